@@ -0,0 +1,369 @@
+// mremap is only declared for GNU sources.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <assert.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "debug.h"
+#include "allocator.h"
+
+// Alignment of every allocation from an arena, enough for any type.
+#define ALLOCATOR_ARENA_ALIGNMENT 16
+
+// Times the size of a page allocation reserved on Windows, for it to grow
+// into without moving.
+#define ALLOCATOR_PAGES_RESERVE 8
+
+static void * allocator_heap_allocate(allocator *a, size_t size) {
+    return malloc(size);
+}
+
+static void * allocator_heap_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    return realloc(data, new_size);
+}
+
+static void allocator_heap_free(allocator *a, void *data, size_t size) {
+    free(data);
+}
+
+allocator allocator_heap = { allocator_heap_allocate, allocator_heap_reallocate, allocator_heap_free };
+
+static uint8_t * allocator_arena_take(allocator_arena *arena, allocator_arena_chunk *chunk, size_t size) {
+    // Returns the next aligned memory of the size in the chunk, or NULL if it
+    // doesn't fit.
+    uintptr_t start = (uintptr_t) (chunk->data + arena->offset);
+    size_t padding = (ALLOCATOR_ARENA_ALIGNMENT - start % ALLOCATOR_ARENA_ALIGNMENT) % ALLOCATOR_ARENA_ALIGNMENT;
+
+    if (chunk->size - arena->offset < padding || chunk->size - arena->offset - padding < size) return NULL;
+
+    arena->offset += padding + size;
+
+    return (uint8_t *) start + padding;
+}
+
+static void * allocator_arena_allocate(allocator *a, size_t size) {
+    allocator_arena *arena = (allocator_arena *) a;
+
+    // Chunks kept by a reset are reused in order, skipping ones too small.
+    while (arena->current != NULL) {
+        uint8_t *data = allocator_arena_take(arena, arena->current, size);
+
+        if (data != NULL) return data;
+
+        if (arena->current->next == NULL) break;
+
+        arena->current = arena->current->next;
+        arena->offset = 0;
+    }
+
+    size_t chunk_size = arena->chunk_size;
+
+    if (size > SIZE_MAX - ALLOCATOR_ARENA_ALIGNMENT - sizeof(allocator_arena_chunk)) return NULL;
+
+    if (chunk_size < size + ALLOCATOR_ARENA_ALIGNMENT) chunk_size = size + ALLOCATOR_ARENA_ALIGNMENT;
+
+    allocator_arena_chunk *chunk = malloc(sizeof(allocator_arena_chunk) + chunk_size);
+
+    if (chunk == NULL) return NULL;
+
+    chunk->next = NULL;
+    chunk->size = chunk_size;
+
+    if (arena->current == NULL) {
+        arena->first = chunk;
+    } else {
+        arena->current->next = chunk;
+    }
+
+    arena->current = chunk;
+    arena->offset = 0;
+
+    return allocator_arena_take(arena, chunk, size);
+}
+
+static bool allocator_arena_last(allocator_arena *arena, void *data, size_t size) {
+    // Whether the memory is the last allocated, which can be resized in place.
+    return arena->current != NULL && (uint8_t *) data + size == arena->current->data + arena->offset;
+}
+
+static void * allocator_arena_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    allocator_arena *arena = (allocator_arena *) a;
+
+    if (allocator_arena_last(arena, data, old_size)) {
+        size_t start = (size_t) ((uint8_t *) data - arena->current->data);
+
+        if (new_size <= arena->current->size - start) {
+            arena->offset = start + new_size;
+            return data;
+        }
+    } else if (new_size <= old_size) {
+        return data;
+    }
+
+    void *moved = allocator_arena_allocate(a, new_size);
+
+    if (moved != NULL) memcpy(moved, data, old_size < new_size ? old_size : new_size);
+
+    return moved;
+}
+
+static void allocator_arena_free(allocator *a, void *data, size_t size) {
+    allocator_arena *arena = (allocator_arena *) a;
+
+    if (allocator_arena_last(arena, data, size)) arena->offset -= size;
+}
+
+void allocator_arena_create(allocator_arena *arena, size_t chunk_size) {
+    arena->allocator.allocate = allocator_arena_allocate;
+    arena->allocator.reallocate = allocator_arena_reallocate;
+    arena->allocator.free = allocator_arena_free;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->offset = 0;
+    arena->chunk_size = chunk_size;
+}
+
+void allocator_arena_destroy(allocator_arena *arena) {
+    allocator_arena_chunk *chunk = arena->first;
+
+    while (chunk != NULL) {
+        allocator_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->offset = 0;
+}
+
+void allocator_arena_reset(allocator_arena *arena) {
+    arena->current = arena->first;
+    arena->offset = 0;
+}
+
+static size_t allocator_cache_class(size_t size) {
+    // Index of the smallest power of two from 16 holding the size.
+    size_t size_class = 0;
+
+    while (((size_t) 16 << size_class) < size) size_class++;
+
+    return size_class;
+}
+
+static void * allocator_cache_allocate(allocator *a, size_t size) {
+    allocator_cache *cache = (allocator_cache *) a;
+
+    if (size > ALLOCATOR_CACHE_MAX_SIZE) return malloc(size);
+
+    size_t size_class = allocator_cache_class(size);
+    void *block = cache->blocks[size_class];
+
+    if (block == NULL) return malloc((size_t) 16 << size_class);
+
+    // Free blocks start with a pointer to the next one.
+    memcpy(&cache->blocks[size_class], block, sizeof(void *));
+    cache->counts[size_class]--;
+
+    return block;
+}
+
+static void allocator_cache_free(allocator *a, void *data, size_t size) {
+    allocator_cache *cache = (allocator_cache *) a;
+
+    if (data == NULL) return;
+
+    size_t size_class = size > ALLOCATOR_CACHE_MAX_SIZE ? 0 : allocator_cache_class(size);
+
+    if (size > ALLOCATOR_CACHE_MAX_SIZE || cache->counts[size_class] == ALLOCATOR_CACHE_BLOCKS) {
+        free(data);
+        return;
+    }
+
+    memcpy(data, &cache->blocks[size_class], sizeof(void *));
+    cache->blocks[size_class] = data;
+    cache->counts[size_class]++;
+}
+
+static void * allocator_cache_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    if (old_size > ALLOCATOR_CACHE_MAX_SIZE && new_size > ALLOCATOR_CACHE_MAX_SIZE) return realloc(data, new_size);
+
+    // Blocks already have room up to the next power of two.
+    if (old_size <= ALLOCATOR_CACHE_MAX_SIZE && new_size <= ALLOCATOR_CACHE_MAX_SIZE
+        && allocator_cache_class(old_size) == allocator_cache_class(new_size)) return data;
+
+    void *moved = allocator_cache_allocate(a, new_size);
+
+    if (moved == NULL) return NULL;
+
+    memcpy(moved, data, old_size < new_size ? old_size : new_size);
+    allocator_cache_free(a, data, old_size);
+
+    return moved;
+}
+
+void allocator_cache_create(allocator_cache *cache) {
+    cache->allocator.allocate = allocator_cache_allocate;
+    cache->allocator.reallocate = allocator_cache_reallocate;
+    cache->allocator.free = allocator_cache_free;
+
+    for (size_t i = 0; i < ALLOCATOR_CACHE_CLASSES; i++) {
+        cache->blocks[i] = NULL;
+        cache->counts[i] = 0;
+    }
+}
+
+void allocator_cache_destroy(allocator_cache *cache) {
+    for (size_t i = 0; i < ALLOCATOR_CACHE_CLASSES; i++) {
+        while (cache->blocks[i] != NULL) {
+            void *block = cache->blocks[i];
+            memcpy(&cache->blocks[i], block, sizeof(void *));
+            free(block);
+        }
+
+        cache->counts[i] = 0;
+    }
+}
+
+size_t allocator_page_size(void) {
+    static size_t page_size = 0;
+
+    if (page_size == 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_size = info.dwPageSize;
+#else
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    return page_size;
+}
+
+static size_t allocator_pages_round(size_t size) {
+    // Sizes rounded up to whole pages, at least one.
+    size_t page_size = allocator_page_size();
+
+    if (size == 0) return page_size;
+
+    if (size > SIZE_MAX - page_size) return 0;
+
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+static void * allocator_pages_map(size_t size) {
+#ifdef _WIN32
+    // Reserve more address space than asked for and commit only the size,
+    // falling back to the size alone when there isn't that much space.
+    void *data = NULL;
+
+    if (size <= SIZE_MAX / ALLOCATOR_PAGES_RESERVE)
+        data = VirtualAlloc(NULL, size * ALLOCATOR_PAGES_RESERVE, MEM_RESERVE, PAGE_NOACCESS);
+
+    if (data == NULL) return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    if (VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+        VirtualFree(data, 0, MEM_RELEASE);
+        return NULL;
+    }
+
+    return data;
+#else
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+static void * allocator_pages_allocate(allocator *a, size_t size) {
+    size = allocator_pages_round(size);
+
+    return size == 0 ? NULL : allocator_pages_map(size);
+}
+
+static void allocator_pages_free(allocator *a, void *data, size_t size) {
+    if (data == NULL) return;
+
+#ifdef _WIN32
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, allocator_pages_round(size));
+#endif
+}
+
+static void * allocator_pages_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    old_size = allocator_pages_round(old_size);
+    new_size = allocator_pages_round(new_size);
+
+    if (new_size == 0) return NULL;
+
+    if (new_size == old_size) return data;
+
+#if defined(__linux__)
+    // The kernel moves the pages to a larger range if they can't grow in
+    // place, without copying them. Shrinking gives the pages back.
+    void *moved = mremap(data, old_size, new_size, MREMAP_MAYMOVE);
+
+    return moved == MAP_FAILED ? NULL : moved;
+#else
+    if (new_size < old_size) {
+#ifdef _WIN32
+        VirtualFree((uint8_t *) data + new_size, old_size - new_size, MEM_DECOMMIT);
+#else
+        munmap((uint8_t *) data + new_size, old_size - new_size);
+#endif
+        return data;
+    }
+
+#ifdef _WIN32
+    // Commit pages of the range reserved with the allocation while it lasts,
+    // including pages decommitted when shrinking.
+    void *end = (uint8_t *) data + old_size;
+    MEMORY_BASIC_INFORMATION info;
+
+    if (VirtualQuery(end, &info, sizeof(info)) != 0 && info.AllocationBase == data
+        && info.State == MEM_RESERVE && info.RegionSize >= new_size - old_size) {
+        return VirtualAlloc(end, new_size - old_size, MEM_COMMIT, PAGE_READWRITE) == NULL ? NULL : data;
+    }
+#else
+    // Map the pages right after the current ones if they're free, growing in
+    // place.
+    void *hint = (uint8_t *) data + old_size;
+    void *extra = mmap(hint, new_size - old_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (extra == hint) return data;
+
+    if (extra != MAP_FAILED) munmap(extra, new_size - old_size);
+#endif
+
+    void *moved = allocator_pages_map(new_size);
+
+    if (moved == NULL) return NULL;
+
+    memcpy(moved, data, old_size);
+    allocator_pages_free(a, data, old_size);
+
+    return moved;
+#endif
+}
+
+allocator allocator_pages = { allocator_pages_allocate, allocator_pages_reallocate, allocator_pages_free };
+
+bool allocator_pages_advise(void *data, size_t size, int advice) {
+#if defined(_WIN32)
+    return true;
+#else
+    int platform_advice = advice == ALLOCATOR_ADVISE_SEQUENTIAL ? MADV_SEQUENTIAL
+        : advice == ALLOCATOR_ADVISE_RANDOM ? MADV_RANDOM
+        : MADV_NORMAL;
+
+    return madvise(data, allocator_pages_round(size), platform_advice) == 0;
+#endif
+}
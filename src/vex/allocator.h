@@ -0,0 +1,111 @@
+/* Allocators the datastructures get their memory from, in place of malloc. */
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Functions of an allocator, called with the allocator itself first so
+// allocators can keep their state in a struct starting with this one. Frees
+// and reallocations are given the size the memory was allocated with, so
+// allocators don't have to store it.
+typedef struct allocator {
+    void * (*allocate)(struct allocator *, size_t);
+    void * (*reallocate)(struct allocator *, void *, size_t, size_t);
+    void (*free)(struct allocator *, void *, size_t);
+} allocator;
+
+// Allocates with malloc, the allocator used by the *_create functions not
+// taking one.
+extern allocator allocator_heap;
+
+// Maps whole pages from the system for each allocation, for very large
+// buffers. Growing them mostly doesn't copy the data: on Linux the pages are
+// moved with mremap, on Windows each allocation reserves 8 times its size and
+// commits pages of that as it grows, and elsewhere pages right after the
+// allocation are mapped when they're free. Past the reserved range, or when
+// the next pages are taken, the data is copied to a new mapping. Shrinking
+// gives the pages past the end back to the system.
+extern allocator allocator_pages;
+
+static inline void * allocator_allocate(allocator *a, size_t size) {
+    return a->allocate(a, size);
+}
+
+static inline void * allocator_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    return a->reallocate(a, data, old_size, new_size);
+}
+
+static inline void allocator_free(allocator *a, void *data, size_t size) {
+    a->free(a, data, size);
+}
+
+// Access patterns hinted with allocator_pages_advise.
+#define ALLOCATOR_ADVISE_NORMAL 0
+#define ALLOCATOR_ADVISE_SEQUENTIAL 1
+#define ALLOCATOR_ADVISE_RANDOM 2
+
+size_t allocator_page_size(void);
+
+// Tells the system how memory from allocator_pages will be accessed, so it
+// reads ahead for sequential access and doesn't for random access.
+bool allocator_pages_advise(void *, size_t, int);
+
+// Chunk of memory allocations of an arena are taken from, in order.
+typedef struct allocator_arena_chunk {
+    struct allocator_arena_chunk *next;
+    size_t size;
+    uint8_t data[];
+} allocator_arena_chunk;
+
+// Allocates by moving an offset forward in chunks of memory, allocating a new
+// chunk when the current one is full. Freeing only gives memory back when it
+// was the last allocation, otherwise everything allocated is freed at once by
+// a reset, keeping the chunks to be reused. For memory with the lifetime of a
+// request, where datastructures created in the arena are never destroyed one
+// by one. Not thread safe.
+typedef struct {
+    allocator allocator;
+    allocator_arena_chunk *first;
+    allocator_arena_chunk *current;
+    // Bytes allocated from the current chunk.
+    size_t offset;
+    size_t chunk_size;
+} allocator_arena;
+
+// Creates an arena allocating chunks of at least the given size. No memory is
+// allocated until the first allocation.
+void allocator_arena_create(allocator_arena *, size_t);
+
+void allocator_arena_destroy(allocator_arena *);
+
+// Frees every allocation at once, without going through the chunks.
+void allocator_arena_reset(allocator_arena *);
+
+// Sizes up to this are rounded to a power of two and kept in a cache when
+// freed. Larger ones go straight to malloc.
+#define ALLOCATOR_CACHE_MAX_SIZE 4096
+
+// Number of sizes cached, the powers of two from 16 bytes to the largest.
+#define ALLOCATOR_CACHE_CLASSES 9
+
+// Freed blocks kept per size, the rest are given back to malloc.
+#define ALLOCATOR_CACHE_BLOCKS 256
+
+// Keeps freed blocks of small sizes in lists to hand out again, so the many
+// small allocations of short lived buffers and strings rarely reach malloc.
+// Each thread uses its own, since the lists aren't locked. Memory can only be
+// freed in the cache it was allocated from.
+typedef struct {
+    allocator allocator;
+    void *blocks[ALLOCATOR_CACHE_CLASSES];
+    size_t counts[ALLOCATOR_CACHE_CLASSES];
+} allocator_cache;
+
+void allocator_cache_create(allocator_cache *);
+
+// Frees the cached blocks. Memory still allocated from the cache must not be
+// freed through it afterwards.
+void allocator_cache_destroy(allocator_cache *);
+
+#endif
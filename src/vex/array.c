@@ -5,12 +5,17 @@
 #include "debug.h"
 
 array * array_create(size_t capacity) {
-    array *s = malloc(sizeof(array) + capacity);
+    return array_create_in(&allocator_heap, capacity);
+}
+
+array * array_create_in(allocator *a, size_t capacity) {
+    array *s = allocator_allocate(a, sizeof(array) + capacity);
 
     if (s == NULL) return NULL;
 
     s->capacity = capacity;
     s->size = 0;
+    s->allocator = a;
 
     return s;
 }
@@ -24,7 +29,7 @@ void * array_get(array *s, size_t offset) {
 }
 
 void array_free(array *s) {
-    free(s);
+    allocator_free(s->allocator, s, sizeof(array) + s->capacity);
 }
 
 array * array_trim(array *s) {
@@ -32,7 +37,7 @@ array * array_trim(array *s) {
     if (s == NULL) return NULL;
 
     if (s->capacity != s->size) {
-        array *new_s = realloc(s, sizeof(array) + s->size);
+        array *new_s = allocator_reallocate(s->allocator, s, sizeof(array) + s->capacity, sizeof(array) + s->size);
 
         if (new_s != NULL) {
             s = new_s;
@@ -55,7 +60,7 @@ array * array_accomodate(array *s, size_t new_size) {
         if (new_capacity < new_size) new_capacity = new_size;
 
         // Reallocate array and update capacity if successful.
-        s = realloc(s, sizeof(array) + new_capacity);
+        s = allocator_reallocate(s->allocator, s, sizeof(array) + s->capacity, sizeof(array) + new_capacity);
 
         if (s != NULL) s->capacity = new_capacity;
     }
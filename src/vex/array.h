@@ -2,15 +2,20 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include "allocator.h"
 
 typedef struct {
     size_t capacity;
     size_t size;
+    // Where the array is allocated, the heap unless created with an allocator.
+    allocator *allocator;
     uint8_t data[];
 } array;
 
 array * array_create(size_t capacity);
 
+array * array_create_in(allocator *a, size_t capacity);
+
 void array_free(array *a);
 
 size_t array_size(array *a);
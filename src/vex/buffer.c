@@ -1,24 +1,65 @@
+// mremap is only declared for GNU sources.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <string.h>
 #include <assert.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "buffer.h"
 #include "debug.h"
 
 bool buffer_set_capacity(buffer *, size_t);
 
+static void buffer_file_free(allocator *, void *, size_t);
+
 bool buffer_create(buffer *b, size_t capacity) {
-    void *new_data = malloc(capacity);
+    return buffer_create_in(b, &allocator_heap, capacity);
+}
+
+static inline bool buffer_is_small(buffer *b) {
+    return b->data == (uint8_t *) b->small;
+}
+
+static inline bool buffer_is_file(buffer *b) {
+    return b->allocator->free == buffer_file_free;
+}
+
+bool buffer_create_in(buffer *b, allocator *a, size_t capacity) {
+    b->allocator = a;
+    b->size = 0;
+
+    if (capacity <= BUFFER_SMALL_SIZE) {
+        b->data = (uint8_t *) b->small;
+        b->capacity = BUFFER_SMALL_SIZE;
+        return true;
+    }
+
+    void *new_data = allocator_allocate(a, capacity);
 
     if (new_data == NULL) return false;
 
     b->data = new_data;
-    b->size = 0;
     b->capacity = capacity;
 
     return true;
 }
 
 void buffer_destroy(buffer *b) {
-    free(b->data);
+    if (!buffer_is_small(b)) allocator_free(b->allocator, b->data, b->capacity);
+}
+
+void buffer_move(buffer *to, buffer *from) {
+    bool small = buffer_is_small(from);
+    *to = *from;
+
+    if (small) to->data = (uint8_t *) to->small;
 }
 
 void buffer_clear(buffer *b) {
@@ -29,13 +70,41 @@ bool buffer_trim(buffer *b) {
     return buffer_set_capacity(b, b->size);
 }
 
+bool buffer_advise(buffer *b, int advice) {
+    if (b->allocator != &allocator_pages || buffer_is_small(b)) return true;
+
+    return allocator_pages_advise(b->data, b->capacity, advice);
+}
+
 size_t buffer_size(buffer *b) {
     return b->size;
 }
 
 bool buffer_set_capacity(buffer *b, size_t new_capacity) {
-    assert(new_capacity > 1); // Capacity must be greater than one to grow.
-    uint8_t *new_data = realloc(b->data, new_capacity);
+    assert(new_capacity >= b->size);
+
+    // The data of a mapped file always stays in the file.
+    if (new_capacity <= BUFFER_SMALL_SIZE && !buffer_is_file(b)) {
+        // Move the data back into the buffer when it fits again.
+        if (!buffer_is_small(b)) {
+            memcpy(b->small, b->data, b->size);
+            allocator_free(b->allocator, b->data, b->capacity);
+            b->data = (uint8_t *) b->small;
+            b->capacity = BUFFER_SMALL_SIZE;
+        }
+
+        return true;
+    }
+
+    uint8_t *new_data;
+
+    if (buffer_is_small(b)) {
+        new_data = allocator_allocate(b->allocator, new_capacity);
+
+        if (new_data != NULL) memcpy(new_data, b->small, b->size);
+    } else {
+        new_data = allocator_reallocate(b->allocator, b->data, b->capacity, new_capacity);
+    }
 
     if (new_data == NULL) return false;
 
@@ -115,3 +184,215 @@ bool buffer_push_buffer(buffer *target, buffer *source) {
     return true;
 }
 
+
+// State of a buffer mapping a file, allocated with the buffer and freed with
+// it. Its allocator resizes the file and maps it again.
+typedef struct {
+    allocator allocator;
+    bool writable;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} buffer_file;
+
+static void * buffer_file_map(buffer_file *f, size_t size) {
+#ifdef _WIN32
+    // Empty files can't be mapped, so buffers of them point at the state,
+    // which is never read with a capacity of 0.
+    if (size == 0) return f;
+
+    f->mapping = CreateFileMappingA(f->file, NULL, f->writable ? PAGE_READWRITE : PAGE_READONLY,
+        (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+
+    if (f->mapping == NULL) return NULL;
+
+    void *data = MapViewOfFile(f->mapping, f->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+
+    if (data == NULL) CloseHandle(f->mapping);
+
+    return data;
+#else
+    // Empty files are mapped with a length of 1, since mappings can't be
+    // empty, and never read past the end of the file.
+    void *data = mmap(NULL, size == 0 ? 1 : size, f->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, f->fd, 0);
+
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+static void buffer_file_unmap(buffer_file *f, void *data, size_t size) {
+#ifdef _WIN32
+    if (size == 0) return;
+
+    UnmapViewOfFile(data);
+    CloseHandle(f->mapping);
+#else
+    munmap(data, size == 0 ? 1 : size);
+#endif
+}
+
+static bool buffer_file_resize(buffer_file *f, size_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG) size;
+
+    return SetFilePointerEx(f->file, offset, NULL, FILE_BEGIN) && SetEndOfFile(f->file);
+#else
+    return ftruncate(f->fd, (off_t) size) == 0;
+#endif
+}
+
+static void * buffer_file_allocate(allocator *a, size_t size) {
+    // The buffer is created with its data mapped, so this is never called.
+    return NULL;
+}
+
+static void * buffer_file_reallocate(allocator *a, void *data, size_t old_size, size_t new_size) {
+    buffer_file *f = (buffer_file *) a;
+
+    if (!f->writable) return NULL;
+
+#if defined(__linux__)
+    // The file is longer than the mapping while growing and never shorter, so
+    // the mapping never reaches past the end of the file.
+    if (new_size > old_size && !buffer_file_resize(f, new_size)) return NULL;
+
+    void *moved = mremap(data, old_size == 0 ? 1 : old_size, new_size == 0 ? 1 : new_size, MREMAP_MAYMOVE);
+
+    if (moved == MAP_FAILED) return NULL;
+
+    if (new_size < old_size) buffer_file_resize(f, new_size);
+
+    return moved;
+#elif defined(_WIN32)
+    // Views can't be resized, so the file is mapped again, which doesn't copy
+    // the data since it's in the file. The file can only be cut while it isn't
+    // mapped.
+    if (new_size < old_size) {
+        buffer_file_unmap(f, data, old_size);
+
+        // If the file can't be cut the view keeps its length, and is only
+        // read up to the new size.
+        return buffer_file_map(f, buffer_file_resize(f, new_size) ? new_size : old_size);
+    }
+
+    // Mapping more than the file has makes it longer.
+    HANDLE old_mapping = f->mapping;
+    void *moved = buffer_file_map(f, new_size);
+
+    if (moved == NULL) {
+        f->mapping = old_mapping;
+        return NULL;
+    }
+
+    if (old_size != 0) {
+        UnmapViewOfFile(data);
+        CloseHandle(old_mapping);
+    }
+
+    return moved;
+#else
+    // The data is in the file, so mapping it again doesn't copy it.
+    if (new_size > old_size && !buffer_file_resize(f, new_size)) return NULL;
+
+    void *moved = buffer_file_map(f, new_size);
+
+    if (moved == NULL) return NULL;
+
+    buffer_file_unmap(f, data, old_size);
+
+    if (new_size < old_size) buffer_file_resize(f, new_size);
+
+    return moved;
+#endif
+}
+
+static void buffer_file_free(allocator *a, void *data, size_t size) {
+    buffer_file *f = (buffer_file *) a;
+    buffer_file_unmap(f, data, size);
+#ifdef _WIN32
+    CloseHandle(f->file);
+#else
+    close(f->fd);
+#endif
+    free(f);
+}
+
+bool buffer_map_file(buffer *b, const char *path, int mode) {
+    buffer_file *f = malloc(sizeof(buffer_file));
+
+    if (f == NULL) return false;
+
+    f->allocator.allocate = buffer_file_allocate;
+    f->allocator.reallocate = buffer_file_reallocate;
+    f->allocator.free = buffer_file_free;
+    f->writable = mode == BUFFER_MAP_WRITE;
+    size_t size;
+
+#ifdef _WIN32
+    f->mapping = NULL;
+    f->file = CreateFileA(path, f->writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+        f->writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    LARGE_INTEGER file_size;
+
+    if (f->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(f->file, &file_size) || (uint64_t) file_size.QuadPart > SIZE_MAX) {
+        if (f->file != INVALID_HANDLE_VALUE) CloseHandle(f->file);
+
+        free(f);
+        return false;
+    }
+
+    size = (size_t) file_size.QuadPart;
+#else
+    f->fd = open(path, f->writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+
+    struct stat st;
+
+    if (f->fd < 0 || fstat(f->fd, &st) != 0 || (uint64_t) st.st_size > SIZE_MAX) {
+        if (f->fd >= 0) close(f->fd);
+
+        free(f);
+        return false;
+    }
+
+    size = (size_t) st.st_size;
+#endif
+
+    void *data = buffer_file_map(f, size);
+
+    if (data == NULL) {
+#ifdef _WIN32
+        CloseHandle(f->file);
+#else
+        close(f->fd);
+#endif
+        free(f);
+        return false;
+    }
+
+    b->allocator = &f->allocator;
+    b->data = data;
+    b->size = size;
+    b->capacity = size;
+
+    return true;
+}
+
+bool buffer_sync(buffer *b) {
+    if (!buffer_is_file(b) || !((buffer_file *) b->allocator)->writable) return true;
+
+    // Growing leaves the file as long as the capacity.
+    if (!buffer_set_capacity(b, b->size)) return false;
+
+    if (b->size == 0) return true;
+
+#ifdef _WIN32
+    return FlushViewOfFile(b->data, b->size) && FlushFileBuffers(((buffer_file *) b->allocator)->file);
+#else
+    return msync(b->data, b->size, MS_SYNC) == 0;
+#endif
+}
@@ -4,23 +4,65 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "allocator.h"
 
+// Bytes kept in the buffer itself before the data is allocated.
+#define BUFFER_SMALL_SIZE 24
+
+// Data of up to BUFFER_SMALL_SIZE bytes is kept in `small`, with `data`
+// pointing to it, and only moved to allocated memory when the buffer grows
+// past it. Since a small buffer points into itself, buffers must be moved with
+// buffer_move rather than copied by value.
 typedef struct {
     size_t size;
     size_t capacity;
     uint8_t *data;
+    // Where the data is allocated, the heap unless created with an allocator.
+    allocator *allocator;
+    uint64_t small[BUFFER_SMALL_SIZE / sizeof(uint64_t)];
 } buffer;
 
 bool buffer_create(buffer *, size_t);
 
+bool buffer_create_in(buffer *, allocator *, size_t);
+
+// Modes of mapping a file.
+#define BUFFER_MAP_READ 0
+// Reads and writes, creating the file if it's missing.
+#define BUFFER_MAP_WRITE 1
+
+// Maps a file into a buffer, so its data is read and written in place through
+// the page cache instead of being copied. Buffers mapped for writing can grow
+// and shrink, which resizes the file and maps it again. The file stays as long
+// as the capacity until the buffer is synced. Destroying the buffer unmaps and
+// closes the file.
+bool buffer_map_file(buffer *, const char *, int);
+
+// Trims a buffer mapping a file, so the file is as long as the size, and
+// writes the changed data to the disk. Other buffers are left as they are.
+bool buffer_sync(buffer *);
+
 void buffer_destroy(buffer *);
 
+// Moves a buffer to another place, the first, leaving the second unused.
+void buffer_move(buffer *, buffer *);
+
 void buffer_clear(buffer *);
 
+// Reduces the capacity to the size. Buffers in allocator_pages give the
+// pages past the end back to the system.
 bool buffer_trim(buffer *);
 
+// Hints how the data of a buffer in allocator_pages will be accessed, with one
+// of the ALLOCATOR_ADVISE_* values. Other buffers ignore it.
+bool buffer_advise(buffer *, int);
+
 size_t buffer_size(buffer *);
 
+// Grows the capacity to hold at least the given size, so data can be written
+// past the size before adding it.
+bool buffer_ensure_capacity(buffer *, size_t);
+
 void * buffer_push(buffer *, size_t);
 
 void buffer_pop(buffer *, size_t);
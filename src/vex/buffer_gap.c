@@ -0,0 +1,130 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "buffer_gap.h"
+
+// The capacity is kept a multiple of this, so the data after the gap, which
+// ends at the capacity, is as aligned as the data before it for any element
+// size dividing it.
+#define BUFFER_GAP_ALIGNMENT 16
+
+static size_t buffer_gap_round(size_t capacity) {
+    // Rounds the capacity up to the alignment, at least one, or 0 if too large.
+    if (capacity == 0) return BUFFER_GAP_ALIGNMENT;
+
+    if (capacity > SIZE_MAX - BUFFER_GAP_ALIGNMENT) return 0;
+
+    return (capacity + BUFFER_GAP_ALIGNMENT - 1) / BUFFER_GAP_ALIGNMENT * BUFFER_GAP_ALIGNMENT;
+}
+
+bool buffer_gap_create(buffer_gap *g, size_t capacity) {
+    return buffer_gap_create_in(g, &allocator_heap, capacity);
+}
+
+bool buffer_gap_create_in(buffer_gap *g, allocator *a, size_t capacity) {
+    capacity = buffer_gap_round(capacity);
+
+    if (capacity == 0) return false;
+
+    g->data = allocator_allocate(a, capacity);
+
+    if (g->data == NULL) return false;
+
+    g->size = 0;
+    g->capacity = capacity;
+    g->gap = 0;
+    g->allocator = a;
+
+    return true;
+}
+
+void buffer_gap_destroy(buffer_gap *g) {
+    allocator_free(g->allocator, g->data, g->capacity);
+}
+
+void buffer_gap_clear(buffer_gap *g) {
+    g->size = 0;
+    g->gap = 0;
+}
+
+size_t buffer_gap_size(buffer_gap *g) {
+    return g->size;
+}
+
+static void buffer_gap_move(buffer_gap *g, size_t offset) {
+    // Moves the gap to the offset, moving the data between the two across it.
+    size_t gap_size = g->capacity - g->size;
+
+    if (offset < g->gap) {
+        memmove(g->data + offset + gap_size, g->data + offset, g->gap - offset);
+    } else if (offset > g->gap) {
+        memmove(g->data + g->gap, g->data + g->gap + gap_size, offset - g->gap);
+    }
+
+    g->gap = offset;
+}
+
+static bool buffer_gap_ensure_capacity(buffer_gap *g, size_t new_size) {
+    if (g->capacity >= new_size) return true;
+
+    size_t new_capacity = (g->capacity * 3) / 2;
+
+    if (new_capacity < new_size) new_capacity = new_size;
+
+    new_capacity = buffer_gap_round(new_capacity);
+
+    if (new_capacity == 0) return false;
+
+    uint8_t *new_data = allocator_reallocate(g->allocator, g->data, g->capacity, new_capacity);
+
+    if (new_data == NULL) return false;
+
+    // The data after the gap stays at the end of the capacity.
+    size_t after = g->size - g->gap;
+    memmove(new_data + new_capacity - after, new_data + g->capacity - after, after);
+    g->data = new_data;
+    g->capacity = new_capacity;
+
+    return true;
+}
+
+void * buffer_gap_add(buffer_gap *g, size_t offset, size_t size) {
+    assert(offset <= g->size);
+
+    if (!buffer_gap_ensure_capacity(g, g->size + size)) return NULL;
+
+    buffer_gap_move(g, offset);
+    uint8_t *data = g->data + g->gap;
+    g->gap += size;
+    g->size += size;
+
+    return data;
+}
+
+void * buffer_gap_push(buffer_gap *g, size_t size) {
+    return buffer_gap_add(g, g->size, size);
+}
+
+bool buffer_gap_remove(buffer_gap *g, size_t offset, size_t size) {
+    assert(offset + size <= g->size);
+
+    // The removed data after the gap becomes part of it.
+    buffer_gap_move(g, offset);
+    g->size -= size;
+
+    return true;
+}
+
+void * buffer_gap_get(buffer_gap *g, size_t offset) {
+    assert(offset < g->size);
+
+    if (offset < g->gap) return g->data + offset;
+
+    return g->data + offset + g->capacity - g->size;
+}
+
+void * buffer_gap_view(buffer_gap *g) {
+    buffer_gap_move(g, g->size);
+
+    return g->data;
+}
@@ -0,0 +1,55 @@
+/* Gap buffer, a buffer keeping its free space at the last edit. */
+#ifndef BUFFER_GAP_H
+#define BUFFER_GAP_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+
+// Works like a buffer, except the unused capacity is a gap kept where data was
+// last added or removed instead of at the end. Adding or removing data only
+// moves the data between the gap and the offset changed, so runs of edits near
+// each other, such as inserting at the front over and over, don't move the
+// rest of the data each time.
+//
+// The data is in two parts, `data` up to `gap`, then the rest after the gap
+// at the end of the capacity. Data added in one piece is never split by the
+// gap as long as data is added and removed in whole pieces, such as elements
+// of one size, so buffer_gap_get can return any piece directly. The capacity
+// is kept a multiple of 16, so pieces after the gap are aligned like those
+// before it when their size divides 16.
+typedef struct {
+    uint8_t *data;
+    // Bytes of data, not counting the gap.
+    size_t size;
+    size_t capacity;
+    // Offset of the gap, where the data after it would continue.
+    size_t gap;
+    allocator *allocator;
+} buffer_gap;
+
+bool buffer_gap_create(buffer_gap *, size_t);
+
+bool buffer_gap_create_in(buffer_gap *, allocator *, size_t);
+
+void buffer_gap_destroy(buffer_gap *);
+
+void buffer_gap_clear(buffer_gap *);
+
+size_t buffer_gap_size(buffer_gap *);
+
+// Adds the given number of bytes at an offset, returning where to write them.
+void * buffer_gap_add(buffer_gap *, size_t, size_t);
+
+void * buffer_gap_push(buffer_gap *, size_t);
+
+bool buffer_gap_remove(buffer_gap *, size_t, size_t);
+
+// Returns the data at an offset, which continues up to the gap.
+void * buffer_gap_get(buffer_gap *, size_t);
+
+// Moves the gap to the end, returning all the data in one piece. Valid until
+// the next add or remove.
+void * buffer_gap_view(buffer_gap *);
+
+#endif
@@ -0,0 +1,506 @@
+// pread and pwrite are only declared for GNU sources with strict C.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+#ifdef BUFFER_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "debug.h"
+#include "buffer_io.h"
+
+// Bytes read at first from descriptors of unknown size, doubled as they fill.
+#define BUFFER_IO_CHUNK 65536
+
+// Most buffers passed to one readv or writev.
+#define BUFFER_IO_VECTORS 64
+
+// Most bytes passed to one read or write, which Linux limits to a little under
+// 2 GiB and Windows to an int.
+#define BUFFER_IO_MAX 0x7ffff000
+
+static long buffer_io_read_some(int fd, void *data, size_t size) {
+    // Reads once, retrying when interrupted. Returns -1 on errors.
+    if (size > BUFFER_IO_MAX) size = BUFFER_IO_MAX;
+
+    for (;;) {
+#ifdef _WIN32
+        long n = _read(fd, data, (unsigned) size);
+#else
+        long n = (long) read(fd, data, size);
+#endif
+
+        if (n >= 0 || errno != EINTR) return n;
+    }
+}
+
+static bool buffer_io_write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        size_t part = size > BUFFER_IO_MAX ? BUFFER_IO_MAX : size;
+#ifdef _WIN32
+        long n = _write(fd, data, (unsigned) part);
+#else
+        long n = (long) write(fd, data, part);
+#endif
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            return false;
+        }
+
+        data += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+bool buffer_read_fd(buffer *b, int fd) {
+    size_t chunk = BUFFER_IO_CHUNK;
+
+#ifndef _WIN32
+    // Room for the whole file and one more byte, so the read finding the end
+    // doesn't grow the buffer.
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t) st.st_size < SIZE_MAX - b->size) {
+        chunk = (size_t) st.st_size + 1;
+    }
+#endif
+
+    for (;;) {
+        if (chunk > SIZE_MAX - b->size || !buffer_ensure_capacity(b, b->size + chunk)) return false;
+
+        long n = buffer_io_read_some(fd, b->data + b->size, b->capacity - b->size);
+
+        if (n < 0) return false;
+
+        if (n == 0) return true;
+
+        b->size += (size_t) n;
+
+        // Reads of growing size once the first is filled.
+        if (b->size == b->capacity && chunk <= SIZE_MAX / 2) chunk *= 2;
+    }
+}
+
+bool buffer_write_fd(buffer *b, int fd) {
+    return buffer_io_write_all(fd, b->data, b->size);
+}
+
+bool buffer_read_fd_many(buffer *buffers, size_t count, int fd, size_t *read_size) {
+    size_t n;
+
+#ifdef _WIN32
+    // Without readv, each buffer is read into until one isn't filled.
+    n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t space = buffers[i].capacity - buffers[i].size;
+
+        if (space == 0) continue;
+
+        long part = buffer_io_read_some(fd, buffers[i].data + buffers[i].size, space);
+
+        if (part < 0) return false;
+
+        buffers[i].size += (size_t) part;
+        n += (size_t) part;
+
+        if ((size_t) part < space) break;
+    }
+#else
+    struct iovec vectors[BUFFER_IO_VECTORS];
+    int vector_count = 0;
+
+    for (size_t i = 0; i < count && vector_count < BUFFER_IO_VECTORS; i++) {
+        if (buffers[i].capacity == buffers[i].size) continue;
+
+        vectors[vector_count].iov_base = buffers[i].data + buffers[i].size;
+        vectors[vector_count].iov_len = buffers[i].capacity - buffers[i].size;
+        vector_count++;
+    }
+
+    ssize_t result;
+
+    do {
+        result = readv(fd, vectors, vector_count);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) return false;
+
+    n = (size_t) result;
+
+    // The bytes fill the buffers in order.
+    for (size_t i = 0, left = n; i < count && left > 0; i++) {
+        size_t part = buffers[i].capacity - buffers[i].size;
+
+        if (part > left) part = left;
+
+        buffers[i].size += part;
+        left -= part;
+    }
+#endif
+
+    *read_size = n;
+
+    return true;
+}
+
+bool buffer_write_fd_many(buffer *buffers, size_t count, int fd) {
+#ifdef _WIN32
+    for (size_t i = 0; i < count; i++) {
+        if (!buffer_io_write_all(fd, buffers[i].data, buffers[i].size)) return false;
+    }
+
+    return true;
+#else
+    // Position in the data of all the buffers written so far.
+    size_t index = 0, offset = 0;
+
+    for (;;) {
+        struct iovec vectors[BUFFER_IO_VECTORS];
+        int vector_count = 0;
+
+        for (size_t i = index; i < count && vector_count < BUFFER_IO_VECTORS; i++) {
+            size_t start = i == index ? offset : 0;
+
+            if (buffers[i].size == start) continue;
+
+            vectors[vector_count].iov_base = buffers[i].data + start;
+            vectors[vector_count].iov_len = buffers[i].size - start;
+            vector_count++;
+        }
+
+        if (vector_count == 0) return true;
+
+        ssize_t result = writev(fd, vectors, vector_count);
+
+        if (result < 0) {
+            if (errno == EINTR) continue;
+
+            return false;
+        }
+
+        // Moves the position past the bytes written.
+        for (size_t left = (size_t) result; left > 0 || (index < count && offset == buffers[index].size);) {
+            if (offset == buffers[index].size) {
+                index++;
+                offset = 0;
+                continue;
+            }
+
+            size_t part = buffers[index].size - offset;
+
+            if (part > left) part = left;
+
+            offset += part;
+            left -= part;
+        }
+    }
+#endif
+}
+
+static bool buffer_io_request_create(buffer_io *io, buffer_io_request *r, buffer *b, int fd, int kind, uint64_t offset, size_t size) {
+    if (io->queued + io->pending >= io->entries) return false;
+
+    r->buffer = b;
+    r->fd = fd;
+    r->kind = kind;
+    r->offset = offset;
+    r->size = size > BUFFER_IO_MAX ? BUFFER_IO_MAX : size;
+    r->transferred = 0;
+    r->failed = false;
+    r->next = NULL;
+
+    return true;
+}
+
+static void buffer_io_complete(buffer_io *io, buffer_io_request *r, long result) {
+    if (result < 0) {
+        r->failed = true;
+    } else {
+        r->transferred = (size_t) result;
+
+        if (r->kind == BUFFER_IO_READ) r->buffer->size += (size_t) result;
+    }
+
+    io->pending--;
+
+    if (r->callback != NULL) r->callback(r);
+}
+
+#ifdef BUFFER_IO_URING
+
+static int buffer_io_enter(buffer_io *io, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, io->ring, submit, wait, flags, NULL, 0);
+}
+
+bool buffer_io_create(buffer_io *io, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    io->ring = (int) syscall(__NR_io_uring_setup, entries, &params);
+
+    if (io->ring < 0) return false;
+
+    io->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings at once.
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (single) {
+        if (io->cq_map_size > io->sq_map_size) io->sq_map_size = io->cq_map_size;
+
+        io->cq_map_size = io->sq_map_size;
+    }
+
+    io->sq_map = mmap(NULL, io->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+    io->cq_map = single || io->sq_map == MAP_FAILED ? io->sq_map
+        : mmap(NULL, io->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQES);
+
+    if (io->sq_map == MAP_FAILED || io->cq_map == MAP_FAILED || io->sqes == MAP_FAILED) {
+        if (io->sqes != MAP_FAILED) munmap(io->sqes, io->sqes_size);
+
+        if (io->cq_map != MAP_FAILED && !single) munmap(io->cq_map, io->cq_map_size);
+
+        if (io->sq_map != MAP_FAILED) munmap(io->sq_map, io->sq_map_size);
+
+        close(io->ring);
+        return false;
+    }
+
+    uint8_t *sq = io->sq_map;
+    uint8_t *cq = io->cq_map;
+    io->sq_head = (unsigned *) (sq + params.sq_off.head);
+    io->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    io->sq_array = (unsigned *) (sq + params.sq_off.array);
+    io->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    io->cq_head = (unsigned *) (cq + params.cq_off.head);
+    io->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    io->cqes = cq + params.cq_off.cqes;
+    io->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+
+    // The completion ring is at least as large, so it never overflows.
+    io->entries = params.sq_entries;
+    io->queued = 0;
+    io->pending = 0;
+
+    return true;
+}
+
+void buffer_io_destroy(buffer_io *io) {
+    munmap(io->sqes, io->sqes_size);
+
+    if (io->cq_map != io->sq_map) munmap(io->cq_map, io->cq_map_size);
+
+    munmap(io->sq_map, io->sq_map_size);
+    close(io->ring);
+}
+
+static bool buffer_io_queue(buffer_io *io, buffer_io_request *r) {
+    // Only this thread writes the tail, and the kernel has taken every entry
+    // up to the head.
+    unsigned tail = *io->sq_tail;
+    unsigned index = tail & io->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *) io->sqes + index;
+    buffer *b = r->buffer;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = r->kind == BUFFER_IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = r->fd;
+    sqe->off = r->offset;
+    sqe->addr = (uint64_t) (uintptr_t) (r->kind == BUFFER_IO_READ ? b->data + b->size : b->data);
+    sqe->len = (unsigned) r->size;
+    sqe->user_data = (uint64_t) (uintptr_t) r;
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->queued++;
+
+    return true;
+}
+
+bool buffer_io_submit(buffer_io *io) {
+    while (io->queued > 0) {
+        int submitted = buffer_io_enter(io, (unsigned) io->queued, 0, 0);
+
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+
+            return false;
+        }
+
+        io->queued -= (size_t) submitted;
+        io->pending += (size_t) submitted;
+    }
+
+    return true;
+}
+
+size_t buffer_io_poll(buffer_io *io, bool wait) {
+    size_t collected = 0;
+
+    for (;;) {
+        unsigned head = *io->cq_head;
+        unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe *cqe = (struct io_uring_cqe *) io->cqes + (head & io->cq_mask);
+            buffer_io_request *r = (buffer_io_request *) (uintptr_t) cqe->user_data;
+            long result = cqe->res;
+
+            // Free the entry before the callback, which may queue more.
+            __atomic_store_n(io->cq_head, ++head, __ATOMIC_RELEASE);
+            buffer_io_complete(io, r, result);
+            collected++;
+        }
+
+        if (collected > 0 || !wait || io->pending == 0) return collected;
+
+        if (buffer_io_enter(io, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return collected;
+    }
+}
+
+#else
+
+bool buffer_io_create(buffer_io *io, unsigned entries) {
+    io->queued_first = NULL;
+    io->queued_last = NULL;
+    io->completed_first = NULL;
+    io->completed_last = NULL;
+    io->entries = entries;
+    io->queued = 0;
+    io->pending = 0;
+
+    return entries > 0;
+}
+
+void buffer_io_destroy(buffer_io *io) {
+}
+
+static bool buffer_io_queue(buffer_io *io, buffer_io_request *r) {
+    if (io->queued_last == NULL) {
+        io->queued_first = r;
+    } else {
+        io->queued_last->next = r;
+    }
+
+    io->queued_last = r;
+    io->queued++;
+
+    return true;
+}
+
+static long buffer_io_transfer(buffer_io_request *r) {
+    // Reads or writes until done, the end of the file or an error.
+    uint8_t *data = r->kind == BUFFER_IO_READ ? r->buffer->data + r->buffer->size : r->buffer->data;
+    size_t done = 0;
+
+    while (done < r->size) {
+#ifdef _WIN32
+        long n = -1;
+
+        if (_lseeki64(r->fd, (__int64) (r->offset + done), SEEK_SET) >= 0) {
+            n = r->kind == BUFFER_IO_READ
+                ? _read(r->fd, data + done, (unsigned) (r->size - done))
+                : _write(r->fd, data + done, (unsigned) (r->size - done));
+        }
+#else
+        long n = r->kind == BUFFER_IO_READ
+            ? (long) pread(r->fd, data + done, r->size - done, (off_t) (r->offset + done))
+            : (long) pwrite(r->fd, data + done, r->size - done, (off_t) (r->offset + done));
+#endif
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            return done > 0 ? (long) done : -1;
+        }
+
+        if (n == 0) break;
+
+        done += (size_t) n;
+    }
+
+    return (long) done;
+}
+
+bool buffer_io_submit(buffer_io *io) {
+    while (io->queued_first != NULL) {
+        buffer_io_request *r = io->queued_first;
+        io->queued_first = r->next;
+
+        if (io->queued_first == NULL) io->queued_last = NULL;
+
+        // The result is kept in the request until it's collected.
+        long result = buffer_io_transfer(r);
+        r->failed = result < 0;
+        r->transferred = result < 0 ? 0 : (size_t) result;
+        r->next = NULL;
+
+        if (io->completed_last == NULL) {
+            io->completed_first = r;
+        } else {
+            io->completed_last->next = r;
+        }
+
+        io->completed_last = r;
+        io->queued--;
+        io->pending++;
+    }
+
+    return true;
+}
+
+size_t buffer_io_poll(buffer_io *io, bool wait) {
+    // Everything submitted has already completed.
+    size_t collected = 0;
+
+    while (io->completed_first != NULL) {
+        buffer_io_request *r = io->completed_first;
+        io->completed_first = r->next;
+
+        if (io->completed_first == NULL) io->completed_last = NULL;
+
+        buffer_io_complete(io, r, r->failed ? -1 : (long) r->transferred);
+        collected++;
+    }
+
+    return collected;
+}
+
+#endif
+
+bool buffer_io_read(buffer_io *io, buffer_io_request *r, buffer *b, int fd, uint64_t offset, size_t size) {
+    if (!buffer_io_request_create(io, r, b, fd, BUFFER_IO_READ, offset, size)) return false;
+
+    // The data is read past the size, so the room must be there first.
+    if (r->size > SIZE_MAX - b->size || !buffer_ensure_capacity(b, b->size + r->size)) return false;
+
+    return buffer_io_queue(io, r);
+}
+
+bool buffer_io_write(buffer_io *io, buffer_io_request *r, buffer *b, int fd, uint64_t offset) {
+    if (!buffer_io_request_create(io, r, b, fd, BUFFER_IO_WRITE, offset, b->size)) return false;
+
+    return buffer_io_queue(io, r);
+}
+
+size_t buffer_io_pending(buffer_io *io) {
+    return io->pending;
+}
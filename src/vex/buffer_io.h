@@ -0,0 +1,113 @@
+/* Reading and writing buffers from and to files and sockets. */
+#ifndef BUFFER_IO_H
+#define BUFFER_IO_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+// Reads a file descriptor to its end, adding the data to the buffer. Regular
+// files are read in one call after growing the buffer to their size, other
+// descriptors in reads of growing size. Blocks until the end, so sockets are
+// read to their end only once the other side closes them.
+bool buffer_read_fd(buffer *, int);
+
+// Writes all the data of a buffer, continuing after partial writes.
+bool buffer_write_fd(buffer *, int);
+
+// Reads once into the free capacity of several buffers in order, adding the
+// bytes read to their sizes, with one readv where available. Gives the number
+// of bytes read, 0 at the end of the file. Reserve capacity with
+// buffer_ensure_capacity first.
+bool buffer_read_fd_many(buffer *, size_t, int, size_t *);
+
+// Writes all the data of several buffers in order, with as few writev calls
+// as the system allows where available.
+bool buffer_write_fd_many(buffer *, size_t, int);
+
+#define BUFFER_IO_READ 0
+#define BUFFER_IO_WRITE 1
+
+// A read or write queued in a buffer_io. It must stay in place, and its buffer
+// unchanged, until it completes.
+typedef struct buffer_io_request {
+    buffer *buffer;
+    int fd;
+    int kind;
+    uint64_t offset;
+    // Bytes to read, or to write from the start of the buffer.
+    size_t size;
+    // Set on completion. Reads and writes can complete with fewer bytes than
+    // asked for, such as at the end of a file, and can be queued again for
+    // the rest.
+    size_t transferred;
+    bool failed;
+    // Set by the caller before queueing, to be called on completion unless
+    // NULL, with `data` left for it to use.
+    void (*callback)(struct buffer_io_request *);
+    void *data;
+    struct buffer_io_request *next;
+} buffer_io_request;
+
+// Batches reads and writes at offsets of files, submitting all the queued ones
+// at once and collecting them as they complete. With BUFFER_IO_URING defined
+// on Linux they go through an io_uring, with a system call to submit a batch
+// and none to collect completions already there. Otherwise they're done one
+// after another with pread and pwrite when submitted.
+typedef struct {
+#ifdef BUFFER_IO_URING
+    int ring;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    void *cqes;
+    unsigned cq_mask;
+#else
+    buffer_io_request *queued_first;
+    buffer_io_request *queued_last;
+    buffer_io_request *completed_first;
+    buffer_io_request *completed_last;
+#endif
+    // Most requests queued and pending at once.
+    size_t entries;
+    // Queued and not yet submitted.
+    size_t queued;
+    // Submitted and not yet collected.
+    size_t pending;
+} buffer_io;
+
+// Creates a buffer_io queueing up to the given number of requests at a time.
+bool buffer_io_create(buffer_io *, unsigned);
+
+// Destroys a buffer_io. Requests still pending are abandoned, so it should be
+// polled until none are left first.
+void buffer_io_destroy(buffer_io *);
+
+// Queues a read of a number of bytes at an offset of a file, added to the end
+// of the buffer when it completes. Fails when the queue is full.
+bool buffer_io_read(buffer_io *, buffer_io_request *, buffer *, int, uint64_t, size_t);
+
+// Queues a write of the data of a buffer at an offset of a file. Fails when
+// the queue is full.
+bool buffer_io_write(buffer_io *, buffer_io_request *, buffer *, int, uint64_t);
+
+// Submits the queued requests.
+bool buffer_io_submit(buffer_io *);
+
+// Collects completed requests, calling their callbacks. Waits for at least one
+// if asked to while any are pending. Returns the number collected.
+size_t buffer_io_poll(buffer_io *, bool);
+
+// Number of requests submitted and not yet collected.
+size_t buffer_io_pending(buffer_io *);
+
+#endif
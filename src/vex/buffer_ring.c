@@ -0,0 +1,181 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "buffer_ring.h"
+
+// Smallest capacity of a ring.
+#define BUFFER_RING_MIN_CAPACITY 16
+
+bool buffer_ring_create(buffer_ring *r, size_t capacity) {
+    return buffer_ring_create_in(r, &allocator_heap, capacity);
+}
+
+bool buffer_ring_create_in(buffer_ring *r, allocator *a, size_t capacity) {
+    size_t rounded = BUFFER_RING_MIN_CAPACITY;
+
+    while (rounded < capacity) {
+        if (rounded > SIZE_MAX / 2) return false;
+
+        rounded *= 2;
+    }
+
+    r->data = allocator_allocate(a, rounded);
+
+    if (r->data == NULL) return false;
+
+    r->size = 0;
+    r->capacity = rounded;
+    r->start = 0;
+    r->allocator = a;
+
+    return true;
+}
+
+void buffer_ring_destroy(buffer_ring *r) {
+    allocator_free(r->allocator, r->data, r->capacity);
+}
+
+void buffer_ring_clear(buffer_ring *r) {
+    r->size = 0;
+    r->start = 0;
+}
+
+size_t buffer_ring_size(buffer_ring *r) {
+    return r->size;
+}
+
+bool buffer_ring_reserve(buffer_ring *r, size_t size) {
+    if (r->capacity - r->size >= size) return true;
+
+    if (size > SIZE_MAX - r->size) return false;
+
+    size_t new_capacity = r->capacity;
+
+    while (new_capacity - r->size < size) {
+        if (new_capacity > SIZE_MAX / 2) return false;
+
+        new_capacity *= 2;
+    }
+
+    uint8_t *new_data = allocator_reallocate(r->allocator, r->data, r->capacity, new_capacity);
+
+    if (new_data == NULL) return false;
+
+    // Data wrapped to the beginning continues after the old end instead, which
+    // has room for it since the capacity at least doubled.
+    if (r->start + r->size > r->capacity) {
+        memcpy(new_data + r->capacity, new_data, r->start + r->size - r->capacity);
+    }
+
+    r->data = new_data;
+    r->capacity = new_capacity;
+
+    return true;
+}
+
+static void buffer_ring_copy_in(buffer_ring *r, size_t offset, const void *data, size_t size) {
+    // Copies to an offset from the start of the capacity, wrapping past the end.
+    size_t first = r->capacity - offset;
+
+    if (first > size) first = size;
+
+    memcpy(r->data + offset, data, first);
+    memcpy(r->data, (const uint8_t *) data + first, size - first);
+}
+
+static void buffer_ring_copy_out(buffer_ring *r, size_t offset, void *data, size_t size) {
+    size_t first = r->capacity - offset;
+
+    if (first > size) first = size;
+
+    memcpy(data, r->data + offset, first);
+    memcpy((uint8_t *) data + first, r->data, size - first);
+}
+
+bool buffer_ring_push(buffer_ring *r, const void *data, size_t size) {
+    if (!buffer_ring_reserve(r, size)) return false;
+
+    buffer_ring_copy_in(r, (r->start + r->size) & (r->capacity - 1), data, size);
+    r->size += size;
+
+    return true;
+}
+
+bool buffer_ring_push_front(buffer_ring *r, const void *data, size_t size) {
+    if (!buffer_ring_reserve(r, size)) return false;
+
+    r->start = (r->start - size) & (r->capacity - 1);
+    buffer_ring_copy_in(r, r->start, data, size);
+    r->size += size;
+
+    return true;
+}
+
+bool buffer_ring_pop(buffer_ring *r, void *data, size_t size) {
+    if (size > r->size) return false;
+
+    r->size -= size;
+
+    if (data != NULL) buffer_ring_copy_out(r, (r->start + r->size) & (r->capacity - 1), data, size);
+
+    if (r->size == 0) r->start = 0;
+
+    return true;
+}
+
+bool buffer_ring_pop_front(buffer_ring *r, void *data, size_t size) {
+    if (size > r->size) return false;
+
+    if (data != NULL) buffer_ring_copy_out(r, r->start, data, size);
+
+    r->start = (r->start + size) & (r->capacity - 1);
+    r->size -= size;
+
+    // Starting over at the beginning when empty keeps the free space in one
+    // span.
+    if (r->size == 0) r->start = 0;
+
+    return true;
+}
+
+bool buffer_ring_read(buffer_ring *r, size_t offset, void *data, size_t size) {
+    if (offset > r->size || size > r->size - offset) return false;
+
+    buffer_ring_copy_out(r, (r->start + offset) & (r->capacity - 1), data, size);
+
+    return true;
+}
+
+static size_t buffer_ring_split(buffer_ring *r, size_t offset, size_t size, buffer_ring_span spans[2]) {
+    // Splits the bytes from an offset at the end of the capacity.
+    if (size == 0) return 0;
+
+    size_t first = r->capacity - offset;
+
+    spans[0].data = r->data + offset;
+
+    if (first >= size) {
+        spans[0].size = size;
+        return 1;
+    }
+
+    spans[0].size = first;
+    spans[1].data = r->data;
+    spans[1].size = size - first;
+
+    return 2;
+}
+
+size_t buffer_ring_spans(buffer_ring *r, buffer_ring_span spans[2]) {
+    return buffer_ring_split(r, r->start, r->size, spans);
+}
+
+size_t buffer_ring_free_spans(buffer_ring *r, buffer_ring_span spans[2]) {
+    return buffer_ring_split(r, (r->start + r->size) & (r->capacity - 1), r->capacity - r->size, spans);
+}
+
+void buffer_ring_commit(buffer_ring *r, size_t size) {
+    assert(size <= r->capacity - r->size);
+
+    r->size += size;
+}
@@ -0,0 +1,75 @@
+/* Ring buffer, a buffer that can be added to and removed from at both ends. */
+#ifndef BUFFER_RING_H
+#define BUFFER_RING_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+
+// Keeps the data in a circle through its capacity, starting at `start` and
+// wrapping around to the beginning past the end, so removing from the front
+// only moves the start instead of the data after it. For queues, such as data
+// received and not yet handled. The capacity is a power of two so positions
+// wrap with a mask.
+//
+// Since the data can wrap, it's copied in and out, or reached in at most two
+// spans with buffer_ring_spans and buffer_ring_free_spans.
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    // Offset of the first byte of data.
+    size_t start;
+    allocator *allocator;
+} buffer_ring;
+
+// Data in the ring continuing up to the size without wrapping.
+typedef struct {
+    void *data;
+    size_t size;
+} buffer_ring_span;
+
+// Creates a ring with at least the given capacity, rounded to a power of two.
+bool buffer_ring_create(buffer_ring *, size_t);
+
+bool buffer_ring_create_in(buffer_ring *, allocator *, size_t);
+
+void buffer_ring_destroy(buffer_ring *);
+
+void buffer_ring_clear(buffer_ring *);
+
+size_t buffer_ring_size(buffer_ring *);
+
+// Makes room for at least the given number of bytes more than the size.
+bool buffer_ring_reserve(buffer_ring *, size_t);
+
+// Copies bytes to the back.
+bool buffer_ring_push(buffer_ring *, const void *, size_t);
+
+// Copies bytes to the front, so they come before the data already there.
+bool buffer_ring_push_front(buffer_ring *, const void *, size_t);
+
+// Removes bytes from the back, copying them out unless given NULL. Fails if
+// there are fewer bytes.
+bool buffer_ring_pop(buffer_ring *, void *, size_t);
+
+// Removes bytes from the front, copying them out unless given NULL. Fails if
+// there are fewer bytes.
+bool buffer_ring_pop_front(buffer_ring *, void *, size_t);
+
+// Copies bytes at an offset from the front without removing them.
+bool buffer_ring_read(buffer_ring *, size_t, void *, size_t);
+
+// Gets the data in order in up to two spans, returning how many. Data written
+// out from them is removed with buffer_ring_pop_front(r, NULL, size).
+size_t buffer_ring_spans(buffer_ring *, buffer_ring_span[2]);
+
+// Gets the free space after the data in up to two spans, returning how many.
+// Data read into them is added with buffer_ring_commit. Reserve first to get
+// at least that much space.
+size_t buffer_ring_free_spans(buffer_ring *, buffer_ring_span[2]);
+
+// Adds the given number of bytes written to the free spans to the back.
+void buffer_ring_commit(buffer_ring *, size_t);
+
+#endif
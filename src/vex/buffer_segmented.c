@@ -0,0 +1,102 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "buffer_segmented.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline size_t buffer_segmented_highest(uint64_t word) {
+    // Index of the highest set bit of a word that isn't zero.
+#ifdef _MSC_VER
+    unsigned long index;
+
+    if (_BitScanReverse(&index, (unsigned long) (word >> 32))) return index + 32;
+
+    _BitScanReverse(&index, (unsigned long) word);
+
+    return index;
+#else
+    return 63 - (size_t) __builtin_clzll(word);
+#endif
+}
+
+bool buffer_segmented_create(buffer_segmented *s, size_t element_size, size_t first_capacity) {
+    return buffer_segmented_create_in(s, &allocator_heap, element_size, first_capacity);
+}
+
+bool buffer_segmented_create_in(buffer_segmented *s, allocator *a, size_t element_size, size_t first_capacity) {
+    size_t shift = 0;
+
+    while (((size_t) 1 << shift) < first_capacity) {
+        if (shift == 31) return false;
+
+        shift++;
+    }
+
+    s->size = 0;
+    s->element_size = element_size;
+    s->first_shift = shift;
+    s->segment_count = 0;
+    s->allocator = a;
+
+    return true;
+}
+
+static size_t buffer_segmented_segment_size(buffer_segmented *s, size_t segment) {
+    // Bytes of a segment.
+    return ((size_t) 1 << (s->first_shift + segment)) * s->element_size;
+}
+
+void buffer_segmented_destroy(buffer_segmented *s) {
+    for (size_t i = 0; i < s->segment_count; i++) {
+        allocator_free(s->allocator, s->segments[i], buffer_segmented_segment_size(s, i));
+    }
+}
+
+void buffer_segmented_clear(buffer_segmented *s) {
+    s->size = 0;
+}
+
+size_t buffer_segmented_size(buffer_segmented *s) {
+    return s->size;
+}
+
+void * buffer_segmented_push(buffer_segmented *s) {
+    // Index counted from the start of a first segment twice as large, whose
+    // highest bit is the segment and the rest the index within it.
+    size_t n = s->size + ((size_t) 1 << s->first_shift);
+    size_t highest = buffer_segmented_highest(n);
+    size_t segment = highest - s->first_shift;
+
+    if (segment == s->segment_count) {
+        if (segment == BUFFER_SEGMENTED_SEGMENTS || s->first_shift + segment >= sizeof(size_t) * 8 - 1
+            || (s->element_size != 0 && ((size_t) 1 << (s->first_shift + segment)) > SIZE_MAX / s->element_size)) return NULL;
+
+        uint8_t *data = allocator_allocate(s->allocator, buffer_segmented_segment_size(s, segment));
+
+        if (data == NULL) return NULL;
+
+        s->segments[segment] = data;
+        s->segment_count++;
+    }
+
+    s->size++;
+
+    return s->segments[segment] + (n - ((size_t) 1 << highest)) * s->element_size;
+}
+
+void buffer_segmented_pop(buffer_segmented *s) {
+    assert(s->size > 0);
+
+    s->size--;
+}
+
+void * buffer_segmented_get(buffer_segmented *s, size_t index) {
+    assert(index < s->size);
+
+    size_t n = index + ((size_t) 1 << s->first_shift);
+    size_t highest = buffer_segmented_highest(n);
+
+    return s->segments[highest - s->first_shift] + (n - ((size_t) 1 << highest)) * s->element_size;
+}
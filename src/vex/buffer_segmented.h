@@ -0,0 +1,54 @@
+/* Segmented buffer, a buffer of elements that never move once added. */
+#ifndef BUFFER_SEGMENTED_H
+#define BUFFER_SEGMENTED_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+
+// Most segments a buffer can have, enough for any size since each segment is
+// twice the size of the one before.
+#define BUFFER_SEGMENTED_SEGMENTS 48
+
+// Keeps elements in segments allocated one after another, each twice the size
+// of the last, so growing allocates a new segment instead of moving what's
+// there. Pointers to elements stay valid until they're popped or the buffer
+// is cleared, so they can be held on to, such as values of a hashtable kept
+// here with the table mapping keys to their pointers.
+//
+// The first segment holds a power of two of elements, so the segment of an
+// index is found from the highest bit of the index plus that number.
+typedef struct {
+    uint8_t *segments[BUFFER_SEGMENTED_SEGMENTS];
+    // Number of elements.
+    size_t size;
+    size_t element_size;
+    // Elements in the first segment, as a power of two.
+    size_t first_shift;
+    // Number of segments allocated, kept when popping or clearing.
+    size_t segment_count;
+    allocator *allocator;
+} buffer_segmented;
+
+// Creates a buffer of elements of a size, with at least the given number in
+// the first segment, rounded to a power of two. No memory is allocated until
+// the first push.
+bool buffer_segmented_create(buffer_segmented *, size_t, size_t);
+
+bool buffer_segmented_create_in(buffer_segmented *, allocator *, size_t, size_t);
+
+void buffer_segmented_destroy(buffer_segmented *);
+
+void buffer_segmented_clear(buffer_segmented *);
+
+size_t buffer_segmented_size(buffer_segmented *);
+
+// Adds an element to the end, returning where to write it.
+void * buffer_segmented_push(buffer_segmented *);
+
+// Removes the last element.
+void buffer_segmented_pop(buffer_segmented *);
+
+void * buffer_segmented_get(buffer_segmented *, size_t);
+
+#endif
@@ -2,12 +2,17 @@
 #ifndef BUFFER_TYPED_H
 #define BUFFER_TYPED_H
 #include "buffer.h"
+#include "buffer_ring.h"
+#include "buffer_segmented.h"
 
 #define BUFFER_REGISTER_TYPE(name, type) \
     typedef struct { buffer b; } buffer_ ## name; \
     inline static bool buffer_create_ ## name(buffer_ ## name *bt, size_t initial_capacity) { \
         return buffer_create(&bt->b, initial_capacity * sizeof(type)); \
     } \
+    inline static bool buffer_create_in_ ## name(buffer_ ## name *bt, allocator *a, size_t initial_capacity) { \
+        return buffer_create_in(&bt->b, a, initial_capacity * sizeof(type)); \
+    } \
     inline static void buffer_destroy_ ## name(buffer_ ## name *bt) { \
         buffer_destroy(&bt->b); \
     } \
@@ -42,4 +47,68 @@
         return buffer_copy(&target->b, &source->b); \
     }
 
+// Typed ring buffers. Elements are copied in and out since they can wrap
+// around the end of the ring.
+#define BUFFER_RING_REGISTER_TYPE(name, type) \
+    typedef struct { buffer_ring r; } buffer_ring_ ## name; \
+    inline static bool buffer_ring_create_ ## name(buffer_ring_ ## name *rt, size_t initial_capacity) { \
+        return buffer_ring_create(&rt->r, initial_capacity * sizeof(type)); \
+    } \
+    inline static bool buffer_ring_create_in_ ## name(buffer_ring_ ## name *rt, allocator *a, size_t initial_capacity) { \
+        return buffer_ring_create_in(&rt->r, a, initial_capacity * sizeof(type)); \
+    } \
+    inline static void buffer_ring_destroy_ ## name(buffer_ring_ ## name *rt) { \
+        buffer_ring_destroy(&rt->r); \
+    } \
+    inline static void buffer_ring_clear_ ## name(buffer_ring_ ## name *rt) { \
+        buffer_ring_clear(&rt->r); \
+    } \
+    inline static size_t buffer_ring_size_ ## name(buffer_ring_ ## name *rt) { \
+        return buffer_ring_size(&rt->r) / sizeof(type); \
+    } \
+    inline static bool buffer_ring_push_ ## name(buffer_ring_ ## name *rt, type value) { \
+        return buffer_ring_push(&rt->r, &value, sizeof(type)); \
+    } \
+    inline static bool buffer_ring_push_front_ ## name(buffer_ring_ ## name *rt, type value) { \
+        return buffer_ring_push_front(&rt->r, &value, sizeof(type)); \
+    } \
+    inline static bool buffer_ring_pop_ ## name(buffer_ring_ ## name *rt, type *value) { \
+        return buffer_ring_pop(&rt->r, value, sizeof(type)); \
+    } \
+    inline static bool buffer_ring_pop_front_ ## name(buffer_ring_ ## name *rt, type *value) { \
+        return buffer_ring_pop_front(&rt->r, value, sizeof(type)); \
+    } \
+    inline static bool buffer_ring_get_ ## name(buffer_ring_ ## name *rt, size_t index, type *value) { \
+        return buffer_ring_read(&rt->r, index * sizeof(type), value, sizeof(type)); \
+    }
+
+// Typed segmented buffers, with the first segment holding the given number of
+// elements.
+#define BUFFER_SEGMENTED_REGISTER_TYPE(name, type) \
+    typedef struct { buffer_segmented s; } buffer_segmented_ ## name; \
+    inline static bool buffer_segmented_create_ ## name(buffer_segmented_ ## name *st, size_t first_capacity) { \
+        return buffer_segmented_create(&st->s, sizeof(type), first_capacity); \
+    } \
+    inline static bool buffer_segmented_create_in_ ## name(buffer_segmented_ ## name *st, allocator *a, size_t first_capacity) { \
+        return buffer_segmented_create_in(&st->s, a, sizeof(type), first_capacity); \
+    } \
+    inline static void buffer_segmented_destroy_ ## name(buffer_segmented_ ## name *st) { \
+        buffer_segmented_destroy(&st->s); \
+    } \
+    inline static void buffer_segmented_clear_ ## name(buffer_segmented_ ## name *st) { \
+        buffer_segmented_clear(&st->s); \
+    } \
+    inline static size_t buffer_segmented_size_ ## name(buffer_segmented_ ## name *st) { \
+        return buffer_segmented_size(&st->s); \
+    } \
+    inline static type * buffer_segmented_push_ ## name(buffer_segmented_ ## name *st) { \
+        return buffer_segmented_push(&st->s); \
+    } \
+    inline static void buffer_segmented_pop_ ## name(buffer_segmented_ ## name *st) { \
+        buffer_segmented_pop(&st->s); \
+    } \
+    inline static type * buffer_segmented_get_ ## name(buffer_segmented_ ## name *st, size_t index) { \
+        return buffer_segmented_get(&st->s, index); \
+    }
+
 #endif
\ No newline at end of file
@@ -2,29 +2,297 @@
 #include <assert.h>
 #include "debug.h"
 #include "hashtable.h"
+#include "hashtable_group.h"
+
+static inline uint8_t * hashtable_control(hashtable *h) {
+    return h->control.data;
+}
+
+static inline uint8_t * hashtable_slot(hashtable *h, size_t index) {
+    return h->slots.data + index * h->entry_size;
+}
+
+static bool hashtable_allocate(hashtable *h, allocator *a, size_t capacity, size_t entry_size, size_t slots_capacity) {
+    size_t control_size = capacity + HASHTABLE_GROUP_WIDTH;
+
+    if (!buffer_create_in(&h->control, a, control_size)) return false;
+
+    if (!buffer_create_in(&h->slots, a, slots_capacity)) {
+        buffer_destroy(&h->control);
+        return false;
+    }
+
+    memset(buffer_push(&h->control, control_size), HASHTABLE_CONTROL_EMPTY, control_size);
+    buffer_push(&h->slots, capacity * entry_size);
+    h->capacity = capacity;
+    h->count = 0;
+    h->growth_left = hashtable_capacity_growth(capacity);
+    h->entry_size = entry_size;
+    h->incremental = false;
+    h->old_capacity = 0;
+    h->rehash_index = 0;
+#ifdef HASHTABLE_COUNTERS
+    memset(&h->counters, 0, sizeof(h->counters));
+#endif
+
+    return true;
+}
 
 bool hashtable_create(hashtable *h, size_t hash_capacity, size_t key_capacity, size_t value_capacity) {
-    return sparsearray_create(h, hash_capacity, key_capacity + value_capacity);
+    return hashtable_create_in(h, &allocator_heap, hash_capacity, key_capacity, value_capacity);
 }
 
-static inline buffer * hashtable_buffer_get(hashtable *h, size_t index, size_t value_size) {
-    // Getter for buckets that asserts the bucket exists and is non-empty.
-    buffer *b = sparsearray_value(h, index, value_size);
-    assert(b != NULL && buffer_size(b) > 0);
+bool hashtable_create_in(hashtable *h, allocator *a, size_t hash_capacity, size_t key_capacity, size_t value_capacity) {
+    // Slots can only be sized once the entry size is known on the first put,
+    // until then the key and value capacities reserve memory for them.
+    return hashtable_allocate(h, a, hashtable_capacity_for(hash_capacity), 0, key_capacity + value_capacity);
+}
 
-    return b;
+bool hashtable_create_sized(hashtable *h, size_t capacity, size_t entry_size) {
+    return hashtable_create_sized_in(h, &allocator_heap, capacity, entry_size);
+}
+
+bool hashtable_create_sized_in(hashtable *h, allocator *a, size_t capacity, size_t entry_size) {
+    assert(capacity >= HASHTABLE_GROUP_WIDTH && (capacity & (capacity - 1)) == 0);
+    assert(entry_size > 0);
+
+    return hashtable_allocate(h, a, capacity, entry_size, capacity * entry_size);
 }
 
 void hashtable_destroy(hashtable *h) {
-    // Destroy all key buffers.
-    for (size_t i = 0, l = sparsearray_count(h); i < l; i++)
-        buffer_destroy(hashtable_buffer_get(h, i, sizeof(buffer)));
+    buffer_destroy(&h->control);
+    buffer_destroy(&h->slots);
+
+    if (h->old_capacity > 0) {
+        buffer_destroy(&h->old_control);
+        buffer_destroy(&h->old_slots);
+    }
+}
+
+void hashtable_move(hashtable *to, hashtable *from) {
+    *to = *from;
+    buffer_move(&to->control, &from->control);
+    buffer_move(&to->slots, &from->slots);
+
+    if (from->old_capacity > 0) {
+        buffer_move(&to->old_control, &from->old_control);
+        buffer_move(&to->old_slots, &from->old_slots);
+    }
+}
 
-    sparsearray_destroy(h);
+size_t hashtable_count(hashtable *h) {
+    return h->count;
 }
 
 size_t hashtable_bucket_count(hashtable *h) {
-    return sparsearray_count(h);
+    return h->capacity;
+}
+
+static size_t hashtable_find_in(uint8_t *control,
+    uint8_t *slots,
+    size_t capacity,
+    size_t entry_size,
+    bool(*equals)(void *, void *),
+    void *key,
+    uint64_t hash) {
+    // Returns the slot index of the key, or the capacity if it's missing.
+    uint8_t h2 = hashtable_hash_h2(hash);
+    size_t mask = capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+
+    while (true) {
+        hashtable_group_mask match = hashtable_group_match(control + offset, h2);
+
+        for (; match; match = hashtable_group_mask_next(match)) {
+            size_t index = (offset + hashtable_group_mask_first(match)) & mask;
+
+            if (equals(key, slots + index * entry_size)) return index;
+        }
+
+        // An empty slot in the group ends the probe sequence.
+        if (hashtable_group_match_empty(control + offset)) return capacity;
+
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+    }
+}
+
+static size_t hashtable_find_slot(hashtable *h, bool (*equals)(void *, void *), void *key, uint64_t hash) {
+    return hashtable_find_in(h->control.data, h->slots.data, h->capacity, h->entry_size, equals, key, hash);
+}
+
+static size_t hashtable_find_old_slot(hashtable *h, bool (*equals)(void *, void *), void *key, uint64_t hash) {
+    // Returns the slot index of the key in the slots being migrated from, or
+    // the old capacity if it's missing or no migration is in progress.
+    if (h->old_capacity == 0) return 0;
+
+    return hashtable_find_in(h->old_control.data, h->old_slots.data, h->old_capacity, h->entry_size, equals, key, hash);
+}
+
+static uint8_t * hashtable_find_entry(hashtable *h, bool (*equals)(void *, void *), void *key, uint64_t hash) {
+    size_t index = hashtable_find_slot(h, equals, key, hash);
+
+    if (index < h->capacity) return hashtable_slot(h, index);
+
+    index = hashtable_find_old_slot(h, equals, key, hash);
+
+    if (index < h->old_capacity) return h->old_slots.data + index * h->entry_size;
+
+    return NULL;
+}
+
+static void hashtable_migrate(hashtable *h, uint64_t (*hash)(void *), size_t budget) {
+    // Move up to budget of the old slots into the current ones.
+    uint8_t *old_control = h->old_control.data;
+    uint8_t *control = hashtable_control(h);
+
+    for (; budget > 0 && h->rehash_index < h->old_capacity; budget--) {
+        size_t i = h->rehash_index++;
+
+        if (!hashtable_control_full(old_control[i])) continue;
+
+        uint8_t *entry = h->old_slots.data + i * h->entry_size;
+        uint64_t entry_hash = hashtable_hash_mix(hash(entry));
+        size_t index = hashtable_probe_insert(control, h->capacity, entry_hash);
+
+        // Room for the entry was reserved when the migration started, reusing
+        // a deleted slot instead gives that room back.
+        if (control[index] != HASHTABLE_CONTROL_EMPTY) h->growth_left++;
+
+        hashtable_control_set(control, h->capacity, index, hashtable_hash_h2(entry_hash));
+        memcpy(hashtable_slot(h, index), entry, h->entry_size);
+
+        // Lookups search the old slots too, so the migrated entry is removed.
+        hashtable_control_set(old_control, h->old_capacity, i, HASHTABLE_CONTROL_DELETED);
+    }
+
+    if (h->old_capacity > 0 && h->rehash_index >= h->old_capacity) {
+        buffer_destroy(&h->old_control);
+        buffer_destroy(&h->old_slots);
+        h->old_capacity = 0;
+        h->rehash_index = 0;
+    }
+}
+
+bool hashtable_rehash_begin(hashtable *h, size_t new_capacity) {
+    // Start migrating the entries to new slots, keeping the current slots
+    // around as the old ones until every entry has been moved.
+    hashtable r;
+
+    if (!hashtable_create_sized_in(&r, h->slots.allocator, new_capacity, h->entry_size)) return false;
+
+    buffer_move(&h->old_control, &h->control);
+    buffer_move(&h->old_slots, &h->slots);
+    h->old_capacity = h->capacity;
+    h->rehash_index = 0;
+    buffer_move(&h->control, &r.control);
+    buffer_move(&h->slots, &r.slots);
+    h->capacity = r.capacity;
+
+    // Reserve room for every entry still to be migrated.
+    h->growth_left = r.growth_left - h->count;
+    hashtable_counter_add(h, rehashes, 1);
+    hashtable_counter_add(h, reallocs, 1);
+
+    return true;
+}
+
+static bool hashtable_rehash(hashtable *h, uint64_t (*hash)(void *), size_t new_capacity) {
+    // Finish any incremental migration first, so all entries are in one place.
+    hashtable_migrate(h, hash, h->old_capacity);
+
+    if (h->incremental) return hashtable_rehash_begin(h, new_capacity);
+
+    hashtable r;
+
+    if (!hashtable_create_sized_in(&r, h->slots.allocator, new_capacity, h->entry_size)) return false;
+
+    uint8_t *control = hashtable_control(h);
+
+    for (size_t i = 0; i < h->capacity; i++) {
+        if (!hashtable_control_full(control[i])) continue;
+
+        uint8_t *entry = hashtable_slot(h, i);
+        uint64_t entry_hash = hashtable_hash_mix(hash(entry));
+        size_t index = hashtable_probe_insert(hashtable_control(&r), r.capacity, entry_hash);
+        hashtable_control_set(hashtable_control(&r), r.capacity, index, hashtable_hash_h2(entry_hash));
+        memcpy(hashtable_slot(&r, index), entry, r.entry_size);
+    }
+
+    r.count = h->count;
+    r.growth_left -= h->count;
+    r.incremental = h->incremental;
+    hashtable_counters_copy(&r, h);
+    hashtable_counter_add(&r, rehashes, 1);
+    hashtable_counter_add(&r, reallocs, 1);
+    hashtable_destroy(h);
+    hashtable_move(h, &r);
+
+    return true;
+}
+
+void hashtable_rehash_incremental(hashtable *h, bool incremental) {
+    h->incremental = incremental;
+}
+
+bool hashtable_rehash_step(hashtable *h, uint64_t (*hash)(void *), size_t budget) {
+    hashtable_migrate(h, hash, budget);
+
+    return h->old_capacity > 0;
+}
+
+size_t hashtable_rehash_remaining(hashtable *h) {
+    return h->old_capacity - h->rehash_index;
+}
+
+static bool hashtable_entry_size_set(hashtable *h, size_t entry_size) {
+    if (h->entry_size == 0) {
+        // First put, size the slots now that the entry size is known.
+        if (h->slots.capacity < h->capacity * entry_size) hashtable_counter_add(h, reallocs, 1);
+
+        if (buffer_push(&h->slots, h->capacity * entry_size) == NULL) return false;
+
+        h->entry_size = entry_size;
+    }
+
+    assert(h->entry_size == entry_size);
+
+    return true;
+}
+
+static bool hashtable_put_mixed(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    void *key,
+    size_t key_size,
+    void *value,
+    size_t value_size,
+    uint64_t key_hash) {
+    // Put with the hash already mixed.
+    uint8_t *entry = hashtable_find_entry(h, equals, key, key_hash);
+
+    if (entry != NULL) {
+        memmove(entry + key_size, value, value_size);
+        return true;
+    }
+
+    if (h->growth_left == 0
+        && !hashtable_rehash(h, hash, hashtable_capacity_rehash(h->capacity, h->count))) return false;
+
+    size_t index = hashtable_probe_insert(hashtable_control(h), h->capacity, key_hash);
+
+    // Reusing a deleted slot doesn't bring the table closer to a rehash.
+    if (hashtable_control(h)[index] == HASHTABLE_CONTROL_EMPTY) h->growth_left--;
+
+    hashtable_control_set(hashtable_control(h), h->capacity, index, hashtable_hash_h2(key_hash));
+    uint8_t *entry_key = hashtable_slot(h, index);
+    uint8_t *entry_value = entry_key + key_size;
+    memmove(entry_key, key, key_size);
+    memmove(entry_value, value, value_size);
+    h->count++;
+
+    return true;
 }
 
 bool hashtable_put(hashtable *h,
@@ -35,35 +303,85 @@ bool hashtable_put(hashtable *h,
     void *value,
     size_t value_size) {
     assert(key != NULL);
+
+    return hashtable_put_hashed(h, hash, equals, hash(key), key, key_size, value, value_size);
+}
+
+bool hashtable_put_hashed(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    uint64_t key_hash,
+    void *key,
+    size_t key_size,
+    void *value,
+    size_t value_size) {
+    assert(key != NULL);
     assert(value != NULL);
-    uint64_t key_hash = hash(key);
-    size_t entry_size = key_size + value_size;
-    buffer *entries = sparsearray_get(h, key_hash, sizeof(buffer));
 
-    if (entries == NULL) {
-        entries = sparsearray_put(h, key_hash, sizeof(buffer));
-        buffer_create(entries, entry_size);
+    if (!hashtable_entry_size_set(h, key_size + value_size)) return false;
+
+    hashtable_migrate(h, hash, HASHTABLE_REHASH_BUDGET);
+
+    return hashtable_put_mixed(h, hash, equals, key, key_size, value, value_size, hashtable_hash_mix(key_hash));
+}
+
+static void hashtable_hash_batch(hashtable *h,
+    uint64_t(*hash)(void *),
+    uint8_t *keys,
+    size_t key_size,
+    size_t count,
+    uint64_t *hashes) {
+    // Hash a batch of keys and prefetch where their probing starts, so the
+    // cache misses of the whole batch overlap.
+    size_t mask = h->capacity - 1;
+
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = hashtable_hash_mix(hash(keys + i * key_size));
+        size_t offset = hashtable_hash_h1(hashes[i]) & mask;
+        hashtable_prefetch(hashtable_control(h) + offset);
+        hashtable_prefetch(hashtable_slot(h, offset));
     }
+}
 
-    for (size_t offset = 0, l = buffer_size(entries);
-        offset < l;
-        offset += entry_size) {
-        uint8_t *bucket_entry_key = buffer_get(entries, offset);
-        uint8_t *bucket_entry_value = bucket_entry_key + key_size;
+bool hashtable_put_many(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    size_t count,
+    void *keys,
+    size_t key_size,
+    void *values,
+    size_t value_size) {
+    assert(keys != NULL);
+    assert(values != NULL);
 
-        if (equals(key, bucket_entry_key)) {
-            uint8_t *entry_value = bucket_entry_key + key_size;
-            memmove(entry_value, value, value_size);
-            return true;
-        }
+    if (!hashtable_entry_size_set(h, key_size + value_size)) return false;
+
+    // Make room for every key up front, so the table isn't rehashed in the
+    // middle of a batch. This rehashes all at once even when incremental.
+    if (h->growth_left < count) {
+        bool incremental = h->incremental;
+        h->incremental = false;
+        bool rehashed = hashtable_rehash(h, hash, hashtable_capacity_reserve(h->capacity, h->count + count));
+        h->incremental = incremental;
+
+        if (!rehashed) return false;
     }
 
-    uint8_t *entry_key = buffer_push(entries, entry_size);
-    if (entry_key == NULL) return false;
+    uint8_t *key_bytes = keys;
+    uint8_t *value_bytes = values;
+    uint64_t hashes[HASHTABLE_BATCH_SIZE];
 
-    uint8_t *entry_value = entry_key + key_size;
-    memmove(entry_key, key, key_size);
-    memmove(entry_value, value, value_size);
+    for (size_t start = 0; start < count; start += HASHTABLE_BATCH_SIZE) {
+        size_t batch = count - start < HASHTABLE_BATCH_SIZE ? count - start : HASHTABLE_BATCH_SIZE;
+        hashtable_hash_batch(h, hash, key_bytes + start * key_size, key_size, batch, hashes);
+
+        for (size_t i = 0; i < batch; i++) {
+            void *key = key_bytes + (start + i) * key_size;
+            void *value = value_bytes + (start + i) * value_size;
+
+            if (!hashtable_put_mixed(h, hash, equals, key, key_size, value, value_size, hashes[i])) return false;
+        }
+    }
 
     return true;
 }
@@ -75,31 +393,44 @@ bool hashtable_remove(hashtable *h,
     size_t key_size,
     size_t value_size) {
     assert(key != NULL);
-    uint64_t key_hash = hash(key);
-    size_t entry_size = key_size + value_size;
-    buffer *entries = sparsearray_get(h, key_hash, sizeof(buffer));
 
-    if (entries == NULL) return true;
+    if (h->count == 0) return true;
+
+    return hashtable_remove_hashed(h, hash, equals, hash(key), key, key_size, value_size);
+}
+
+bool hashtable_remove_hashed(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    uint64_t key_hash,
+    void *key,
+    size_t key_size,
+    size_t value_size) {
+    assert(key != NULL);
+
+    if (h->count == 0) return true;
 
-    for (size_t offset = 0, l = buffer_size(entries);
-        offset < l;
-        offset += entry_size) {
-        uint8_t *bucket_entry_key = buffer_get(entries, offset);
+    assert(h->entry_size == key_size + value_size);
+    hashtable_migrate(h, hash, HASHTABLE_REHASH_BUDGET);
+    key_hash = hashtable_hash_mix(key_hash);
+    size_t index = hashtable_find_slot(h, equals, key, key_hash);
 
-        if (equals(key, bucket_entry_key)) {
-            if (buffer_remove(entries, offset, entry_size)) {
-                // Buffer is non-empty. Break to return success. 
-                if (buffer_size(entries) > 0) break;
+    if (index < h->capacity) {
+        // Mark the slot deleted rather than empty, so probe sequences passing
+        // through it continue on to later groups.
+        hashtable_control_set(hashtable_control(h), h->capacity, index, HASHTABLE_CONTROL_DELETED);
+        h->count--;
 
-                // Destroy and remove buffer. Break to return success.
-                buffer_destroy(entries);
+        return true;
+    }
 
-                if (sparsearray_remove(h, key_hash, sizeof(buffer))) break;
-            }
+    index = hashtable_find_old_slot(h, equals, key, key_hash);
 
-            // Failed to remove buffer entry or remove the entire buffer.
-            return false;
-        }
+    if (index < h->old_capacity) {
+        // The entry no longer needs the room reserved for migrating it.
+        hashtable_control_set(h->old_control.data, h->old_capacity, index, HASHTABLE_CONTROL_DELETED);
+        h->growth_left++;
+        h->count--;
     }
 
     return true;
@@ -112,22 +443,46 @@ void * hashtable_get_entry(hashtable *h,
     size_t key_size,
     size_t value_size) {
     assert(key != NULL);
-    uint64_t key_hash = hash(key);
-    buffer *entries = sparsearray_get(h, key_hash, sizeof(buffer));
 
-    if (entries == NULL) return NULL;
+    if (h->count == 0) {
+        hashtable_counter_add(h, misses, 1);
+        return NULL;
+    }
 
-    size_t entry_size = key_size + value_size;
+    return hashtable_get_entry_hashed(h, equals, hash(key), key, key_size, value_size);
+}
 
-    for (size_t offset = 0, l = buffer_size(entries);
-        offset < l;
-        offset += entry_size) {
-        uint8_t *bucket_entry = buffer_get(entries, offset);
+void * hashtable_get_entry_hashed(hashtable *h,
+    bool(*equals)(void *, void *),
+    uint64_t key_hash,
+    void *key,
+    size_t key_size,
+    size_t value_size) {
+    assert(key != NULL);
+    uint8_t *entry = NULL;
 
-        if (equals(key, bucket_entry)) return bucket_entry;
+    if (h->count > 0) {
+        assert(h->entry_size == key_size + value_size);
+        entry = hashtable_find_entry(h, equals, key, hashtable_hash_mix(key_hash));
     }
 
-    return NULL;
+    if (entry != NULL) {
+        hashtable_counter_add(h, hits, 1);
+    } else {
+        hashtable_counter_add(h, misses, 1);
+    }
+
+    return entry;
+}
+
+void * hashtable_get_key(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    void *key,
+    size_t key_size,
+    size_t value_size) {
+    // Key is at the start of the entry.
+    return hashtable_get_entry(h, hash, equals, key, key_size, value_size);
 }
 
 void * hashtable_get(hashtable *h,
@@ -143,55 +498,253 @@ void * hashtable_get(hashtable *h,
     return entry + key_size;
 }
 
+void * hashtable_get_hashed(hashtable *h,
+    bool(*equals)(void *, void *),
+    uint64_t key_hash,
+    void *key,
+    size_t key_size,
+    size_t value_size) {
+    uint8_t *entry = hashtable_get_entry_hashed(h, equals, key_hash, key, key_size, value_size);
+
+    if (entry == NULL) return NULL;
+
+    return entry + key_size;
+}
+
+size_t hashtable_get_many(hashtable *h,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    size_t count,
+    void *keys,
+    size_t key_size,
+    size_t value_size,
+    void **values) {
+    assert(keys != NULL);
+    assert(values != NULL);
+    size_t found = 0;
+
+    if (h->count == 0) {
+        for (size_t i = 0; i < count; i++) values[i] = NULL;
+
+        hashtable_counter_add(h, misses, count);
+
+        return 0;
+    }
+
+    assert(h->entry_size == key_size + value_size);
+    uint8_t *key_bytes = keys;
+    uint64_t hashes[HASHTABLE_BATCH_SIZE];
+
+    for (size_t start = 0; start < count; start += HASHTABLE_BATCH_SIZE) {
+        size_t batch = count - start < HASHTABLE_BATCH_SIZE ? count - start : HASHTABLE_BATCH_SIZE;
+        hashtable_hash_batch(h, hash, key_bytes + start * key_size, key_size, batch, hashes);
+
+        for (size_t i = 0; i < batch; i++) {
+            void *key = key_bytes + (start + i) * key_size;
+            uint8_t *entry = hashtable_find_entry(h, equals, key, hashes[i]);
+
+            if (entry != NULL) {
+                values[start + i] = entry + key_size;
+                found++;
+            } else {
+                values[start + i] = NULL;
+            }
+        }
+    }
+
+    hashtable_counter_add(h, hits, found);
+    hashtable_counter_add(h, misses, count - found);
+
+    return found;
+}
+
+static size_t hashtable_probe_length(size_t capacity, uint64_t hash, size_t index) {
+    // Number of groups probed before reaching the group with the slot, the
+    // same sequence as when looking up the entry.
+    size_t mask = capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+    size_t length = 1;
+
+    while (((index - offset) & mask) >= HASHTABLE_GROUP_WIDTH) {
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+        length++;
+    }
+
+    return length;
+}
+
+static void hashtable_stats_add(hashtable_stats *stats,
+    uint64_t(*hash)(void *),
+    uint8_t *control,
+    uint8_t *slots,
+    size_t capacity,
+    size_t entry_size,
+    size_t *probe_length_sum) {
+    for (size_t i = 0; i < capacity; i++) {
+        if (control[i] == HASHTABLE_CONTROL_DELETED) stats->deleted++;
+
+        if (!hashtable_control_full(control[i])) continue;
+
+        uint64_t entry_hash = hashtable_hash_mix(hash(slots + i * entry_size));
+        size_t length = hashtable_probe_length(capacity, entry_hash, i);
+        size_t bin = length < HASHTABLE_STATS_PROBE_LENGTHS ? length : HASHTABLE_STATS_PROBE_LENGTHS;
+        stats->probe_lengths[bin - 1]++;
+        *probe_length_sum += length;
+
+        if (length > stats->probe_length_max) stats->probe_length_max = length;
+    }
+}
+
+void hashtable_get_stats(hashtable *h, uint64_t (*hash)(void *), hashtable_stats *stats) {
+    size_t probe_length_sum = 0;
+    memset(stats, 0, sizeof(hashtable_stats));
+    stats->count = h->count;
+    stats->capacity = h->capacity;
+    stats->load_factor = (double) h->count / (double) h->capacity;
+    stats->bytes_allocated = h->control.capacity + h->slots.capacity;
+    stats->bytes_used = h->count * h->entry_size;
+
+    if (h->entry_size > 0) {
+        hashtable_stats_add(stats, hash, h->control.data, h->slots.data, h->capacity, h->entry_size, &probe_length_sum);
+    }
+
+    if (h->old_capacity > 0) {
+        stats->bytes_allocated += h->old_control.capacity + h->old_slots.capacity;
+        hashtable_stats_add(stats, hash, h->old_control.data, h->old_slots.data, h->old_capacity, h->entry_size, &probe_length_sum);
+    }
+
+    if (h->count > 0) stats->probe_length_average = (double) probe_length_sum / (double) h->count;
+
+#ifdef HASHTABLE_COUNTERS
+    stats->hits = h->counters.hits;
+    stats->misses = h->counters.misses;
+    stats->rehashes = h->counters.rehashes;
+    stats->reallocs = h->counters.reallocs;
+#endif
+}
+
+bool hashtable_save(hashtable *h, int fd) {
+    snapshot_header header;
+    snapshot_header_create(&header, SNAPSHOT_HASHTABLE);
+    header.parameter = HASHTABLE_GROUP_WIDTH;
+    header.fields[0] = h->capacity;
+    header.fields[1] = h->count;
+    header.fields[2] = h->entry_size;
+    header.fields[3] = h->old_capacity;
+    header.fields[4] = h->rehash_index;
+
+    if (!snapshot_write_header(fd, &header)
+        || !snapshot_write_section(fd, h->control.data, h->capacity + HASHTABLE_GROUP_WIDTH)
+        || !snapshot_write_section(fd, h->slots.data, h->capacity * h->entry_size)) return false;
+
+    if (h->old_capacity == 0) return true;
+
+    return snapshot_write_section(fd, h->old_control.data, h->old_capacity + HASHTABLE_GROUP_WIDTH)
+        && snapshot_write_section(fd, h->old_slots.data, h->old_capacity * h->entry_size);
+}
+
+static bool hashtable_map_buffer(buffer *b, snapshot *snap, size_t size) {
+    // Tables grown from the mapped buffers allocate on the heap.
+    b->allocator = &allocator_heap;
+    b->data = snapshot_read_section(snap, size);
+    b->size = size;
+    b->capacity = size;
+
+    return b->data != NULL;
+}
+
+bool hashtable_open_mapped(hashtable *h, snapshot *snap, const char *path) {
+    if (!snapshot_open(snap, path, SNAPSHOT_HASHTABLE)) return false;
+
+    snapshot_header *header = snapshot_get_header(snap);
+    size_t capacity = (size_t) header->fields[0];
+    size_t entry_size = (size_t) header->fields[2];
+    size_t old_capacity = (size_t) header->fields[3];
+
+    size_t count = (size_t) header->fields[1];
+    size_t rehash_index = (size_t) header->fields[4];
+
+    // Probe sequences step by the group width, so a table written by a build
+    // with groups of another width would be probed in the wrong slots.
+    bool valid = header->parameter == HASHTABLE_GROUP_WIDTH
+        && capacity >= HASHTABLE_GROUP_WIDTH && (capacity & (capacity - 1)) == 0
+        && (entry_size == 0 || capacity <= SIZE_MAX / entry_size)
+        && (old_capacity == 0
+            || (old_capacity >= HASHTABLE_GROUP_WIDTH && (old_capacity & (old_capacity - 1)) == 0 && old_capacity <= capacity))
+        && rehash_index <= old_capacity && count <= capacity + old_capacity
+        && hashtable_map_buffer(&h->control, snap, capacity + header->parameter)
+        && hashtable_map_buffer(&h->slots, snap, capacity * entry_size)
+        && (old_capacity == 0
+            || (hashtable_map_buffer(&h->old_control, snap, old_capacity + header->parameter)
+                && hashtable_map_buffer(&h->old_slots, snap, old_capacity * entry_size)));
+
+    if (!valid) {
+        snapshot_close(snap);
+        return false;
+    }
+
+    h->capacity = capacity;
+    h->count = count;
+    h->entry_size = entry_size;
+    h->old_capacity = old_capacity;
+    h->rehash_index = rehash_index;
+    h->growth_left = 0;
+    h->incremental = false;
+#ifdef HASHTABLE_COUNTERS
+    memset(&h->counters, 0, sizeof(h->counters));
+#endif
+
+    return true;
+}
+
 hashtable_iterator hashtable_iterate(hashtable *h) {
     hashtable_iterator it;
     it.table = h;
-    it.key_index = 0;
-    it.entry_offset = 0;
-    it.entries = NULL;
+    it.slot_index = 0;
+    it.entry = NULL;
 
     return it;
 }
 
 bool hashtable_iterate_next(hashtable_iterator *it, size_t key_size, size_t value_size) {
-    size_t key_count = sparsearray_count(it->table);
+    hashtable *h = it->table;
 
-    // Stop if no more buckets to iterate over.
-    if (it->key_index >= key_count) return false;
+    // Start at the first slot, or the one after the current entry. Slots past
+    // the capacity are the old ones of an incremental migration.
+    size_t index = it->entry == NULL ? 0 : it->slot_index + 1;
+    size_t end = h->capacity + h->old_capacity;
 
-    if (it->entries == NULL) {
-        // Entries are null, initial iteration.
-        it->entry_offset = 0;
-        it->entries = hashtable_buffer_get(it->table, 0, sizeof(buffer));
-    } else {
-        // Iterate in current entry bucket.
-        it->entry_offset += key_size + value_size;
+    // Skip empty and deleted slots.
+    for (; index < end; index++) {
+        uint8_t control = index < h->capacity
+            ? hashtable_control(h)[index]
+            : h->old_control.data[index - h->capacity];
+
+        if (hashtable_control_full(control)) break;
     }
 
-    // Check if increment put us at end of buffer.
-    if (it->entry_offset >= buffer_size(it->entries)) {
-        it->key_index++;
+    it->slot_index = index;
 
-        // Check if key increment put us at end of sparse array keys.
-        // If so iteration has finished.
-        if (it->key_index >= key_count) return false;
+    if (index >= end) return false;
 
-        // Start iterating at next entry bucket.
-        it->entry_offset = 0;
-        it->entries = hashtable_buffer_get(it->table, it->key_index, sizeof(buffer));
-    }
+    assert(h->entry_size == key_size + value_size);
+    it->entry = index < h->capacity
+        ? hashtable_slot(h, index)
+        : h->old_slots.data + (index - h->capacity) * h->entry_size;
 
     return true;
 }
 
 void * hashtable_iterate_key(hashtable_iterator *it) {
-    assert(it->entries != NULL);
+    assert(it->entry != NULL);
 
-    return buffer_get(it->entries, it->entry_offset);
+    return it->entry;
 }
 
 void * hashtable_iterate_value(hashtable_iterator *it, size_t key_size) {
-    assert(it->entries != NULL);
+    assert(it->entry != NULL);
 
-    return (uint8_t *) buffer_get(it->entries, it->entry_offset) + key_size;
+    return it->entry + key_size;
 }
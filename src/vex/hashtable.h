@@ -1,38 +1,171 @@
-/* Sparse array, mapping 64-bit integers to arbitrary data. */
+/* Open addressing hashtable, mapping keys to values of a fixed size. */
 #ifndef HASHTABLE_H
 #define HASHTABLE_H
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "buffer.h"
-#include "sparsearray.h"
+#include "snapshot.h"
 
-typedef sparsearray hashtable;
+// Defining HASHTABLE_COUNTERS for the whole build makes every hashtable count
+// lookups and rehashes as they happen, reported by hashtable_get_stats. The
+// counters are plain increments on the table, cheap enough to leave enabled.
+#ifdef HASHTABLE_COUNTERS
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t rehashes;
+    uint64_t reallocs;
+} hashtable_counters;
+
+#define hashtable_counter_add(h, counter, n) ((h)->counters.counter += (n))
+#define hashtable_counters_copy(to, from) ((to)->counters = (from)->counters)
+#else
+#define hashtable_counter_add(h, counter, n) ((void) 0)
+#define hashtable_counters_copy(to, from) ((void) 0)
+#endif
+
+// Entries are stored flat in `slots` as key + value data in sequence. Each
+// slot has a control byte in `control`, followed by a copy of the first group
+// of control bytes so probing can read a whole group past the end.
+typedef struct {
+    buffer control;
+    buffer slots;
+    // Number of slots, always a power of two.
+    size_t capacity;
+    size_t count;
+    // Number of empty slots that can be filled before the table is rehashed.
+    size_t growth_left;
+    // Size of key + value, zero until the first put.
+    size_t entry_size;
+    // When incremental, growing moves the entries to new slots a few at a time
+    // on every put and remove instead of all at once. Until all are moved the
+    // previous slots are kept as the old ones and searched as well.
+    bool incremental;
+    buffer old_control;
+    buffer old_slots;
+    // Zero unless a migration is in progress.
+    size_t old_capacity;
+    // Next old slot to migrate.
+    size_t rehash_index;
+#ifdef HASHTABLE_COUNTERS
+    hashtable_counters counters;
+#endif
+} hashtable;
+
+// Number of probe lengths counted separately in the histogram of the stats.
+#define HASHTABLE_STATS_PROBE_LENGTHS 8
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t deleted;
+    double load_factor;
+    // Entries by the number of groups probed to find them, from one group up.
+    // The last length also counts every longer probe.
+    size_t probe_lengths[HASHTABLE_STATS_PROBE_LENGTHS];
+    double probe_length_average;
+    size_t probe_length_max;
+    size_t bytes_allocated;
+    // Bytes of the keys and values in the table.
+    size_t bytes_used;
+    // Counted since the table was created, zero unless HASHTABLE_COUNTERS is
+    // defined. Rehashes include the ones clearing deleted slots without
+    // growing, reallocs count every allocation of slots.
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t rehashes;
+    uint64_t reallocs;
+} hashtable_stats;
 
 typedef struct {
     hashtable *table;
-    size_t key_index;
-    size_t entry_offset;
-    buffer *entries;
+    size_t slot_index;
+    uint8_t *entry;
 } hashtable_iterator;
 
 bool hashtable_create(hashtable *, size_t, size_t, size_t);
 
+// Creates a hashtable with its slots allocated by the given allocator, which
+// is also used for the slots of every rehash.
+bool hashtable_create_in(hashtable *, allocator *, size_t, size_t, size_t);
+
+// Creates a hashtable with a power of two slot capacity and the entry size
+// known up front. Used by the typed hashtables in hashtable_typed.h.
+bool hashtable_create_sized(hashtable *, size_t, size_t);
+
+bool hashtable_create_sized_in(hashtable *, allocator *, size_t, size_t);
+
 void hashtable_destroy(hashtable *);
 
+// Moves a hashtable to another place, the first, since its buffers can't be
+// copied by value.
+void hashtable_move(hashtable *, hashtable *);
+
+size_t hashtable_count(hashtable *);
+
 size_t hashtable_bucket_count(hashtable *);
 
 bool hashtable_put(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), void *, size_t, void *, size_t);
 
+// The *_hashed functions take the hash of the key from the caller, so a key
+// used several times only has to be hashed once. It must be what the hash
+// function returns for the key, which is still needed to move other entries
+// when the table grows.
+bool hashtable_put_hashed(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), uint64_t, void *, size_t, void *, size_t);
+
+// Puts a number of keys and values stored in sequence, hashing and prefetching
+// them in batches.
+bool hashtable_put_many(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), size_t, void *, size_t, void *, size_t);
+
 bool hashtable_remove(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), void *, size_t, size_t);
 
+bool hashtable_remove_hashed(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), uint64_t, void *, size_t, size_t);
+
 // Returns pointer to memory with key + value data in sequence.
 void * hashtable_get_entry(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), void *, size_t, size_t);
 
+void * hashtable_get_entry_hashed(hashtable *, bool (*)(void *, void *), uint64_t, void *, size_t, size_t);
+
 void * hashtable_get_key(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), void *, size_t, size_t);
 
 void * hashtable_get(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), void *, size_t, size_t);
 
+void * hashtable_get_hashed(hashtable *, bool (*)(void *, void *), uint64_t, void *, size_t, size_t);
+
+// Gets the values of a number of keys stored in sequence, hashing and
+// prefetching them in batches. Values of missing keys are set to NULL.
+// Returns the number of keys found.
+size_t hashtable_get_many(hashtable *, uint64_t (*)(void *), bool (*)(void *, void *), size_t, void *, size_t, size_t, void **);
+
+// Enables or disables incremental rehashing.
+void hashtable_rehash_incremental(hashtable *, bool);
+
+// Migrates up to the given number of old slots. Returns whether a migration
+// is still in progress.
+bool hashtable_rehash_step(hashtable *, uint64_t (*)(void *), size_t);
+
+// Starts an incremental migration to new slots with a power of two capacity.
+// Used by the typed hashtables in hashtable_typed.h.
+bool hashtable_rehash_begin(hashtable *, size_t);
+
+// Number of old slots left to migrate, zero when no migration is in progress.
+size_t hashtable_rehash_remaining(hashtable *);
+
+// Gets statistics of the hashtable, hashing every entry to find how far it is
+// from where its probing starts. Long probes point to a weak hash function.
+void hashtable_get_stats(hashtable *, uint64_t (*)(void *), hashtable_stats *);
+
+// Writes a snapshot of the hashtable to a file descriptor, including the old
+// slots of an incremental migration in progress.
+bool hashtable_save(hashtable *, int);
+
+// Opens a hashtable from a snapshot file, looking up keys in the slots of the
+// mapped file directly. It's read only and must not be destroyed, instead it's
+// valid until the snapshot is closed. The snapshot must have been written by a
+// build probing groups of the same width as this one.
+bool hashtable_open_mapped(hashtable *, snapshot *, const char *);
+
 hashtable_iterator hashtable_iterate(hashtable *);
 
 bool hashtable_iterate_next(hashtable_iterator *, size_t, size_t);
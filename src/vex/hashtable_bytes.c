@@ -0,0 +1,280 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "hashtable_bytes.h"
+#include "hashtable_group.h"
+
+// Arena bytes reserved per slot when creating the table.
+#define HASHTABLE_BYTES_KEY_RESERVE 16
+
+static inline hashtable_bytes_key * hashtable_bytes_slot(hashtable_bytes *h, size_t index) {
+    return (hashtable_bytes_key *) (h->slots.data + index * h->entry_size);
+}
+
+static bool hashtable_bytes_allocate(hashtable_bytes *h, allocator *a, size_t capacity, size_t value_size, size_t keys_capacity) {
+    size_t control_size = capacity + HASHTABLE_GROUP_WIDTH;
+    size_t alignment = sizeof(uint64_t);
+    size_t entry_size = sizeof(hashtable_bytes_key) + ((value_size + alignment - 1) & ~(alignment - 1));
+
+    if (!buffer_create_in(&h->control, a, control_size)) return false;
+
+    if (!buffer_create_in(&h->slots, a, capacity * entry_size)) {
+        buffer_destroy(&h->control);
+        return false;
+    }
+
+    // Buffers need a capacity above one to grow.
+    if (!buffer_create_in(&h->keys, a, keys_capacity > 2 ? keys_capacity : 2)) {
+        buffer_destroy(&h->control);
+        buffer_destroy(&h->slots);
+        return false;
+    }
+
+    memset(buffer_push(&h->control, control_size), HASHTABLE_CONTROL_EMPTY, control_size);
+    buffer_push(&h->slots, capacity * entry_size);
+    h->capacity = capacity;
+    h->count = 0;
+    h->growth_left = hashtable_capacity_growth(capacity);
+    h->value_size = value_size;
+    h->entry_size = entry_size;
+    h->keys_unused = 0;
+
+    return true;
+}
+
+bool hashtable_bytes_create(hashtable_bytes *h, size_t capacity, size_t value_size) {
+    return hashtable_bytes_create_in(h, &allocator_heap, capacity, value_size);
+}
+
+bool hashtable_bytes_create_in(hashtable_bytes *h, allocator *a, size_t capacity, size_t value_size) {
+    capacity = hashtable_capacity_for(capacity);
+
+    return hashtable_bytes_allocate(h, a, capacity, value_size, capacity * HASHTABLE_BYTES_KEY_RESERVE);
+}
+
+void hashtable_bytes_destroy(hashtable_bytes *h) {
+    buffer_destroy(&h->control);
+    buffer_destroy(&h->slots);
+    buffer_destroy(&h->keys);
+}
+
+size_t hashtable_bytes_count(hashtable_bytes *h) {
+    return h->count;
+}
+
+uint64_t hashtable_bytes_hash(void *key, size_t size) {
+    // FNV-1a taking eight bytes at a time, with the high bits folded down
+    // after each step. The table mixes the result further.
+    const uint8_t *bytes = key;
+    uint64_t hash = 14695981039346656037ULL ^ size;
+    uint64_t word;
+
+    for (; size >= sizeof(word); bytes += sizeof(word), size -= sizeof(word)) {
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+
+    if (size > 0) {
+        word = 0;
+        memcpy(&word, bytes, size);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+
+    return hash;
+}
+
+static size_t hashtable_bytes_find(hashtable_bytes *h, uint64_t hash, void *key, size_t size) {
+    // Returns the slot index of the key, or the capacity if it's missing. The
+    // hash is already mixed.
+    uint8_t *control = h->control.data;
+    uint8_t h2 = hashtable_hash_h2(hash);
+    size_t mask = h->capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+
+    while (true) {
+        hashtable_group_mask match = hashtable_group_match(control + offset, h2);
+
+        for (; match; match = hashtable_group_mask_next(match)) {
+            size_t index = (offset + hashtable_group_mask_first(match)) & mask;
+            hashtable_bytes_key *k = hashtable_bytes_slot(h, index);
+
+            if (k->hash == hash && k->size == size
+                && (size == 0 || memcmp(h->keys.data + k->offset, key, size) == 0)) return index;
+        }
+
+        if (hashtable_group_match_empty(control + offset)) return h->capacity;
+
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+    }
+}
+
+static bool hashtable_bytes_rehash(hashtable_bytes *h, size_t new_capacity) {
+    // Slots keep the full hash, so keys are moved without hashing them again.
+    // Once most of the arena is removed keys, the live keys are copied to a
+    // new arena, otherwise the arena is kept as it is.
+    hashtable_bytes r;
+    bool compact = h->keys_unused > h->keys.size / 2;
+    size_t keys_size = compact ? h->keys.size - h->keys_unused : 0;
+
+    if (!hashtable_bytes_allocate(&r, h->slots.allocator, new_capacity, h->value_size, keys_size)) return false;
+
+    for (size_t i = 0; i < h->capacity; i++) {
+        if (!hashtable_control_full(h->control.data[i])) continue;
+
+        hashtable_bytes_key *k = hashtable_bytes_slot(h, i);
+        size_t index = hashtable_probe_insert(r.control.data, r.capacity, k->hash);
+        hashtable_control_set(r.control.data, r.capacity, index, hashtable_hash_h2(k->hash));
+        hashtable_bytes_key *moved = hashtable_bytes_slot(&r, index);
+        memcpy(moved, k, h->entry_size);
+
+        if (compact) {
+            // Room for every live key was allocated up front.
+            moved->offset = r.keys.size;
+            memcpy(buffer_push(&r.keys, k->size), h->keys.data + k->offset, k->size);
+        }
+    }
+
+    if (!compact) {
+        buffer keys;
+        buffer_move(&keys, &r.keys);
+        buffer_move(&r.keys, &h->keys);
+        buffer_move(&h->keys, &keys);
+        r.keys_unused = h->keys_unused;
+    }
+
+    r.count = h->count;
+    r.growth_left -= h->count;
+    hashtable_bytes_destroy(h);
+    *h = r;
+    buffer_move(&h->control, &r.control);
+    buffer_move(&h->slots, &r.slots);
+    buffer_move(&h->keys, &r.keys);
+
+    return true;
+}
+
+bool hashtable_bytes_put(hashtable_bytes *h, void *key, size_t size, void *value) {
+    return hashtable_bytes_put_hashed(h, hashtable_bytes_hash(key, size), key, size, value);
+}
+
+bool hashtable_bytes_put_hashed(hashtable_bytes *h, uint64_t hash, void *key, size_t size, void *value) {
+    assert(key != NULL || size == 0);
+    assert(value != NULL || h->value_size == 0);
+    hash = hashtable_hash_mix(hash);
+    size_t index = hashtable_bytes_find(h, hash, key, size);
+
+    if (index < h->capacity) {
+        if (h->value_size > 0) memmove(hashtable_bytes_slot(h, index) + 1, value, h->value_size);
+
+        return true;
+    }
+
+    if (h->growth_left == 0
+        && !hashtable_bytes_rehash(h, hashtable_capacity_rehash(h->capacity, h->count))) return false;
+
+    size_t offset = h->keys.size;
+    uint8_t *key_copy = buffer_push(&h->keys, size);
+
+    if (key_copy == NULL) return false;
+
+    // Empty keys may be NULL, which memcpy doesn't allow even for no bytes.
+    if (size > 0) memcpy(key_copy, key, size);
+
+    index = hashtable_probe_insert(h->control.data, h->capacity, hash);
+
+    // Reusing a deleted slot doesn't bring the table closer to a rehash.
+    if (h->control.data[index] == HASHTABLE_CONTROL_EMPTY) h->growth_left--;
+
+    hashtable_control_set(h->control.data, h->capacity, index, hashtable_hash_h2(hash));
+    hashtable_bytes_key *k = hashtable_bytes_slot(h, index);
+    k->hash = hash;
+    k->offset = offset;
+    k->size = size;
+
+    if (h->value_size > 0) memmove(k + 1, value, h->value_size);
+
+    h->count++;
+
+    return true;
+}
+
+bool hashtable_bytes_remove(hashtable_bytes *h, void *key, size_t size) {
+    return hashtable_bytes_remove_hashed(h, hashtable_bytes_hash(key, size), key, size);
+}
+
+bool hashtable_bytes_remove_hashed(hashtable_bytes *h, uint64_t hash, void *key, size_t size) {
+    assert(key != NULL || size == 0);
+
+    if (h->count == 0) return true;
+
+    size_t index = hashtable_bytes_find(h, hashtable_hash_mix(hash), key, size);
+
+    if (index < h->capacity) {
+        hashtable_control_set(h->control.data, h->capacity, index, HASHTABLE_CONTROL_DELETED);
+        h->keys_unused += size;
+        h->count--;
+    }
+
+    return true;
+}
+
+void * hashtable_bytes_get(hashtable_bytes *h, void *key, size_t size) {
+    if (h->count == 0) return NULL;
+
+    return hashtable_bytes_get_hashed(h, hashtable_bytes_hash(key, size), key, size);
+}
+
+void * hashtable_bytes_get_hashed(hashtable_bytes *h, uint64_t hash, void *key, size_t size) {
+    assert(key != NULL || size == 0);
+
+    if (h->count == 0) return NULL;
+
+    size_t index = hashtable_bytes_find(h, hashtable_hash_mix(hash), key, size);
+
+    if (index == h->capacity) return NULL;
+
+    return hashtable_bytes_slot(h, index) + 1;
+}
+
+hashtable_bytes_iterator hashtable_bytes_iterate(hashtable_bytes *h) {
+    hashtable_bytes_iterator it;
+    it.table = h;
+    it.slot_index = 0;
+    it.entry = NULL;
+
+    return it;
+}
+
+bool hashtable_bytes_iterate_next(hashtable_bytes_iterator *it) {
+    hashtable_bytes *h = it->table;
+    size_t index = it->entry == NULL ? 0 : it->slot_index + 1;
+
+    // Skip empty and deleted slots.
+    while (index < h->capacity && !hashtable_control_full(h->control.data[index])) index++;
+
+    it->slot_index = index;
+
+    if (index >= h->capacity) return false;
+
+    it->entry = (uint8_t *) hashtable_bytes_slot(h, index);
+
+    return true;
+}
+
+void * hashtable_bytes_iterate_key(hashtable_bytes_iterator *it, size_t *size) {
+    assert(it->entry != NULL);
+    hashtable_bytes_key *k = (hashtable_bytes_key *) it->entry;
+    *size = k->size;
+
+    return it->table->keys.data + k->offset;
+}
+
+void * hashtable_bytes_iterate_value(hashtable_bytes_iterator *it) {
+    assert(it->entry != NULL);
+
+    return it->entry + sizeof(hashtable_bytes_key);
+}
@@ -0,0 +1,75 @@
+/* Open addressing hashtable with variable length keys copied into the table. */
+#ifndef HASHTABLE_BYTES_H
+#define HASHTABLE_BYTES_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+// Refers to a key in the key arena, along with the full hash of the key.
+// Comparing the hash first means the key bytes are only read when the hashes
+// match, which is almost always the key being looked for.
+typedef struct {
+    uint64_t hash;
+    size_t offset;
+    size_t size;
+} hashtable_bytes_key;
+
+// Keys of any size, such as the characters of a `string`, are copied into one
+// arena owned by the table. Slots hold a hashtable_bytes_key followed by a
+// value of a fixed size, and control bytes work like in hashtable.h. Removed
+// keys leave their bytes in the arena until the table is next rehashed.
+typedef struct {
+    buffer control;
+    buffer slots;
+    buffer keys;
+    size_t capacity;
+    size_t count;
+    size_t growth_left;
+    size_t value_size;
+    // Size of a slot, the key followed by the value padded to the key's alignment.
+    size_t entry_size;
+    // Bytes in the arena no longer used by any key.
+    size_t keys_unused;
+} hashtable_bytes;
+
+typedef struct {
+    hashtable_bytes *table;
+    size_t slot_index;
+    uint8_t *entry;
+} hashtable_bytes_iterator;
+
+bool hashtable_bytes_create(hashtable_bytes *, size_t, size_t);
+
+bool hashtable_bytes_create_in(hashtable_bytes *, allocator *, size_t, size_t);
+
+void hashtable_bytes_destroy(hashtable_bytes *);
+
+size_t hashtable_bytes_count(hashtable_bytes *);
+
+// Hashes the bytes of a key. Keys are hashed with this by the functions not
+// taking a hash, and the *_hashed functions expect the same result.
+uint64_t hashtable_bytes_hash(void *, size_t);
+
+bool hashtable_bytes_put(hashtable_bytes *, void *, size_t, void *);
+
+bool hashtable_bytes_put_hashed(hashtable_bytes *, uint64_t, void *, size_t, void *);
+
+bool hashtable_bytes_remove(hashtable_bytes *, void *, size_t);
+
+bool hashtable_bytes_remove_hashed(hashtable_bytes *, uint64_t, void *, size_t);
+
+void * hashtable_bytes_get(hashtable_bytes *, void *, size_t);
+
+void * hashtable_bytes_get_hashed(hashtable_bytes *, uint64_t, void *, size_t);
+
+hashtable_bytes_iterator hashtable_bytes_iterate(hashtable_bytes *);
+
+bool hashtable_bytes_iterate_next(hashtable_bytes_iterator *);
+
+// Returns the bytes of the current key and sets the last argument to its size.
+void * hashtable_bytes_iterate_key(hashtable_bytes_iterator *, size_t *);
+
+void * hashtable_bytes_iterate_value(hashtable_bytes_iterator *);
+
+#endif
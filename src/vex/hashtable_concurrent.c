@@ -0,0 +1,394 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "hashtable_concurrent.h"
+#include "hashtable_group.h"
+
+// Number of retired pointers collected before trying to advance the epoch.
+#define HASHTABLE_CONCURRENT_RETIRE_BATCH 64
+
+typedef struct {
+    size_t capacity;
+    // Slots that aren't empty, reserved by writers before inserting.
+    volatile size_t used;
+    uint8_t * volatile *entries;
+    // Control bytes, followed by a copy of the first group like hashtable.
+    uint8_t control[];
+} hashtable_concurrent_table;
+
+static hashtable_concurrent_table * hashtable_concurrent_table_create(size_t capacity) {
+    // Control bytes and entry pointers are allocated together with the table.
+    size_t control_size = capacity + HASHTABLE_GROUP_WIDTH;
+    size_t entries_offset = sizeof(hashtable_concurrent_table) + control_size;
+    entries_offset = (entries_offset + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+    hashtable_concurrent_table *table = malloc(entries_offset + capacity * sizeof(void *));
+
+    if (table == NULL) return NULL;
+
+    table->capacity = capacity;
+    table->used = 0;
+    table->entries = (uint8_t * volatile *) ((uint8_t *) table + entries_offset);
+    memset(table->control, HASHTABLE_CONTROL_EMPTY, control_size);
+
+    for (size_t i = 0; i < capacity; i++) table->entries[i] = NULL;
+
+    return table;
+}
+
+static void hashtable_concurrent_control_set(hashtable_concurrent_table *table, size_t index, uint8_t control) {
+    // Set the mirrored byte first, so once the original is seen set both are.
+    if (index < HASHTABLE_GROUP_WIDTH) sync_store_byte(table->control + table->capacity + index, control);
+
+    sync_store_byte(table->control + index, control);
+}
+
+static size_t hashtable_concurrent_table_find(hashtable_concurrent_table *table,
+    bool(*equals)(void *, void *),
+    void *key,
+    uint64_t hash) {
+    // Returns the slot index of the key, or the capacity if it's missing.
+    // Control bytes are read while writers may change them, so a match is
+    // only a hint and the entry pointer is what's checked.
+    uint8_t h2 = hashtable_hash_h2(hash);
+    size_t mask = table->capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+
+    while (true) {
+        hashtable_group_mask match = hashtable_group_match(table->control + offset, h2);
+
+        for (; match; match = hashtable_group_mask_next(match)) {
+            size_t index = (offset + hashtable_group_mask_first(match)) & mask;
+            uint8_t *entry = sync_load_ptr((void * volatile *) &table->entries[index]);
+
+            if (entry != NULL && equals(key, entry)) return index;
+        }
+
+        if (hashtable_group_match_empty(table->control + offset)) return table->capacity;
+
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+    }
+}
+
+static bool hashtable_concurrent_table_claim(hashtable_concurrent_table *table, uint8_t *entry, uint64_t hash) {
+    // Claims an empty or deleted slot for the entry, racing writers of other
+    // stripes for it. Returns whether the claimed slot was empty.
+    size_t mask = table->capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+
+    while (true) {
+        hashtable_group_mask match = hashtable_group_match_empty_or_deleted(table->control + offset);
+
+        for (; match; match = hashtable_group_mask_next(match)) {
+            size_t index = (offset + hashtable_group_mask_first(match)) & mask;
+            bool empty = table->control[index] == HASHTABLE_CONTROL_EMPTY;
+
+            if (sync_compare_exchange_ptr((void * volatile *) &table->entries[index], NULL, entry)) {
+                hashtable_concurrent_control_set(table, index, hashtable_hash_h2(hash));
+                return empty;
+            }
+
+            // Another writer claimed the slot. Wait for its control byte, so
+            // lookups for this entry can't stop early at the slot.
+            while (((volatile uint8_t *) table->control)[index] == HASHTABLE_CONTROL_EMPTY) SYNC_PAUSE();
+        }
+
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+    }
+}
+
+static void hashtable_concurrent_enter(hashtable_concurrent *h, hashtable_concurrent_thread *t) {
+    sync_store(&t->state, (sync_load(&h->epoch) << 1) | 1);
+    sync_fence();
+}
+
+static void hashtable_concurrent_exit(hashtable_concurrent_thread *t) {
+    sync_store(&t->state, 0);
+}
+
+static void hashtable_concurrent_advance(hashtable_concurrent *h) {
+    // Advance the epoch if every thread inside a call has entered the current
+    // one. Called with the retired lock held.
+    size_t epoch = sync_load(&h->epoch);
+    sync_fence();
+
+    for (hashtable_concurrent_thread *t = sync_load_ptr((void * volatile *) &h->threads); t != NULL; t = t->next) {
+        size_t state = sync_load(&t->state);
+
+        if ((state & 1) && (state >> 1) != epoch) return;
+    }
+
+    sync_store(&h->epoch, epoch + 1);
+
+    // Nothing retired two epochs ago can be reached by any thread anymore.
+    buffer *retired = &h->retired[(epoch + 2) % 3];
+
+    for (size_t offset = 0, l = buffer_size(retired); offset < l; offset += sizeof(void *))
+        free(*(void **) buffer_get(retired, offset));
+
+    buffer_clear(retired);
+}
+
+static void hashtable_concurrent_retire(hashtable_concurrent *h, void *p) {
+    sync_lock_acquire(&h->retired_lock);
+    buffer *retired = &h->retired[sync_load(&h->epoch) % 3];
+    void **r = buffer_push(retired, sizeof(void *));
+
+    // Leak rather than free memory other threads might still read.
+    if (r != NULL) {
+        *r = p;
+    } else {
+        debug("Failed to retire %p", p);
+    }
+
+    if (buffer_size(retired) >= HASHTABLE_CONCURRENT_RETIRE_BATCH * sizeof(void *))
+        hashtable_concurrent_advance(h);
+
+    sync_lock_release(&h->retired_lock);
+}
+
+bool hashtable_concurrent_create(hashtable_concurrent *h, size_t capacity, size_t key_size, size_t value_size) {
+    for (size_t i = 0; i < 3; i++) {
+        if (!buffer_create(&h->retired[i], HASHTABLE_CONCURRENT_RETIRE_BATCH * sizeof(void *))) {
+            while (i-- > 0) buffer_destroy(&h->retired[i]);
+
+            return false;
+        }
+    }
+
+    h->table = hashtable_concurrent_table_create(hashtable_capacity_for(capacity));
+
+    if (h->table == NULL) {
+        for (size_t i = 0; i < 3; i++) buffer_destroy(&h->retired[i]);
+
+        return false;
+    }
+
+    h->key_size = key_size;
+    h->value_size = value_size;
+    h->count = 0;
+    h->threads = NULL;
+    h->epoch = 0;
+    sync_lock_create(&h->threads_lock);
+    sync_lock_create(&h->retired_lock);
+
+    for (size_t i = 0; i < HASHTABLE_CONCURRENT_STRIPES; i++) sync_lock_create(&h->stripes[i].lock);
+
+    return true;
+}
+
+void hashtable_concurrent_destroy(hashtable_concurrent *h) {
+    hashtable_concurrent_table *table = h->table;
+
+    for (size_t i = 0; i < table->capacity; i++) free(table->entries[i]);
+
+    free(table);
+
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t offset = 0, l = buffer_size(&h->retired[i]); offset < l; offset += sizeof(void *))
+            free(*(void **) buffer_get(&h->retired[i], offset));
+
+        buffer_destroy(&h->retired[i]);
+    }
+
+    while (h->threads != NULL) {
+        hashtable_concurrent_thread *next = h->threads->next;
+        free(h->threads);
+        h->threads = next;
+    }
+}
+
+hashtable_concurrent_thread * hashtable_concurrent_register(hashtable_concurrent *h) {
+    sync_lock_acquire(&h->threads_lock);
+
+    for (hashtable_concurrent_thread *t = h->threads; t != NULL; t = t->next) {
+        if (!t->registered) {
+            t->registered = true;
+            sync_lock_release(&h->threads_lock);
+
+            return t;
+        }
+    }
+
+    hashtable_concurrent_thread *t = malloc(sizeof(hashtable_concurrent_thread));
+
+    if (t != NULL) {
+        t->state = 0;
+        t->registered = true;
+        t->next = h->threads;
+        sync_store_ptr((void * volatile *) &h->threads, t);
+    }
+
+    sync_lock_release(&h->threads_lock);
+
+    return t;
+}
+
+void hashtable_concurrent_unregister(hashtable_concurrent *h, hashtable_concurrent_thread *t) {
+    // The state is left at 0 by the last call, so epochs never wait on it.
+    assert(sync_load(&t->state) == 0);
+
+    sync_lock_acquire(&h->threads_lock);
+    t->registered = false;
+    sync_lock_release(&h->threads_lock);
+}
+
+size_t hashtable_concurrent_count(hashtable_concurrent *h) {
+    return sync_load(&h->count);
+}
+
+static bool hashtable_concurrent_grow(hashtable_concurrent *h, uint64_t (*hash)(void *), hashtable_concurrent_table *full) {
+    // Replace the full table while holding every stripe, so no writer is
+    // changing it. Lookups keep using the old table until it's replaced.
+    for (size_t i = 0; i < HASHTABLE_CONCURRENT_STRIPES; i++) sync_lock_acquire(&h->stripes[i].lock);
+
+    hashtable_concurrent_table *table = h->table;
+    bool grown = true;
+
+    // Only grow if another writer didn't already.
+    if (table == full) {
+        size_t capacity = hashtable_capacity_rehash(table->capacity, sync_load(&h->count));
+        hashtable_concurrent_table *r = hashtable_concurrent_table_create(capacity);
+
+        if (r != NULL) {
+            for (size_t i = 0; i < table->capacity; i++) {
+                uint8_t *entry = table->entries[i];
+
+                if (entry != NULL) {
+                    hashtable_concurrent_table_claim(r, entry, hashtable_hash_mix(hash(entry)));
+                    r->used++;
+                }
+            }
+
+            sync_store_ptr(&h->table, r);
+        } else {
+            grown = false;
+        }
+    }
+
+    for (size_t i = HASHTABLE_CONCURRENT_STRIPES; i-- > 0;) sync_lock_release(&h->stripes[i].lock);
+
+    if (grown && table == full) hashtable_concurrent_retire(h, table);
+
+    return grown;
+}
+
+bool hashtable_concurrent_put(hashtable_concurrent *h,
+    hashtable_concurrent_thread *t,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    void *key,
+    void *value) {
+    assert(key != NULL);
+    assert(value != NULL);
+    uint8_t *entry = malloc(h->key_size + h->value_size);
+
+    if (entry == NULL) return false;
+
+    memcpy(entry, key, h->key_size);
+    memcpy(entry + h->key_size, value, h->value_size);
+    uint64_t key_hash = hashtable_hash_mix(hash(key));
+    sync_lock *stripe = &h->stripes[key_hash % HASHTABLE_CONCURRENT_STRIPES].lock;
+    hashtable_concurrent_enter(h, t);
+
+    while (true) {
+        sync_lock_acquire(stripe);
+        hashtable_concurrent_table *table = h->table;
+        size_t index = hashtable_concurrent_table_find(table, equals, key, key_hash);
+
+        if (index < table->capacity) {
+            // Replace the entry rather than change it under concurrent lookups.
+            void *old = sync_exchange_ptr((void * volatile *) &table->entries[index], entry);
+            sync_lock_release(stripe);
+            hashtable_concurrent_retire(h, old);
+            break;
+        }
+
+        // Reserve a slot, growing first if the table is full.
+        if (sync_fetch_add(&table->used, 1) >= hashtable_capacity_growth(table->capacity)) {
+            sync_fetch_add(&table->used, (size_t) -1);
+            sync_lock_release(stripe);
+
+            if (!hashtable_concurrent_grow(h, hash, table)) {
+                hashtable_concurrent_exit(t);
+                free(entry);
+                return false;
+            }
+
+            continue;
+        }
+
+        // Reusing a deleted slot doesn't use up the reservation.
+        if (!hashtable_concurrent_table_claim(table, entry, key_hash)) sync_fetch_add(&table->used, (size_t) -1);
+
+        sync_fetch_add(&h->count, 1);
+        sync_lock_release(stripe);
+        break;
+    }
+
+    hashtable_concurrent_exit(t);
+
+    return true;
+}
+
+bool hashtable_concurrent_remove(hashtable_concurrent *h,
+    hashtable_concurrent_thread *t,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    void *key) {
+    assert(key != NULL);
+    uint64_t key_hash = hashtable_hash_mix(hash(key));
+    sync_lock *stripe = &h->stripes[key_hash % HASHTABLE_CONCURRENT_STRIPES].lock;
+    hashtable_concurrent_enter(h, t);
+    sync_lock_acquire(stripe);
+    hashtable_concurrent_table *table = h->table;
+    size_t index = hashtable_concurrent_table_find(table, equals, key, key_hash);
+    void *old = NULL;
+
+    if (index < table->capacity) {
+        hashtable_concurrent_control_set(table, index, HASHTABLE_CONTROL_DELETED);
+        old = sync_exchange_ptr((void * volatile *) &table->entries[index], NULL);
+        sync_fetch_add(&h->count, (size_t) -1);
+    }
+
+    sync_lock_release(stripe);
+
+    if (old != NULL) hashtable_concurrent_retire(h, old);
+
+    hashtable_concurrent_exit(t);
+
+    return true;
+}
+
+bool hashtable_concurrent_get(hashtable_concurrent *h,
+    hashtable_concurrent_thread *t,
+    uint64_t(*hash)(void *),
+    bool(*equals)(void *, void *),
+    void *key,
+    void *value) {
+    assert(key != NULL);
+    assert(value != NULL);
+    uint64_t key_hash = hashtable_hash_mix(hash(key));
+    bool found = false;
+    hashtable_concurrent_enter(h, t);
+    hashtable_concurrent_table *table = sync_load_ptr(&h->table);
+    size_t index = hashtable_concurrent_table_find(table, equals, key, key_hash);
+
+    if (index < table->capacity) {
+        // The entry may have been replaced since it was found, but it stays
+        // allocated until this thread exits the epoch.
+        uint8_t *entry = sync_load_ptr((void * volatile *) &table->entries[index]);
+
+        if (entry != NULL && equals(key, entry)) {
+            memcpy(value, entry + h->key_size, h->value_size);
+            found = true;
+        }
+    }
+
+    hashtable_concurrent_exit(t);
+
+    return found;
+}
@@ -0,0 +1,75 @@
+/* Concurrent open addressing hashtable with lock free lookups. */
+#ifndef HASHTABLE_CONCURRENT_H
+#define HASHTABLE_CONCURRENT_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+#include "sync.h"
+
+// Number of locks writers are spread over by hash.
+#define HASHTABLE_CONCURRENT_STRIPES 64
+
+// Every thread using a concurrent hashtable registers once to get one of
+// these, and passes it to every call. It records which epoch the thread has
+// entered, so memory the thread might still read isn't freed.
+typedef struct hashtable_concurrent_thread {
+    struct hashtable_concurrent_thread *next;
+    // Epoch shifted left once, with the lowest bit set while inside a call.
+    volatile size_t state;
+    // Whether a thread holds the record, changed with the threads lock held.
+    bool registered;
+} hashtable_concurrent_thread;
+
+typedef struct {
+    sync_lock lock;
+    uint8_t padding[SYNC_CACHE_LINE - sizeof(sync_lock)];
+} hashtable_concurrent_stripe;
+
+// Entries are immutable key + value data allocated separately, and slots
+// point to them. Lookups never lock: they follow the slot pointers and copy
+// the value out. Writers lock one stripe by hash and replace entries instead
+// of changing them, retiring the previous ones. Retired entries and tables
+// are freed once every registered thread has moved past the epoch they were
+// retired in.
+typedef struct {
+    // Current table, replaced as a whole when growing.
+    void * volatile table;
+    size_t key_size;
+    size_t value_size;
+    volatile size_t count;
+    hashtable_concurrent_stripe stripes[HASHTABLE_CONCURRENT_STRIPES];
+    sync_lock threads_lock;
+    hashtable_concurrent_thread * volatile threads;
+    volatile size_t epoch;
+    sync_lock retired_lock;
+    // Pointers retired in each of the last three epochs.
+    buffer retired[3];
+} hashtable_concurrent;
+
+bool hashtable_concurrent_create(hashtable_concurrent *, size_t, size_t, size_t);
+
+// Destroys the hashtable. No other thread may be using it.
+void hashtable_concurrent_destroy(hashtable_concurrent *);
+
+// Registers the calling thread. The record is owned by the hashtable, and one
+// left by a thread that unregistered is reused before allocating another.
+hashtable_concurrent_thread * hashtable_concurrent_register(hashtable_concurrent *);
+
+// Gives back the record of a thread that's done with the hashtable, outside
+// of any call. Records stay in the list epochs are checked against, since
+// it's read without locking, and are freed when the hashtable is destroyed.
+void hashtable_concurrent_unregister(hashtable_concurrent *, hashtable_concurrent_thread *);
+
+size_t hashtable_concurrent_count(hashtable_concurrent *);
+
+bool hashtable_concurrent_put(hashtable_concurrent *, hashtable_concurrent_thread *, uint64_t (*)(void *), bool (*)(void *, void *), void *, void *);
+
+bool hashtable_concurrent_remove(hashtable_concurrent *, hashtable_concurrent_thread *, uint64_t (*)(void *), bool (*)(void *, void *), void *);
+
+// Copies the value of the key, if found, into the last argument. Lookups run
+// concurrently with writers, so the key is only compared against complete
+// entries.
+bool hashtable_concurrent_get(hashtable_concurrent *, hashtable_concurrent_thread *, uint64_t (*)(void *), bool (*)(void *, void *), void *, void *);
+
+#endif
\ No newline at end of file
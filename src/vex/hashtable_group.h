@@ -0,0 +1,233 @@
+// Control byte groups for the open addressing hashtable. Each slot in a
+// hashtable has one control byte that is either empty, deleted, or holds the
+// low 7 bits of the slot's hash. Groups of control bytes are matched at once,
+// with SSE2 or AVX2 when available and a portable 64-bit fallback otherwise.
+// Shared by hashtable.c and the specialized tables in hashtable_typed.h.
+#ifndef HASHTABLE_GROUP_H
+#define HASHTABLE_GROUP_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if !defined(HASHTABLE_GROUP_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define HASHTABLE_GROUP_AVX2
+#define HASHTABLE_GROUP_WIDTH 32
+#define HASHTABLE_GROUP_MASK_SHIFT 0
+#elif !defined(HASHTABLE_GROUP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define HASHTABLE_GROUP_SSE2
+#define HASHTABLE_GROUP_WIDTH 16
+#define HASHTABLE_GROUP_MASK_SHIFT 0
+#else
+#define HASHTABLE_GROUP_WIDTH 8
+#define HASHTABLE_GROUP_MASK_SHIFT 3
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define HASHTABLE_CONTROL_EMPTY ((uint8_t) 0x80)
+#define HASHTABLE_CONTROL_DELETED ((uint8_t) 0xFE)
+
+static inline bool hashtable_control_full(uint8_t control) {
+    // Only empty and deleted control bytes have the high bit set.
+    return (control & 0x80) == 0;
+}
+
+// Mask of matching slots in a group. SIMD groups use one bit per slot, the
+// portable fallback uses the high bit of one byte per slot.
+typedef uint64_t hashtable_group_mask;
+
+// Mixes the user supplied hash, since hashes such as the identity of a char
+// would otherwise place every key in the same group.
+static inline uint64_t hashtable_hash_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// Position in the table where probing for the hash starts.
+static inline size_t hashtable_hash_h1(uint64_t hash) {
+    return (size_t) (hash >> 7);
+}
+
+// Hash bits stored in the control byte of a full slot.
+static inline uint8_t hashtable_hash_h2(uint64_t hash) {
+    return (uint8_t) (hash & 0x7F);
+}
+
+static inline size_t hashtable_group_mask_first(hashtable_group_mask mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+
+    if (_BitScanForward(&index, (unsigned long) mask))
+        return index >> HASHTABLE_GROUP_MASK_SHIFT;
+
+    _BitScanForward(&index, (unsigned long) (mask >> 32));
+
+    return (index + 32) >> HASHTABLE_GROUP_MASK_SHIFT;
+#else
+    return (size_t) __builtin_ctzll(mask) >> HASHTABLE_GROUP_MASK_SHIFT;
+#endif
+}
+
+static inline hashtable_group_mask hashtable_group_mask_next(hashtable_group_mask mask) {
+    // Clear the lowest set bit.
+    return mask & (mask - 1);
+}
+
+#if defined(HASHTABLE_GROUP_AVX2)
+
+static inline hashtable_group_mask hashtable_group_match(const uint8_t *control, uint8_t h2) {
+    __m256i group = _mm256_loadu_si256((const __m256i *) control);
+    __m256i match = _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) h2));
+
+    return (uint32_t) _mm256_movemask_epi8(match);
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty(const uint8_t *control) {
+    return hashtable_group_match(control, HASHTABLE_CONTROL_EMPTY);
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty_or_deleted(const uint8_t *control) {
+    // Only empty and deleted control bytes have the high bit set.
+    __m256i group = _mm256_loadu_si256((const __m256i *) control);
+
+    return (uint32_t) _mm256_movemask_epi8(group);
+}
+
+#elif defined(HASHTABLE_GROUP_SSE2)
+
+static inline hashtable_group_mask hashtable_group_match(const uint8_t *control, uint8_t h2) {
+    __m128i group = _mm_loadu_si128((const __m128i *) control);
+    __m128i match = _mm_cmpeq_epi8(group, _mm_set1_epi8((char) h2));
+
+    return (uint32_t) _mm_movemask_epi8(match);
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty(const uint8_t *control) {
+    return hashtable_group_match(control, HASHTABLE_CONTROL_EMPTY);
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty_or_deleted(const uint8_t *control) {
+    // Only empty and deleted control bytes have the high bit set.
+    __m128i group = _mm_loadu_si128((const __m128i *) control);
+
+    return (uint32_t) _mm_movemask_epi8(group);
+}
+
+#else
+
+#define HASHTABLE_GROUP_LSBS 0x0101010101010101ULL
+#define HASHTABLE_GROUP_MSBS 0x8080808080808080ULL
+
+static inline uint64_t hashtable_group_load(const uint8_t *control) {
+    uint64_t group;
+    memcpy(&group, control, sizeof(group));
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+
+    return group;
+}
+
+static inline hashtable_group_mask hashtable_group_match(const uint8_t *control, uint8_t h2) {
+    // Zero bytes of `x` are the matches. This may report a false positive for
+    // a byte following a true match, which is fine as every match is compared
+    // against the key anyway.
+    uint64_t x = hashtable_group_load(control) ^ (HASHTABLE_GROUP_LSBS * h2);
+
+    return (x - HASHTABLE_GROUP_LSBS) & ~x & HASHTABLE_GROUP_MSBS;
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty(const uint8_t *control) {
+    // Empty has the high bit set and, unlike deleted, bit 1 cleared.
+    uint64_t group = hashtable_group_load(control);
+
+    return group & ~(group << 6) & HASHTABLE_GROUP_MSBS;
+}
+
+static inline hashtable_group_mask hashtable_group_match_empty_or_deleted(const uint8_t *control) {
+    // Only empty and deleted control bytes have the high bit set.
+    return hashtable_group_load(control) & HASHTABLE_GROUP_MSBS;
+}
+
+#endif
+
+// Number of keys hashed and prefetched ahead of being looked up by the batched
+// hashtable functions.
+#define HASHTABLE_BATCH_SIZE 16
+
+// Number of old slots migrated by each put and remove while incrementally
+// rehashing. Must be at least 3 for a migration to finish before the new
+// slots fill up, larger values finish sooner.
+#define HASHTABLE_REHASH_BUDGET 16
+
+static inline void hashtable_prefetch(const void *p) {
+#if defined(HASHTABLE_GROUP_SSE2) || defined(HASHTABLE_GROUP_AVX2)
+    _mm_prefetch((const char *) p, _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void) p;
+#endif
+}
+
+static inline size_t hashtable_capacity_growth(size_t capacity) {
+    // Keep the load factor at most 7/8 so probing always finds an empty slot.
+    return capacity - capacity / 8;
+}
+
+static inline size_t hashtable_capacity_for(size_t count) {
+    // Smallest power of two capacity that holds count entries without growth.
+    size_t capacity = HASHTABLE_GROUP_WIDTH;
+
+    while (hashtable_capacity_growth(capacity) < count) capacity *= 2;
+
+    return capacity;
+}
+
+static inline size_t hashtable_capacity_rehash(size_t capacity, size_t count) {
+    // Grow if the table is getting full, otherwise the slots are mostly
+    // deleted ones and rehashing at the same capacity clears them.
+    return count + 1 > capacity * 7 / 16 ? capacity * 2 : capacity;
+}
+
+static inline size_t hashtable_capacity_reserve(size_t capacity, size_t count) {
+    // Capacity to rehash to so count entries fit without growing, never
+    // shrinking the table.
+    size_t reserved = hashtable_capacity_for(count);
+
+    return reserved > capacity ? reserved : capacity;
+}
+
+static inline void hashtable_control_set(uint8_t *control, size_t capacity, size_t index, uint8_t c) {
+    control[index] = c;
+
+    // Mirror the first group after the end.
+    if (index < HASHTABLE_GROUP_WIDTH) control[capacity + index] = c;
+}
+
+static inline size_t hashtable_probe_insert(const uint8_t *control, size_t capacity, uint64_t hash) {
+    // Probe groups in a triangular sequence, which visits every group when
+    // the capacity is a power of two.
+    size_t mask = capacity - 1;
+    size_t offset = hashtable_hash_h1(hash) & mask;
+    size_t stride = 0;
+
+    while (true) {
+        hashtable_group_mask match = hashtable_group_match_empty_or_deleted(control + offset);
+
+        if (match) return (offset + hashtable_group_mask_first(match)) & mask;
+
+        stride += HASHTABLE_GROUP_WIDTH;
+        offset = (offset + stride) & mask;
+    }
+}
+
+#endif
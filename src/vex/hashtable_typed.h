@@ -1,7 +1,11 @@
 // Extends hashtable.h with a macro to create typed hashtable for additional safety.
+// The typed functions are specialized for the key and value types, so hashing,
+// comparing and copying entries is inlined rather than done through function
+// pointers and byte sizes.
 #ifndef HASHTABLE_TYPED_H
 #define HASHTABLE_TYPED_H
 #include "hashtable.h"
+#include "hashtable_group.h"
 
 #define HASHTABLE_REGISTER_TYPE(name, key_type, value_type, hash_func, equals_func) \
     typedef struct { hashtable h; } hashtable_ ## name; \
@@ -13,55 +17,228 @@
     inline static bool hashtable_equals_ ## name(key_type *a, key_type *b) { \
         return equals_func(*a, *b); \
     } \
+    inline static hashtable_entry_ ## name * hashtable_slot_ ## name(hashtable_ ## name *ht, size_t index) { \
+        return (hashtable_entry_ ## name *) ht->h.slots.data + index; \
+    } \
+    inline static hashtable_entry_ ## name * hashtable_old_slot_ ## name(hashtable_ ## name *ht, size_t index) { \
+        return (hashtable_entry_ ## name *) ht->h.old_slots.data + index; \
+    } \
+    inline static size_t hashtable_find_in_ ## name(uint8_t *control, hashtable_entry_ ## name *slots, size_t capacity, key_type *key, uint64_t hash) { \
+        /* Returns the slot index of the key, or the capacity if it's missing. */ \
+        uint8_t h2 = hashtable_hash_h2(hash); \
+        size_t mask = capacity - 1; \
+        size_t offset = hashtable_hash_h1(hash) & mask; \
+        size_t stride = 0; \
+        while (true) { \
+            hashtable_group_mask match = hashtable_group_match(control + offset, h2); \
+            for (; match; match = hashtable_group_mask_next(match)) { \
+                size_t index = (offset + hashtable_group_mask_first(match)) & mask; \
+                if (equals_func(*key, slots[index].key)) return index; \
+            } \
+            if (hashtable_group_match_empty(control + offset)) return capacity; \
+            stride += HASHTABLE_GROUP_WIDTH; \
+            offset = (offset + stride) & mask; \
+        } \
+    } \
+    inline static size_t hashtable_find_ ## name(hashtable_ ## name *ht, key_type *key, uint64_t hash) { \
+        return hashtable_find_in_ ## name(ht->h.control.data, hashtable_slot_ ## name(ht, 0), ht->h.capacity, key, hash); \
+    } \
+    inline static size_t hashtable_find_old_ ## name(hashtable_ ## name *ht, key_type *key, uint64_t hash) { \
+        /* Searches the old slots, returning the old capacity if the key is missing. */ \
+        if (ht->h.old_capacity == 0) return 0; \
+        return hashtable_find_in_ ## name(ht->h.old_control.data, hashtable_old_slot_ ## name(ht, 0), ht->h.old_capacity, key, hash); \
+    } \
+    inline static hashtable_entry_ ## name * hashtable_find_entry_ ## name(hashtable_ ## name *ht, key_type *key, uint64_t hash) { \
+        size_t index = hashtable_find_ ## name(ht, key, hash); \
+        if (index < ht->h.capacity) return hashtable_slot_ ## name(ht, index); \
+        index = hashtable_find_old_ ## name(ht, key, hash); \
+        if (index < ht->h.old_capacity) return hashtable_old_slot_ ## name(ht, index); \
+        return NULL; \
+    } \
+    inline static bool hashtable_insert_ ## name(hashtable_ ## name *ht, hashtable_entry_ ## name *entry, uint64_t hash) { \
+        /* Inserts an entry known to be missing into a table with room for it, */ \
+        /* returning whether it reused an empty slot. */ \
+        uint8_t *control = ht->h.control.data; \
+        size_t index = hashtable_probe_insert(control, ht->h.capacity, hash); \
+        bool empty = control[index] == HASHTABLE_CONTROL_EMPTY; \
+        hashtable_control_set(control, ht->h.capacity, index, hashtable_hash_h2(hash)); \
+        *hashtable_slot_ ## name(ht, index) = *entry; \
+        return empty; \
+    } \
+    inline static void hashtable_migrate_ ## name(hashtable_ ## name *ht, size_t budget) { \
+        uint8_t *old_control = ht->h.old_control.data; \
+        for (; budget > 0 && ht->h.rehash_index < ht->h.old_capacity; budget--) { \
+            size_t i = ht->h.rehash_index++; \
+            if (!hashtable_control_full(old_control[i])) continue; \
+            hashtable_entry_ ## name *entry = hashtable_old_slot_ ## name(ht, i); \
+            if (!hashtable_insert_ ## name(ht, entry, hashtable_hash_mix(hash_func(entry->key)))) ht->h.growth_left++; \
+            hashtable_control_set(old_control, ht->h.old_capacity, i, HASHTABLE_CONTROL_DELETED); \
+        } \
+        if (ht->h.old_capacity > 0 && ht->h.rehash_index >= ht->h.old_capacity) { \
+            buffer_destroy(&ht->h.old_control); \
+            buffer_destroy(&ht->h.old_slots); \
+            ht->h.old_capacity = 0; \
+            ht->h.rehash_index = 0; \
+        } \
+    } \
+    inline static bool hashtable_rehash_ ## name(hashtable_ ## name *ht, size_t new_capacity) { \
+        hashtable_migrate_ ## name(ht, ht->h.old_capacity); \
+        if (ht->h.incremental) return hashtable_rehash_begin(&ht->h, new_capacity); \
+        hashtable_ ## name old; \
+        hashtable_move(&old.h, &ht->h); \
+        if (!hashtable_create_sized_in(&ht->h, old.h.slots.allocator, new_capacity, sizeof(hashtable_entry_ ## name))) { \
+            hashtable_move(&ht->h, &old.h); \
+            return false; \
+        } \
+        uint8_t *control = old.h.control.data; \
+        for (size_t i = 0; i < old.h.capacity; i++) { \
+            if (!hashtable_control_full(control[i])) continue; \
+            hashtable_entry_ ## name *entry = hashtable_slot_ ## name(&old, i); \
+            hashtable_insert_ ## name(ht, entry, hashtable_hash_mix(hash_func(entry->key))); \
+        } \
+        ht->h.count = old.h.count; \
+        ht->h.growth_left -= old.h.count; \
+        ht->h.incremental = old.h.incremental; \
+        hashtable_counters_copy(&ht->h, &old.h); \
+        hashtable_counter_add(&ht->h, rehashes, 1); \
+        hashtable_counter_add(&ht->h, reallocs, 1); \
+        hashtable_destroy(&old.h); \
+        return true; \
+    } \
     inline static bool hashtable_create_ ## name(hashtable_ ## name *ht, size_t capacity) { \
-        return hashtable_create(&ht->h, capacity, capacity * sizeof(key_type), capacity * sizeof(value_type)); \
+        return hashtable_create_sized(&ht->h, hashtable_capacity_for(capacity), sizeof(hashtable_entry_ ## name)); \
+    } \
+    inline static bool hashtable_create_in_ ## name(hashtable_ ## name *ht, allocator *a, size_t capacity) { \
+        return hashtable_create_sized_in(&ht->h, a, hashtable_capacity_for(capacity), sizeof(hashtable_entry_ ## name)); \
     } \
     inline static void hashtable_destroy_ ## name(hashtable_ ## name *ht) { \
         hashtable_destroy(&ht->h); \
     } \
+    inline static size_t hashtable_count_ ## name(hashtable_ ## name *ht) { \
+        return hashtable_count(&ht->h); \
+    } \
     inline static size_t hashtable_bucket_count_ ## name(hashtable_ ## name *ht) { \
         return hashtable_bucket_count(&ht->h); \
     } \
+    inline static void hashtable_rehash_incremental_ ## name(hashtable_ ## name *ht, bool incremental) { \
+        hashtable_rehash_incremental(&ht->h, incremental); \
+    } \
+    inline static bool hashtable_rehash_step_ ## name(hashtable_ ## name *ht, size_t budget) { \
+        hashtable_migrate_ ## name(ht, budget); \
+        return ht->h.old_capacity > 0; \
+    } \
+    inline static size_t hashtable_rehash_remaining_ ## name(hashtable_ ## name *ht) { \
+        return hashtable_rehash_remaining(&ht->h); \
+    } \
+    inline static bool hashtable_put_mixed_ ## name(hashtable_ ## name *ht, key_type key, value_type value, uint64_t hash) { \
+        hashtable_entry_ ## name *found = hashtable_find_entry_ ## name(ht, &key, hash); \
+        if (found != NULL) { \
+            found->value = value; \
+            return true; \
+        } \
+        if (ht->h.growth_left == 0 \
+            && !hashtable_rehash_ ## name(ht, hashtable_capacity_rehash(ht->h.capacity, ht->h.count))) return false; \
+        hashtable_entry_ ## name entry; \
+        entry.key = key; \
+        entry.value = value; \
+        if (hashtable_insert_ ## name(ht, &entry, hash)) ht->h.growth_left--; \
+        ht->h.count++; \
+        return true; \
+    } \
+    inline static bool hashtable_put_hashed_ ## name(hashtable_ ## name *ht, uint64_t hash, key_type key, value_type value) { \
+        hashtable_migrate_ ## name(ht, HASHTABLE_REHASH_BUDGET); \
+        return hashtable_put_mixed_ ## name(ht, key, value, hashtable_hash_mix(hash)); \
+    } \
     inline static bool hashtable_put_ ## name(hashtable_ ## name *ht, key_type key, value_type value) { \
-        return hashtable_put( \
-            &ht->h, \
-            (uint64_t (*)(void *)) hashtable_hash_ ## name, \
-            (bool (*)(void *, void *)) hashtable_equals_ ## name, \
-            &key, \
-            sizeof(key_type), \
-            &value, \
-            sizeof(value_type)); \
+        return hashtable_put_hashed_ ## name(ht, hash_func(key), key, value); \
+    } \
+    inline static void hashtable_prefetch_ ## name(hashtable_ ## name *ht, uint64_t hash) { \
+        size_t offset = hashtable_hash_h1(hash) & (ht->h.capacity - 1); \
+        hashtable_prefetch(ht->h.control.data + offset); \
+        hashtable_prefetch(hashtable_slot_ ## name(ht, offset)); \
+    } \
+    inline static bool hashtable_put_many_ ## name(hashtable_ ## name *ht, size_t count, key_type *keys, value_type *values) { \
+        uint64_t hashes[HASHTABLE_BATCH_SIZE]; \
+        if (ht->h.growth_left < count) { \
+            /* Make room for every key up front, all at once even when incremental. */ \
+            bool incremental = ht->h.incremental; \
+            ht->h.incremental = false; \
+            bool rehashed = hashtable_rehash_ ## name(ht, hashtable_capacity_reserve(ht->h.capacity, ht->h.count + count)); \
+            ht->h.incremental = incremental; \
+            if (!rehashed) return false; \
+        } \
+        for (size_t start = 0; start < count; start += HASHTABLE_BATCH_SIZE) { \
+            size_t batch = count - start < HASHTABLE_BATCH_SIZE ? count - start : HASHTABLE_BATCH_SIZE; \
+            for (size_t i = 0; i < batch; i++) { \
+                hashes[i] = hashtable_hash_mix(hash_func(keys[start + i])); \
+                hashtable_prefetch_ ## name(ht, hashes[i]); \
+            } \
+            for (size_t i = 0; i < batch; i++) { \
+                if (!hashtable_put_mixed_ ## name(ht, keys[start + i], values[start + i], hashes[i])) return false; \
+            } \
+        } \
+        return true; \
+    } \
+    inline static bool hashtable_remove_hashed_ ## name(hashtable_ ## name *ht, uint64_t hash, key_type key) { \
+        hashtable_migrate_ ## name(ht, HASHTABLE_REHASH_BUDGET); \
+        hash = hashtable_hash_mix(hash); \
+        size_t index = hashtable_find_ ## name(ht, &key, hash); \
+        if (index < ht->h.capacity) { \
+            hashtable_control_set(ht->h.control.data, ht->h.capacity, index, HASHTABLE_CONTROL_DELETED); \
+            ht->h.count--; \
+            return true; \
+        } \
+        index = hashtable_find_old_ ## name(ht, &key, hash); \
+        if (index < ht->h.old_capacity) { \
+            hashtable_control_set(ht->h.old_control.data, ht->h.old_capacity, index, HASHTABLE_CONTROL_DELETED); \
+            ht->h.growth_left++; \
+            ht->h.count--; \
+        } \
+        return true; \
     } \
     inline static bool hashtable_remove_ ## name(hashtable_ ## name *ht, key_type key) { \
-        return hashtable_remove( \
-            &ht->h, \
-            (uint64_t (*)(void *)) hashtable_hash_ ## name, \
-            (bool (*)(void *, void *)) hashtable_equals_ ## name, \
-            &key, \
-            sizeof(key_type), \
-            sizeof(value_type)); \
-    } \
-    inline static hashtable_entry_ ## name hashtable_get_entry_ ## name(hashtable_ ## name *ht, key_type key) { \
-        uint8_t * ue = hashtable_get_entry( \
-            &ht->h, \
-            (uint64_t (*)(void *)) hashtable_hash_ ## name, \
-            (bool (*)(void *, void *)) hashtable_equals_ ## name, \
-            &key, \
-            sizeof(key_type), \
-            sizeof(value_type)); \
-        hashtable_entry_ ## name e; \
-        e.key = *(key_type *) ue; \
-        e.value = *((value_type *) ue + sizeof(value_type)); \
+        return hashtable_remove_hashed_ ## name(ht, hash_func(key), key); \
+    } \
+    inline static hashtable_entry_ ## name * hashtable_get_entry_hashed_ ## name(hashtable_ ## name *ht, uint64_t hash, key_type key) { \
+        hashtable_entry_ ## name *e = hashtable_find_entry_ ## name(ht, &key, hashtable_hash_mix(hash)); \
+        if (e != NULL) { \
+            hashtable_counter_add(&ht->h, hits, 1); \
+        } else { \
+            hashtable_counter_add(&ht->h, misses, 1); \
+        } \
         return e; \
     } \
+    inline static hashtable_entry_ ## name * hashtable_get_entry_ ## name(hashtable_ ## name *ht, key_type key) { \
+        return hashtable_get_entry_hashed_ ## name(ht, hash_func(key), key); \
+    } \
+    inline static value_type * hashtable_get_hashed_ ## name(hashtable_ ## name *ht, uint64_t hash, key_type key) { \
+        hashtable_entry_ ## name *e = hashtable_get_entry_hashed_ ## name(ht, hash, key); \
+        return e == NULL ? NULL : &e->value; \
+    } \
     inline static value_type * hashtable_get_ ## name(hashtable_ ## name *ht, key_type key) { \
-        return (value_type *) hashtable_get( \
-            &ht->h, \
-            (uint64_t (*)(void *)) hashtable_hash_ ## name, \
-            (bool (*)(void *, void *)) hashtable_equals_ ## name, \
-            &key, \
-            sizeof(key_type), \
-            sizeof(value_type)); \
+        return hashtable_get_hashed_ ## name(ht, hash_func(key), key); \
+    } \
+    inline static size_t hashtable_get_many_ ## name(hashtable_ ## name *ht, size_t count, key_type *keys, value_type **values) { \
+        uint64_t hashes[HASHTABLE_BATCH_SIZE]; \
+        size_t found = 0; \
+        for (size_t start = 0; start < count; start += HASHTABLE_BATCH_SIZE) { \
+            size_t batch = count - start < HASHTABLE_BATCH_SIZE ? count - start : HASHTABLE_BATCH_SIZE; \
+            for (size_t i = 0; i < batch; i++) { \
+                hashes[i] = hashtable_hash_mix(hash_func(keys[start + i])); \
+                hashtable_prefetch_ ## name(ht, hashes[i]); \
+            } \
+            for (size_t i = 0; i < batch; i++) { \
+                hashtable_entry_ ## name *e = hashtable_find_entry_ ## name(ht, &keys[start + i], hashes[i]); \
+                values[start + i] = e == NULL ? NULL : &e->value; \
+                found += e != NULL; \
+            } \
+        } \
+        hashtable_counter_add(&ht->h, hits, found); \
+        hashtable_counter_add(&ht->h, misses, count - found); \
+        return found; \
+    } \
+    inline static void hashtable_get_stats_ ## name(hashtable_ ## name *ht, hashtable_stats *stats) { \
+        hashtable_get_stats(&ht->h, (uint64_t (*)(void *)) hashtable_hash_ ## name, stats); \
     } \
     inline static hashtable_iterator_ ## name hashtable_iterate_ ## name(hashtable_ ## name *ht) { \
         hashtable_iterator_ ## name it; \
@@ -69,13 +246,27 @@
         return it; \
     } \
     inline static bool hashtable_iterate_next_ ## name(hashtable_iterator_ ## name *it) { \
-        return hashtable_iterate_next(&it->h, sizeof(key_type), sizeof(value_type)); \
+        /* Slots past the capacity are the old ones of an incremental migration. */ \
+        hashtable_ ## name *ht = (hashtable_ ## name *) it->h.table; \
+        size_t capacity = ht->h.capacity; \
+        size_t end = capacity + ht->h.old_capacity; \
+        size_t index = it->h.entry == NULL ? 0 : it->h.slot_index + 1; \
+        for (; index < end; index++) { \
+            uint8_t control = index < capacity ? ht->h.control.data[index] : ht->h.old_control.data[index - capacity]; \
+            if (hashtable_control_full(control)) break; \
+        } \
+        it->h.slot_index = index; \
+        if (index >= end) return false; \
+        it->h.entry = (uint8_t *) (index < capacity \
+            ? hashtable_slot_ ## name(ht, index) \
+            : hashtable_old_slot_ ## name(ht, index - capacity)); \
+        return true; \
     } \
     inline static key_type * hashtable_iterate_key_ ## name(hashtable_iterator_ ## name *it) { \
-        return (key_type *) hashtable_iterate_key(&it->h); \
+        return &((hashtable_entry_ ## name *) it->h.entry)->key; \
     } \
     inline static value_type * hashtable_iterate_value_ ## name(hashtable_iterator_ ## name *it) { \
-        return (value_type *) hashtable_iterate_value(&it->h, sizeof(key_type)); \
+        return &((hashtable_entry_ ## name *) it->h.entry)->value; \
     }
 
 #endif
\ No newline at end of file
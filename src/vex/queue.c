@@ -0,0 +1,206 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "queue.h"
+
+static size_t queue_capacity(size_t capacity) {
+    // Rounds the capacity up to a power of two, at least two, or 0 if too large.
+    size_t rounded = 2;
+
+    while (rounded < capacity) {
+        if (rounded > SIZE_MAX / 2) return 0;
+
+        rounded *= 2;
+    }
+
+    return rounded;
+}
+
+bool queue_spsc_create(queue_spsc *q, size_t capacity, size_t element_size) {
+    return queue_spsc_create_in(q, &allocator_heap, capacity, element_size);
+}
+
+bool queue_spsc_create_in(queue_spsc *q, allocator *a, size_t capacity, size_t element_size) {
+    capacity = queue_capacity(capacity);
+
+    if (capacity == 0 || (element_size != 0 && capacity > SIZE_MAX / element_size)) return false;
+
+    q->data = allocator_allocate(a, capacity * element_size);
+
+    if (q->data == NULL) return false;
+
+    q->capacity = capacity;
+    q->element_size = element_size;
+    q->allocator = a;
+    q->tail = 0;
+    q->head_cached = 0;
+    q->head = 0;
+    q->tail_cached = 0;
+
+    return true;
+}
+
+void queue_spsc_destroy(queue_spsc *q) {
+    allocator_free(q->allocator, q->data, q->capacity * q->element_size);
+}
+
+size_t queue_spsc_push_batch(queue_spsc *q, const void *elements, size_t count) {
+    // Only this thread writes the tail, so it's read without synchronizing.
+    size_t tail = q->tail;
+
+    if (q->capacity - (tail - q->head_cached) < count) q->head_cached = sync_load(&q->head);
+
+    size_t space = q->capacity - (tail - q->head_cached);
+
+    if (count > space) count = space;
+
+    if (count == 0) return 0;
+
+    size_t offset = tail & (q->capacity - 1);
+    size_t first = q->capacity - offset;
+
+    if (first > count) first = count;
+
+    memcpy(q->data + offset * q->element_size, elements, first * q->element_size);
+    memcpy(q->data, (const uint8_t *) elements + first * q->element_size, (count - first) * q->element_size);
+    sync_store(&q->tail, tail + count);
+
+    return count;
+}
+
+size_t queue_spsc_pop_batch(queue_spsc *q, void *elements, size_t count) {
+    size_t head = q->head;
+
+    if (q->tail_cached - head < count) q->tail_cached = sync_load(&q->tail);
+
+    size_t available = q->tail_cached - head;
+
+    if (count > available) count = available;
+
+    if (count == 0) return 0;
+
+    size_t offset = head & (q->capacity - 1);
+    size_t first = q->capacity - offset;
+
+    if (first > count) first = count;
+
+    memcpy(elements, q->data + offset * q->element_size, first * q->element_size);
+    memcpy((uint8_t *) elements + first * q->element_size, q->data, (count - first) * q->element_size);
+    sync_store(&q->head, head + count);
+
+    return count;
+}
+
+bool queue_spsc_push(queue_spsc *q, const void *element) {
+    return queue_spsc_push_batch(q, element, 1) == 1;
+}
+
+bool queue_spsc_pop(queue_spsc *q, void *element) {
+    return queue_spsc_pop_batch(q, element, 1) == 1;
+}
+
+static inline uint8_t * queue_mpmc_cell(queue_mpmc *q, size_t position) {
+    return q->cells + (position & (q->capacity - 1)) * q->cell_size;
+}
+
+static inline size_t queue_mpmc_sequence(queue_mpmc *q, size_t position) {
+    return sync_load((volatile size_t *) queue_mpmc_cell(q, position));
+}
+
+bool queue_mpmc_create(queue_mpmc *q, size_t capacity, size_t element_size) {
+    return queue_mpmc_create_in(q, &allocator_heap, capacity, element_size);
+}
+
+bool queue_mpmc_create_in(queue_mpmc *q, allocator *a, size_t capacity, size_t element_size) {
+    capacity = queue_capacity(capacity);
+
+    // Elements are padded so every sequence stays aligned.
+    if (capacity == 0 || element_size > SIZE_MAX / 2) return false;
+
+    size_t cell_size = sizeof(size_t) + (element_size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+
+    if (capacity > SIZE_MAX / cell_size) return false;
+
+    q->cells = allocator_allocate(a, capacity * cell_size);
+
+    if (q->cells == NULL) return false;
+
+    q->capacity = capacity;
+    q->element_size = element_size;
+    q->cell_size = cell_size;
+    q->allocator = a;
+    q->tail = 0;
+    q->head = 0;
+
+    for (size_t i = 0; i < capacity; i++) *(size_t *) queue_mpmc_cell(q, i) = i;
+
+    return true;
+}
+
+void queue_mpmc_destroy(queue_mpmc *q) {
+    allocator_free(q->allocator, q->cells, q->capacity * q->cell_size);
+}
+
+size_t queue_mpmc_push_batch(queue_mpmc *q, const void *elements, size_t count) {
+    if (count == 0) return 0;
+
+    size_t position = sync_load(&q->tail);
+
+    for (;;) {
+        // A cell whose sequence is its position is free for it, and stays free
+        // until claimed, so the cells counted here can be claimed together.
+        size_t claimed = 0;
+
+        while (claimed < count && queue_mpmc_sequence(q, position + claimed) == position + claimed) claimed++;
+
+        if (claimed == 0) {
+            // The cell still holds the element of the previous lap when full.
+            if ((intptr_t) (queue_mpmc_sequence(q, position) - position) < 0) return 0;
+        } else if (sync_compare_exchange(&q->tail, position, position + claimed)) {
+            for (size_t i = 0; i < claimed; i++) {
+                uint8_t *cell = queue_mpmc_cell(q, position + i);
+                memcpy(cell + sizeof(size_t), (const uint8_t *) elements + i * q->element_size, q->element_size);
+                sync_store((volatile size_t *) cell, position + i + 1);
+            }
+
+            return claimed;
+        }
+
+        position = sync_load(&q->tail);
+    }
+}
+
+size_t queue_mpmc_pop_batch(queue_mpmc *q, void *elements, size_t count) {
+    if (count == 0) return 0;
+
+    size_t position = sync_load(&q->head);
+
+    for (;;) {
+        size_t claimed = 0;
+
+        while (claimed < count && queue_mpmc_sequence(q, position + claimed) == position + claimed + 1) claimed++;
+
+        if (claimed == 0) {
+            // The cell hasn't been pushed to in this lap when empty.
+            if ((intptr_t) (queue_mpmc_sequence(q, position) - (position + 1)) < 0) return 0;
+        } else if (sync_compare_exchange(&q->head, position, position + claimed)) {
+            for (size_t i = 0; i < claimed; i++) {
+                uint8_t *cell = queue_mpmc_cell(q, position + i);
+                memcpy((uint8_t *) elements + i * q->element_size, cell + sizeof(size_t), q->element_size);
+                sync_store((volatile size_t *) cell, position + i + q->capacity);
+            }
+
+            return claimed;
+        }
+
+        position = sync_load(&q->head);
+    }
+}
+
+bool queue_mpmc_push(queue_mpmc *q, const void *element) {
+    return queue_mpmc_push_batch(q, element, 1) == 1;
+}
+
+bool queue_mpmc_pop(queue_mpmc *q, void *element) {
+    return queue_mpmc_pop_batch(q, element, 1) == 1;
+}
@@ -0,0 +1,92 @@
+/* Bounded lock free queues for passing elements of one size between threads. */
+#ifndef QUEUE_H
+#define QUEUE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+#include "sync.h"
+
+// Queue with one thread pushing and one thread popping. The positions only
+// ever grow, and are masked by the power-of-two capacity to find the element.
+// Each side keeps the last position of the other side it read, so it only
+// reads the other's cache line again when the queue looks full or empty.
+typedef struct {
+    uint8_t *data;
+    size_t capacity;
+    size_t element_size;
+    allocator *allocator;
+    uint8_t padding_data[SYNC_CACHE_LINE];
+    // Written by the pushing thread.
+    volatile size_t tail;
+    size_t head_cached;
+    uint8_t padding_tail[SYNC_CACHE_LINE];
+    // Written by the popping thread.
+    volatile size_t head;
+    size_t tail_cached;
+    uint8_t padding_head[SYNC_CACHE_LINE];
+} queue_spsc;
+
+// Creates a queue holding at least the given number of elements of a size,
+// rounded to a power of two.
+bool queue_spsc_create(queue_spsc *, size_t, size_t);
+
+bool queue_spsc_create_in(queue_spsc *, allocator *, size_t, size_t);
+
+// Destroys the queue. No other thread may be using it.
+void queue_spsc_destroy(queue_spsc *);
+
+// Copies an element in, failing if the queue is full.
+bool queue_spsc_push(queue_spsc *, const void *);
+
+// Copies an element out, failing if the queue is empty.
+bool queue_spsc_pop(queue_spsc *, void *);
+
+// Copies in as many of the elements as fit, returning how many.
+size_t queue_spsc_push_batch(queue_spsc *, const void *, size_t);
+
+// Copies out up to the given number of elements, returning how many.
+size_t queue_spsc_pop_batch(queue_spsc *, void *, size_t);
+
+// Queue with any number of threads pushing and popping. Every cell has a
+// sequence number telling which position may use it next: a pusher claims a
+// position by moving the tail past it once the cell's sequence equals the
+// position, and publishes the element by setting the sequence one past it.
+// A popper waits for that, then sets the sequence a lap ahead to free the
+// cell for the pusher of the next lap.
+typedef struct {
+    uint8_t *cells;
+    size_t capacity;
+    size_t element_size;
+    // Bytes from one cell to the next, the sequence followed by the element.
+    size_t cell_size;
+    allocator *allocator;
+    uint8_t padding_cells[SYNC_CACHE_LINE];
+    volatile size_t tail;
+    uint8_t padding_tail[SYNC_CACHE_LINE];
+    volatile size_t head;
+    uint8_t padding_head[SYNC_CACHE_LINE];
+} queue_mpmc;
+
+// Creates a queue holding at least the given number of elements of a size,
+// rounded to a power of two.
+bool queue_mpmc_create(queue_mpmc *, size_t, size_t);
+
+bool queue_mpmc_create_in(queue_mpmc *, allocator *, size_t, size_t);
+
+// Destroys the queue. No other thread may be using it.
+void queue_mpmc_destroy(queue_mpmc *);
+
+bool queue_mpmc_push(queue_mpmc *, const void *);
+
+bool queue_mpmc_pop(queue_mpmc *, void *);
+
+// Claims up to the given number of free cells in one step and copies the
+// elements in, returning how many.
+size_t queue_mpmc_push_batch(queue_mpmc *, const void *, size_t);
+
+// Claims up to the given number of pushed cells in one step and copies the
+// elements out, returning how many.
+size_t queue_mpmc_pop_batch(queue_mpmc *, void *, size_t);
+
+#endif
@@ -0,0 +1,52 @@
+// Extends queue.h with a macro to create typed queues for additional safety.
+#ifndef QUEUE_TYPED_H
+#define QUEUE_TYPED_H
+#include "queue.h"
+
+#define QUEUE_REGISTER_TYPE(name, type) \
+    typedef struct { queue_spsc q; } queue_spsc_ ## name; \
+    typedef struct { queue_mpmc q; } queue_mpmc_ ## name; \
+    inline static bool queue_spsc_create_ ## name(queue_spsc_ ## name *qt, size_t capacity) { \
+        return queue_spsc_create(&qt->q, capacity, sizeof(type)); \
+    } \
+    inline static bool queue_spsc_create_in_ ## name(queue_spsc_ ## name *qt, allocator *a, size_t capacity) { \
+        return queue_spsc_create_in(&qt->q, a, capacity, sizeof(type)); \
+    } \
+    inline static void queue_spsc_destroy_ ## name(queue_spsc_ ## name *qt) { \
+        queue_spsc_destroy(&qt->q); \
+    } \
+    inline static bool queue_spsc_push_ ## name(queue_spsc_ ## name *qt, type value) { \
+        return queue_spsc_push(&qt->q, &value); \
+    } \
+    inline static bool queue_spsc_pop_ ## name(queue_spsc_ ## name *qt, type *value) { \
+        return queue_spsc_pop(&qt->q, value); \
+    } \
+    inline static size_t queue_spsc_push_batch_ ## name(queue_spsc_ ## name *qt, const type *values, size_t count) { \
+        return queue_spsc_push_batch(&qt->q, values, count); \
+    } \
+    inline static size_t queue_spsc_pop_batch_ ## name(queue_spsc_ ## name *qt, type *values, size_t count) { \
+        return queue_spsc_pop_batch(&qt->q, values, count); \
+    } \
+    inline static bool queue_mpmc_create_ ## name(queue_mpmc_ ## name *qt, size_t capacity) { \
+        return queue_mpmc_create(&qt->q, capacity, sizeof(type)); \
+    } \
+    inline static bool queue_mpmc_create_in_ ## name(queue_mpmc_ ## name *qt, allocator *a, size_t capacity) { \
+        return queue_mpmc_create_in(&qt->q, a, capacity, sizeof(type)); \
+    } \
+    inline static void queue_mpmc_destroy_ ## name(queue_mpmc_ ## name *qt) { \
+        queue_mpmc_destroy(&qt->q); \
+    } \
+    inline static bool queue_mpmc_push_ ## name(queue_mpmc_ ## name *qt, type value) { \
+        return queue_mpmc_push(&qt->q, &value); \
+    } \
+    inline static bool queue_mpmc_pop_ ## name(queue_mpmc_ ## name *qt, type *value) { \
+        return queue_mpmc_pop(&qt->q, value); \
+    } \
+    inline static size_t queue_mpmc_push_batch_ ## name(queue_mpmc_ ## name *qt, const type *values, size_t count) { \
+        return queue_mpmc_push_batch(&qt->q, values, count); \
+    } \
+    inline static size_t queue_mpmc_pop_batch_ ## name(queue_mpmc_ ## name *qt, type *values, size_t count) { \
+        return queue_mpmc_pop_batch(&qt->q, values, count); \
+    }
+
+#endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <assert.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <limits.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "debug.h"
+#include "snapshot.h"
+
+static const uint8_t snapshot_magic[8] = { 'V', 'E', 'X', 'S', 'N', 'A', 'P', 0 };
+
+// Reads back as a different value when the byte order differs.
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+void snapshot_header_create(snapshot_header *header, uint32_t kind) {
+    memset(header, 0, sizeof(snapshot_header));
+    memcpy(header->magic, snapshot_magic, sizeof(snapshot_magic));
+    header->version = SNAPSHOT_VERSION;
+    header->kind = kind;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+}
+
+bool snapshot_write_data(int fd, const void *data, size_t size) {
+    // Write everything, continuing after partial writes.
+    const uint8_t *bytes = data;
+
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, bytes, size > INT_MAX ? INT_MAX : (unsigned int) size);
+#else
+        ssize_t written = write(fd, bytes, size);
+#endif
+
+        if (written <= 0) return false;
+
+        bytes += written;
+        size -= (size_t) written;
+    }
+
+    return true;
+}
+
+bool snapshot_write_header(int fd, snapshot_header *header) {
+    assert(sizeof(snapshot_header) <= SNAPSHOT_ALIGNMENT);
+
+    return snapshot_write_section(fd, header, sizeof(snapshot_header));
+}
+
+bool snapshot_write_section(int fd, void *data, size_t size) {
+    return snapshot_write_data(fd, data, size) && snapshot_write_padding(fd, size);
+}
+
+bool snapshot_write_padding(int fd, size_t size) {
+    static const uint8_t padding[SNAPSHOT_ALIGNMENT] = { 0 };
+
+    return snapshot_write_data(fd, padding, (SNAPSHOT_ALIGNMENT - size % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT);
+}
+
+static bool snapshot_map(snapshot *s, const char *path) {
+#ifdef _WIN32
+    s->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (s->file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(s->file, &size) || size.QuadPart < (LONGLONG) sizeof(snapshot_header)) {
+        CloseHandle(s->file);
+        return false;
+    }
+
+    s->mapping = CreateFileMappingA(s->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (s->mapping == NULL) {
+        CloseHandle(s->file);
+        return false;
+    }
+
+    s->data = MapViewOfFile(s->mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (s->data == NULL) {
+        CloseHandle(s->mapping);
+        CloseHandle(s->file);
+        return false;
+    }
+
+    s->size = (size_t) size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header)) {
+        close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the file is closed.
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return false;
+
+    s->data = data;
+    s->size = (size_t) st.st_size;
+#endif
+
+    return true;
+}
+
+bool snapshot_open(snapshot *s, const char *path, uint32_t kind) {
+    if (!snapshot_map(s, path)) return false;
+
+    snapshot_header *header = snapshot_get_header(s);
+
+    if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+        || header->byte_order != SNAPSHOT_BYTE_ORDER
+        || header->version != SNAPSHOT_VERSION
+        || header->kind != kind) {
+        debug("Unexpected snapshot header in %s", path);
+        snapshot_close(s);
+        return false;
+    }
+
+    s->offset = SNAPSHOT_ALIGNMENT;
+
+    return true;
+}
+
+snapshot_header * snapshot_get_header(snapshot *s) {
+    return (snapshot_header *) s->data;
+}
+
+void * snapshot_read_section(snapshot *s, size_t size) {
+    if (s->offset > s->size || size > s->size - s->offset) return NULL;
+
+    void *section = s->data + s->offset;
+    s->offset += size + (SNAPSHOT_ALIGNMENT - size % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT;
+
+    return section;
+}
+
+void snapshot_close(snapshot *s) {
+#ifdef _WIN32
+    UnmapViewOfFile(s->data);
+    CloseHandle(s->mapping);
+    CloseHandle(s->file);
+#else
+    munmap(s->data, s->size);
+#endif
+}
@@ -0,0 +1,69 @@
+/* Binary snapshots of datastructures, opened by mapping the file into memory. */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Incremented whenever the layout of a snapshot, or the data it's made of,
+// changes. Snapshots of other versions are refused.
+#define SNAPSHOT_VERSION 1
+
+// Header and sections start at multiples of this, so data in the mapped file
+// is aligned like the data it was written from.
+#define SNAPSHOT_ALIGNMENT 64
+
+#define SNAPSHOT_SPARSEARRAY 1
+#define SNAPSHOT_HASHTABLE 2
+
+// Written at the start of the file, in the byte order of the writer, followed
+// by the sections of data. The meaning of `parameter` and `fields` depends on
+// the kind of datastructure.
+typedef struct {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t byte_order;
+    uint32_t parameter;
+    uint64_t fields[5];
+} snapshot_header;
+
+// A snapshot file mapped read only into memory.
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    // Next section to read.
+    size_t offset;
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#endif
+} snapshot;
+
+// Fills in the magic, version, byte order and kind of a header.
+void snapshot_header_create(snapshot_header *, uint32_t);
+
+bool snapshot_write_header(int, snapshot_header *);
+
+// Writes a section of data, padded to the alignment.
+bool snapshot_write_section(int, void *, size_t);
+
+// Writes part of a section written in parts, which must be followed by the
+// padding for the size of the whole section.
+bool snapshot_write_data(int, const void *, size_t);
+
+bool snapshot_write_padding(int, size_t);
+
+// Maps a snapshot file, checking the header is one of the given kind written
+// by this version on a machine with the same byte order.
+bool snapshot_open(snapshot *, const char *, uint32_t);
+
+snapshot_header * snapshot_get_header(snapshot *);
+
+// Returns the next section of the given size, or NULL if the file is too short.
+void * snapshot_read_section(snapshot *, size_t);
+
+// Unmaps the file. Datastructures opened from it can no longer be used.
+void snapshot_close(snapshot *);
+
+#endif
@@ -3,10 +3,23 @@
 #include "debug.h"
 #include "sparsearray.h"
 
+static void sparsearray_drop_packed(sparsearray *);
+static void sparsearray_drop_dense(sparsearray *);
+static bool sparsearray_make_flat(sparsearray *);
+
 bool sparsearray_create(sparsearray *s, size_t key_capacity, size_t value_capacity) {
-    if (!buffer_create(&s->keys, key_capacity)) return false;
+    return sparsearray_create_in(s, &allocator_heap, key_capacity, value_capacity);
+}
+
+bool sparsearray_create_in(sparsearray *s, allocator *a, size_t key_capacity, size_t value_capacity) {
+    s->tree = NULL;
+    s->index = NULL;
+    s->packed = NULL;
+    s->dense = NULL;
 
-    if (!buffer_create(&s->values, value_capacity)) {
+    if (!buffer_create_in(&s->keys, a, key_capacity)) return false;
+
+    if (!buffer_create_in(&s->values, a, value_capacity)) {
         buffer_destroy(&s->keys);
         return false;
     }
@@ -14,56 +27,337 @@ bool sparsearray_create(sparsearray *s, size_t key_capacity, size_t value_capaci
     return true;
 }
 
+bool sparsearray_create_tree(sparsearray *s, size_t value_size) {
+    return sparsearray_create_tree_in(s, &allocator_heap, value_size);
+}
+
+bool sparsearray_create_tree_in(sparsearray *s, allocator *a, size_t value_size) {
+    s->index = NULL;
+    s->packed = NULL;
+    s->dense = NULL;
+    s->tree = allocator_allocate(a, sizeof(sparsearray_tree));
+
+    if (s->tree == NULL) return false;
+
+    if (!sparsearray_tree_create(s->tree, a, value_size)) {
+        allocator_free(a, s->tree, sizeof(sparsearray_tree));
+        return false;
+    }
+
+    return true;
+}
+
+static inline allocator * sparsearray_allocator(sparsearray *s) {
+    return s->tree != NULL ? s->tree->allocator : s->values.allocator;
+}
+
 void sparsearray_destroy(sparsearray *s) {
+    if (s->tree != NULL) {
+        allocator *a = s->tree->allocator;
+        sparsearray_tree_destroy(s->tree);
+        allocator_free(a, s->tree, sizeof(sparsearray_tree));
+        return;
+    }
+
+    sparsearray_drop_index(s);
+    sparsearray_drop_packed(s);
+    sparsearray_drop_dense(s);
     buffer_destroy(&s->keys);
     buffer_destroy(&s->values);
 }
 
 void sparsearray_clear(sparsearray *s) {
+    if (s->tree != NULL) {
+        sparsearray_tree_clear(s->tree);
+        return;
+    }
+
+    sparsearray_drop_index(s);
+    sparsearray_drop_packed(s);
+    sparsearray_drop_dense(s);
     buffer_clear(&s->keys);
     buffer_clear(&s->values);
 }
 
 bool sparsearray_trim(sparsearray *s) {
+    // Nodes of a tree are always allocated in full.
+    if (s->tree != NULL) return true;
+
+    // Keys are left empty while packed or dense.
+    if (s->packed != NULL || s->dense != NULL) return buffer_trim(&s->values);
+
     return buffer_trim(&s->keys) && buffer_trim(&s->values);
 }
 
 size_t sparsearray_count(sparsearray *s) {
+    if (s->tree != NULL) return sparsearray_tree_count(s->tree);
+
+    if (s->packed != NULL) return s->packed->count;
+
+    if (s->dense != NULL) return s->dense->count;
+
     return buffer_size(&s->keys) / sizeof(uint64_t);
 }
 
 size_t sparsearray_key_search(sparsearray *s, uint64_t key) {
-    // Binary search for closest key index.
-    size_t left = 0;
-    size_t right = sparsearray_count(s);
-
-    while (left < right) {
-        size_t index = (left + right) / 2;
-        uint64_t *skey = buffer_get(&s->keys, index * sizeof(uint64_t));
-
-        if (key < *skey) {
-            right = index;
-        } else if (key > *skey) {
-            left = index + 1;
-        } else {
-            left = index;
-            break;
-        }
+    // Index of the key, or where it would be inserted.
+    size_t count = sparsearray_count(s);
+    uint64_t *keys = (uint64_t *) s->keys.data;
+
+    if (s->index != NULL) return sparsearray_index_search(s->index, count, keys, key);
+
+    if (s->packed != NULL) return sparsearray_packed_search(s->packed, key);
+
+    if (s->dense != NULL) {
+        sparsearray_dense *d = s->dense;
+
+        if (key <= d->base) return 0;
+
+        if (key - d->base >= d->slots) return d->count;
+
+        return sparsearray_dense_rank(d, (size_t) (key - d->base));
+    }
+
+    if (count == 0) return 0;
+
+    // Binary search halving the range without branching on the keys, so
+    // there are no mispredictions to wait for.
+    uint64_t *base = keys;
+
+    while (count > 1) {
+        size_t half = count / 2;
+        base = base[half] < key ? base + half : base;
+        count -= half;
+    }
+
+    return (size_t) (base - keys) + (*base < key);
+}
+
+bool sparsearray_build_index(sparsearray *s) {
+    // Packed keys are searched by block already, and dense ones aren't
+    // searched.
+    if (s->tree != NULL || s->packed != NULL || s->dense != NULL) return true;
+
+    sparsearray_index *index = malloc(sizeof(sparsearray_index));
+
+    if (index == NULL) return false;
+
+    if (!sparsearray_index_create(index, sparsearray_count(s), (uint64_t *) s->keys.data)) {
+        free(index);
+        return false;
+    }
+
+    sparsearray_drop_index(s);
+    s->index = index;
+
+    return true;
+}
+
+void sparsearray_drop_index(sparsearray *s) {
+    if (s->index == NULL) return;
+
+    sparsearray_index_destroy(s->index);
+    free(s->index);
+    s->index = NULL;
+}
+
+bool sparsearray_pack(sparsearray *s) {
+    if (s->tree != NULL || s->packed != NULL || s->dense != NULL) return true;
+
+    sparsearray_packed *packed = malloc(sizeof(sparsearray_packed));
+    buffer keys;
+
+    if (packed == NULL) return false;
+
+    if (!sparsearray_packed_create(packed, sparsearray_count(s), (uint64_t *) s->keys.data)) {
+        free(packed);
+        return false;
+    }
+
+    // Keep an empty buffer of keys to unpack into later.
+    if (!buffer_create_in(&keys, s->keys.allocator, 2 * sizeof(uint64_t))) {
+        sparsearray_packed_destroy(packed);
+        free(packed);
+        return false;
+    }
+
+    sparsearray_drop_index(s);
+    buffer_destroy(&s->keys);
+    buffer_move(&s->keys, &keys);
+    s->packed = packed;
+
+    return true;
+}
+
+bool sparsearray_unpack(sparsearray *s) {
+    if (s->packed == NULL) return true;
+
+    sparsearray_packed *p = s->packed;
+    uint64_t *keys = buffer_push(&s->keys, p->count * sizeof(uint64_t));
+
+    if (keys == NULL) return false;
+
+    for (size_t b = 0; b < p->blocks; b++) keys += sparsearray_packed_unpack(p, b, keys);
+
+    sparsearray_drop_packed(s);
+
+    return true;
+}
+
+static void sparsearray_drop_packed(sparsearray *s) {
+    if (s->packed == NULL) return;
+
+    sparsearray_packed_destroy(s->packed);
+    free(s->packed);
+    s->packed = NULL;
+}
+
+static void sparsearray_drop_dense(sparsearray *s) {
+    if (s->dense == NULL) return;
+
+    sparsearray_dense_destroy(s->dense);
+    free(s->dense);
+    s->dense = NULL;
+}
+
+static inline uint8_t * sparsearray_dense_value(sparsearray *s, size_t slot) {
+    return s->values.data + slot * s->dense->value_size;
+}
+
+static inline bool sparsearray_dense_contains(sparsearray_dense *d, uint64_t key) {
+    return key >= d->base && key - d->base < d->slots && sparsearray_dense_has(d, (size_t) (key - d->base));
+}
+
+static bool sparsearray_make_dense(sparsearray *s, size_t value_size) {
+    // Moves the values of a flat sparse array into a slot for every key from
+    // its first to its last.
+    size_t count = sparsearray_count(s);
+    uint64_t *keys = (uint64_t *) s->keys.data;
+    size_t slots = (size_t) (keys[count - 1] - keys[0]) + 1;
+    size_t values_size = slots * value_size;
+    sparsearray_dense *dense = malloc(sizeof(sparsearray_dense));
+    buffer values;
+    buffer empty;
+
+    if (dense == NULL) return false;
+
+    if (!sparsearray_dense_create(dense, keys[0], slots, value_size)) {
+        free(dense);
+        return false;
+    }
+
+    // Buffers need a capacity above one to grow.
+    if (!buffer_create_in(&values, s->values.allocator, values_size > 2 ? values_size : 2)) {
+        sparsearray_dense_destroy(dense);
+        free(dense);
+        return false;
+    }
+
+    if (!buffer_create_in(&empty, s->keys.allocator, 2 * sizeof(uint64_t))) {
+        buffer_destroy(&values);
+        sparsearray_dense_destroy(dense);
+        free(dense);
+        return false;
+    }
+
+    uint8_t *data = buffer_push(&values, values_size);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = (size_t) (keys[i] - keys[0]);
+        sparsearray_dense_set(dense, slot);
+        memcpy(data + slot * value_size, s->values.data + i * value_size, value_size);
+    }
+
+    sparsearray_drop_index(s);
+    buffer_destroy(&s->keys);
+    buffer_destroy(&s->values);
+    buffer_move(&s->keys, &empty);
+    buffer_move(&s->values, &values);
+    s->dense = dense;
+
+    return true;
+}
+
+static bool sparsearray_check_dense(sparsearray *s, size_t value_size) {
+    // Switches a flat sparse array with keys for at least half the slots from
+    // its first key to its last to dense. Returns whether it switched.
+    size_t count = sparsearray_count(s);
+
+    if (count < SPARSEARRAY_DENSE_MIN_COUNT || s->packed != NULL) return false;
+
+    uint64_t *keys = (uint64_t *) s->keys.data;
+
+    if (keys[count - 1] - keys[0] >= (uint64_t) count * 2) return false;
+
+    return sparsearray_make_dense(s, value_size);
+}
+
+static bool sparsearray_dense_grow(sparsearray *s, uint64_t key) {
+    // Adds slots from the old ones to the key, and half again as many past
+    // it for more keys, unless that leaves too few keys for the slots.
+    sparsearray_dense *d = s->dense;
+    uint64_t limit = (uint64_t) (d->count + 1) * SPARSEARRAY_DENSE_MAX_SLOTS_PER_KEY;
+    uint64_t distance = key < d->base ? d->base - key : key - d->base;
+
+    if (distance >= limit) return false;
+
+    size_t needed = (size_t) (key < d->base ? distance + d->slots : distance + 1);
+
+    if (needed > limit) return false;
+
+    size_t extra = d->slots / 2;
+
+    if (extra > limit - needed) extra = (size_t) (limit - needed);
+
+    if (key < d->base && extra > key) extra = (size_t) key;
+
+    uint64_t base = key < d->base ? key - extra : d->base;
+    size_t slots = needed + extra;
+    size_t values_size = slots * d->value_size;
+    buffer values;
+
+    if (!buffer_create_in(&values, s->values.allocator, values_size > 2 ? values_size : 2)) return false;
+
+    uint8_t *data = buffer_push(&values, values_size);
+    memcpy(data + (size_t) (d->base - base) * d->value_size, s->values.data, d->slots * d->value_size);
+
+    if (!sparsearray_dense_rebase(d, base, slots)) {
+        buffer_destroy(&values);
+        return false;
     }
 
-    return left;
+    buffer_destroy(&s->values);
+    buffer_move(&s->values, &values);
+
+    return true;
 }
 
 uint64_t sparsearray_key(sparsearray *s, size_t index) {
+    if (s->tree != NULL) return sparsearray_tree_key(s->tree, index);
+
+    if (s->packed != NULL) return sparsearray_packed_key(s->packed, index);
+
+    if (s->dense != NULL) return s->dense->base + sparsearray_dense_select(s->dense, index);
+
     uint64_t *key = buffer_get(&s->keys, index * sizeof(uint64_t));
     return *key;
 }
 
 void * sparsearray_value(sparsearray *s, size_t index, size_t value_size) {
+    if (s->tree != NULL) {
+        assert(s->tree->value_size == value_size);
+        return sparsearray_tree_value(s->tree, index);
+    }
+
+    if (s->dense != NULL) {
+        assert(s->dense->value_size == value_size);
+        return sparsearray_dense_value(s, sparsearray_dense_select(s->dense, index));
+    }
+
     return buffer_get(&s->values, index * value_size);
 }
 
-void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
+static void * sparsearray_put_flat(sparsearray *s, uint64_t key, size_t value_size) {
     size_t keys_size = buffer_size(&s->keys);
 
     if (keys_size > 0) {
@@ -77,6 +371,7 @@ void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
                 return buffer_get(&s->values, index * value_size);
             } else {
                 // Insert key at offset.
+                sparsearray_drop_index(s);
                 uint64_t *new_key = buffer_add(&s->keys, offset, sizeof(uint64_t));
 
                 if (new_key == NULL) return NULL;
@@ -87,6 +382,7 @@ void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
             }
         } else {
             // Key is past end. Add the new key at end.
+            sparsearray_drop_index(s);
             uint64_t *new_key = buffer_push(&s->keys, sizeof(uint64_t));
 
             if (new_key == NULL) return NULL;
@@ -97,6 +393,7 @@ void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
         }
     } else {
         // Sparse array is empty. Add the new key.
+        sparsearray_drop_index(s);
         uint64_t *new_key = buffer_push(&s->keys, sizeof(uint64_t));
 
         if (new_key == NULL) return NULL;
@@ -107,7 +404,67 @@ void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
     }
 }
 
+void * sparsearray_put(sparsearray *s, uint64_t key, size_t value_size) {
+    if (s->tree != NULL) {
+        assert(s->tree->value_size == value_size);
+        return sparsearray_tree_put(s->tree, key);
+    }
+
+    if (s->packed != NULL) {
+        // Only new keys unpack the keys.
+        void *value = sparsearray_get(s, key, value_size);
+
+        if (value != NULL) return value;
+
+        if (!sparsearray_unpack(s)) return NULL;
+    }
+
+    if (s->dense != NULL) {
+        // Keys too far from the others make the sparse array flat again.
+        sparsearray_dense *d = s->dense;
+        assert(d->value_size == value_size);
+
+        if ((key >= d->base && key - d->base < d->slots) || sparsearray_dense_grow(s, key)) {
+            size_t slot = (size_t) (key - d->base);
+
+            if (!sparsearray_dense_has(d, slot)) sparsearray_dense_set(d, slot);
+
+            return sparsearray_dense_value(s, slot);
+        }
+
+        if (!sparsearray_make_flat(s)) return NULL;
+    }
+
+    void *value = sparsearray_put_flat(s, key, value_size);
+
+    // New keys can make the keys close enough to switch.
+    if (value != NULL && sparsearray_check_dense(s, value_size)) return sparsearray_get(s, key, value_size);
+
+    return value;
+}
+
 bool sparsearray_remove(sparsearray *s, uint64_t key, size_t value_size) {
+    if (s->tree != NULL) {
+        assert(s->tree->value_size == value_size);
+        return sparsearray_tree_remove(s->tree, key);
+    }
+
+    if (s->packed != NULL && (sparsearray_get(s, key, value_size) == NULL || !sparsearray_unpack(s))) return false;
+
+    if (s->dense != NULL) {
+        sparsearray_dense *d = s->dense;
+        assert(d->value_size == value_size);
+
+        if (!sparsearray_dense_contains(d, key)) return false;
+
+        sparsearray_dense_clear(d, (size_t) (key - d->base));
+
+        // Staying dense when making the sparse array flat fails is fine.
+        if (d->count * SPARSEARRAY_DENSE_MAX_SLOTS_PER_KEY < d->slots) sparsearray_make_flat(s);
+
+        return true;
+    }
+
     size_t index = sparsearray_key_search(s, key);
     size_t offset = index * sizeof(uint64_t);
 
@@ -117,11 +474,34 @@ bool sparsearray_remove(sparsearray *s, uint64_t key, size_t value_size) {
 
     if (*skey != key) return false;
 
+    sparsearray_drop_index(s);
+
     return buffer_remove(&s->keys, offset, sizeof(uint64_t))
         && buffer_remove(&s->values, index * value_size, value_size);
 }
 
 void * sparsearray_get(sparsearray *s, uint64_t key, size_t value_size) {
+    if (s->tree != NULL) {
+        assert(s->tree->value_size == value_size);
+        return sparsearray_tree_get(s->tree, key);
+    }
+
+    if (s->packed != NULL) {
+        size_t index = sparsearray_packed_search(s->packed, key);
+
+        if (index >= s->packed->count || sparsearray_packed_key(s->packed, index) != key) return NULL;
+
+        return buffer_get(&s->values, index * value_size);
+    }
+
+    if (s->dense != NULL) {
+        assert(s->dense->value_size == value_size);
+
+        if (!sparsearray_dense_contains(s->dense, key)) return NULL;
+
+        return sparsearray_dense_value(s, (size_t) (key - s->dense->base));
+    }
+
     size_t index = sparsearray_key_search(s, key);
     size_t offset = index * sizeof(uint64_t);
 
@@ -133,3 +513,509 @@ void * sparsearray_get(sparsearray *s, uint64_t key, size_t value_size) {
 
     return buffer_get(&s->values, index * value_size);
 }
+
+size_t sparsearray_lower_bound(sparsearray *s, uint64_t key) {
+    if (s->tree != NULL) {
+        sparsearray_tree_leaf *leaf;
+        size_t offset;
+
+        return sparsearray_tree_lower_bound(s->tree, key, &leaf, &offset);
+    }
+
+    return sparsearray_key_search(s, key);
+}
+
+size_t sparsearray_upper_bound(sparsearray *s, uint64_t key) {
+    if (key == UINT64_MAX) return sparsearray_count(s);
+
+    return sparsearray_lower_bound(s, key + 1);
+}
+
+sparsearray_range_iterator sparsearray_iterate_range(sparsearray *s, uint64_t start, uint64_t end) {
+    sparsearray_range_iterator it;
+    it.array = s;
+    it.end = sparsearray_lower_bound(s, end);
+    it.leaf = NULL;
+    it.offset = 0;
+    it.started = false;
+
+    if (s->tree == NULL) {
+        it.index = sparsearray_key_search(s, start);
+        return it;
+    }
+
+    it.index = sparsearray_tree_lower_bound(s->tree, start, &it.leaf, &it.offset);
+
+    // The first key can be at the start of the next leaf.
+    if (it.offset == it.leaf->node.size) {
+        it.leaf = sparsearray_tree_next(s->tree, it.leaf);
+        it.offset = 0;
+    }
+
+    return it;
+}
+
+bool sparsearray_iterate_range_next(sparsearray_range_iterator *it) {
+    if (it->started) {
+        it->index++;
+
+        if (it->leaf != NULL && ++it->offset == it->leaf->node.size) {
+            it->leaf = sparsearray_tree_next(it->array->tree, it->leaf);
+            it->offset = 0;
+        }
+    }
+
+    it->started = true;
+
+    return it->index < it->end;
+}
+
+uint64_t sparsearray_iterate_range_key(sparsearray_range_iterator *it) {
+    assert(it->started && it->index < it->end);
+
+    if (it->leaf != NULL) return it->leaf->keys[it->offset];
+
+    if (it->array->packed != NULL || it->array->dense != NULL) return sparsearray_key(it->array, it->index);
+
+    return ((uint64_t *) it->array->keys.data)[it->index];
+}
+
+void * sparsearray_iterate_range_value(sparsearray_range_iterator *it, size_t value_size) {
+    assert(it->started && it->index < it->end);
+
+    if (it->leaf != NULL) {
+        assert(it->array->tree->value_size == value_size);
+        return it->leaf->values + it->offset * value_size;
+    }
+
+    if (it->array->dense != NULL) return sparsearray_value(it->array, it->index, value_size);
+
+    return it->array->values.data + it->index * value_size;
+}
+
+bool sparsearray_remove_range(sparsearray *s, uint64_t start, uint64_t end, size_t value_size) {
+    if (start >= end) return true;
+
+    if (s->tree != NULL) {
+        // Removing from a tree only moves keys within a leaf, so the keys are
+        // removed one at a time, each found from the root.
+        assert(s->tree->value_size == value_size);
+        sparsearray_tree_leaf *leaf;
+        size_t offset;
+
+        while (true) {
+            size_t index = sparsearray_tree_lower_bound(s->tree, start, &leaf, &offset);
+
+            if (index == s->tree->count) return true;
+
+            if (offset == leaf->node.size) {
+                leaf = sparsearray_tree_next(s->tree, leaf);
+                offset = 0;
+            }
+
+            uint64_t key = leaf->keys[offset];
+
+            if (key >= end) return true;
+
+            sparsearray_tree_remove(s->tree, key);
+        }
+    }
+
+    size_t first = sparsearray_key_search(s, start);
+    size_t last = sparsearray_key_search(s, end);
+
+    if (first == last) return true;
+
+    if (s->dense != NULL) {
+        // Clear the slots of the keys in the range.
+        sparsearray_dense *d = s->dense;
+        assert(d->value_size == value_size);
+        size_t end_slot = last < d->count ? sparsearray_dense_select(d, last) : d->slots;
+
+        for (size_t slot = sparsearray_dense_select(d, first); slot < end_slot; slot = sparsearray_dense_next(d, slot + 1)) {
+            sparsearray_dense_clear(d, slot);
+        }
+
+        if (d->count * SPARSEARRAY_DENSE_MAX_SLOTS_PER_KEY < d->slots) sparsearray_make_flat(s);
+
+        return true;
+    }
+
+    if (!sparsearray_unpack(s)) return false;
+
+    sparsearray_drop_index(s);
+
+    return buffer_remove(&s->keys, first * sizeof(uint64_t), (last - first) * sizeof(uint64_t))
+        && buffer_remove(&s->values, first * value_size, (last - first) * value_size);
+}
+
+typedef struct {
+    uint64_t key;
+    size_t index;
+} sparsearray_sort_entry;
+
+static bool sparsearray_radix_sort(size_t count, uint64_t *keys, size_t *order) {
+    // Sets order to the indexes of the keys in sorted order, with equal keys
+    // kept in the order given. Sorts by one byte at a time from the lowest,
+    // skipping bytes that are the same in every key.
+    size_t histograms[8][256] = { { 0 } };
+    sparsearray_sort_entry *entries = malloc(count * sizeof(sparsearray_sort_entry));
+    sparsearray_sort_entry *sorted = malloc(count * sizeof(sparsearray_sort_entry));
+
+    if (entries == NULL || sorted == NULL) {
+        free(entries);
+        free(sorted);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i].key = keys[i];
+        entries[i].index = i;
+
+        for (size_t b = 0; b < 8; b++) histograms[b][(keys[i] >> (b * 8)) & 0xFF]++;
+    }
+
+    for (size_t b = 0; b < 8; b++) {
+        size_t *histogram = histograms[b];
+
+        if (histogram[(keys[0] >> (b * 8)) & 0xFF] == count) continue;
+
+        // Turn the counts into the offsets each byte value starts at.
+        for (size_t v = 0, offset = 0; v < 256; v++) {
+            size_t c = histogram[v];
+            histogram[v] = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < count; i++) sorted[histogram[(entries[i].key >> (b * 8)) & 0xFF]++] = entries[i];
+
+        sparsearray_sort_entry *swap = entries;
+        entries = sorted;
+        sorted = swap;
+    }
+
+    for (size_t i = 0; i < count; i++) order[i] = entries[i].index;
+
+    free(entries);
+    free(sorted);
+
+    return true;
+}
+
+static bool sparsearray_flatten(sparsearray *s, sparsearray *flat) {
+    // Copies the keys and values of a tree, packed or dense sparse array into
+    // a flat sparse array.
+    if (s->dense != NULL) {
+        sparsearray_dense *d = s->dense;
+
+        if (!sparsearray_create_in(flat, sparsearray_allocator(s), d->count * sizeof(uint64_t), d->count * d->value_size)) return false;
+
+        for (size_t slot = sparsearray_dense_next(d, 0); slot < d->slots; slot = sparsearray_dense_next(d, slot + 1)) {
+            *(uint64_t *) buffer_push(&flat->keys, sizeof(uint64_t)) = d->base + slot;
+            memcpy(buffer_push(&flat->values, d->value_size), sparsearray_dense_value(s, slot), d->value_size);
+        }
+
+        return true;
+    }
+
+    if (s->packed != NULL) {
+        sparsearray_packed *p = s->packed;
+
+        if (!sparsearray_create_in(flat, sparsearray_allocator(s), p->count * sizeof(uint64_t), buffer_size(&s->values))) return false;
+
+        uint64_t *keys = buffer_push(&flat->keys, p->count * sizeof(uint64_t));
+
+        for (size_t b = 0; b < p->blocks; b++) keys += sparsearray_packed_unpack(p, b, keys);
+
+        memcpy(buffer_push(&flat->values, buffer_size(&s->values)), s->values.data, buffer_size(&s->values));
+
+        return true;
+    }
+
+    sparsearray_tree *t = s->tree;
+
+    if (!sparsearray_create_in(flat, sparsearray_allocator(s), t->count * sizeof(uint64_t), t->count * t->value_size)) return false;
+
+    for (sparsearray_tree_leaf *l = sparsearray_tree_first(t); l != NULL; l = sparsearray_tree_next(t, l)) {
+        memcpy(buffer_push(&flat->keys, l->node.size * sizeof(uint64_t)), l->keys, l->node.size * sizeof(uint64_t));
+        memcpy(buffer_push(&flat->values, l->node.size * t->value_size), l->values, l->node.size * t->value_size);
+    }
+
+    return true;
+}
+
+bool sparsearray_snapshot(sparsearray *s, sparsearray *snapshot) {
+    snapshot->index = NULL;
+    snapshot->packed = NULL;
+    snapshot->dense = NULL;
+
+    if (s->tree != NULL) {
+        snapshot->tree = allocator_allocate(s->tree->allocator, sizeof(sparsearray_tree));
+
+        if (snapshot->tree == NULL) return false;
+
+        sparsearray_tree_share(s->tree, snapshot->tree);
+
+        return true;
+    }
+
+    if (s->packed != NULL || s->dense != NULL) return sparsearray_flatten(s, snapshot);
+
+    if (!sparsearray_create_in(snapshot, sparsearray_allocator(s), buffer_size(&s->keys), buffer_size(&s->values))) return false;
+
+    memcpy(buffer_push(&snapshot->keys, buffer_size(&s->keys)), s->keys.data, buffer_size(&s->keys));
+    memcpy(buffer_push(&snapshot->values, buffer_size(&s->values)), s->values.data, buffer_size(&s->values));
+
+    return true;
+}
+
+static bool sparsearray_make_flat(sparsearray *s) {
+    // Gathers the values of a dense sparse array back into key order.
+    sparsearray flat;
+
+    if (!sparsearray_flatten(s, &flat)) return false;
+
+    sparsearray_drop_dense(s);
+    buffer_destroy(&s->keys);
+    buffer_destroy(&s->values);
+    buffer_move(&s->keys, &flat.keys);
+    buffer_move(&s->values, &flat.values);
+
+    return true;
+}
+
+static bool sparsearray_merge_flat(sparsearray *s,
+    size_t count,
+    uint64_t *keys,
+    uint8_t *values,
+    size_t *order,
+    size_t value_size,
+    int duplicates) {
+    // Merges the keys in the order given, or in sequence without one, with
+    // the sorted keys of a flat sparse array into new buffers.
+    size_t existing = sparsearray_count(s);
+    uint64_t *existing_keys = (uint64_t *) s->keys.data;
+    sparsearray merged;
+
+    if (!sparsearray_create_in(&merged, sparsearray_allocator(s), (existing + count) * sizeof(uint64_t), (existing + count) * value_size)) return false;
+
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < existing || j < count) {
+        uint64_t key = j < count ? keys[order == NULL ? j : order[j]] : 0;
+        uint8_t *value;
+
+        if (j == count || (i < existing && existing_keys[i] < key)) {
+            key = existing_keys[i];
+            value = s->values.data + i++ * value_size;
+        } else {
+            // Go past every key put more than once, keeping the first or last.
+            size_t first = j;
+
+            while (j < count && keys[order == NULL ? j : order[j]] == key) j++;
+
+            size_t kept = duplicates == SPARSEARRAY_KEEP_FIRST ? first : j - 1;
+            value = values + (order == NULL ? kept : order[kept]) * value_size;
+
+            if (i < existing && existing_keys[i] == key) {
+                if (duplicates == SPARSEARRAY_KEEP_FIRST) value = s->values.data + i * value_size;
+
+                i++;
+            }
+        }
+
+        *(uint64_t *) buffer_push(&merged.keys, sizeof(uint64_t)) = key;
+        memcpy(buffer_push(&merged.values, value_size), value, value_size);
+    }
+
+    sparsearray_drop_index(s);
+    buffer_destroy(&s->keys);
+    buffer_destroy(&s->values);
+    buffer_move(&s->keys, &merged.keys);
+    buffer_move(&s->values, &merged.values);
+
+    return true;
+}
+
+static bool sparsearray_merge_sorted(sparsearray *s,
+    size_t count,
+    uint64_t *keys,
+    uint8_t *values,
+    size_t *order,
+    size_t value_size,
+    int duplicates) {
+    if (s->tree == NULL) {
+        if ((s->dense != NULL && !sparsearray_make_flat(s))
+            || !sparsearray_unpack(s)
+            || !sparsearray_merge_flat(s, count, keys, values, order, value_size, duplicates)) return false;
+
+        sparsearray_check_dense(s, value_size);
+
+        return true;
+    }
+
+    // Trees are merged flat, then built again from the merged keys.
+    assert(s->tree->value_size == value_size);
+    sparsearray flat;
+
+    if (!sparsearray_flatten(s, &flat)) return false;
+
+    bool merged = sparsearray_merge_flat(&flat, count, keys, values, order, value_size, duplicates)
+        && sparsearray_tree_build(s->tree, sparsearray_count(&flat), (uint64_t *) flat.keys.data, flat.values.data);
+    sparsearray_destroy(&flat);
+
+    return merged;
+}
+
+bool sparsearray_put_sorted(sparsearray *s,
+    size_t count,
+    uint64_t *keys,
+    void *values,
+    size_t value_size,
+    int duplicates) {
+    assert(keys != NULL || count == 0);
+
+    if (count == 0) return true;
+
+    size_t sorted = 1;
+
+    while (sorted < count && keys[sorted - 1] <= keys[sorted]) sorted++;
+
+    if (sorted >= count) return sparsearray_merge_sorted(s, count, keys, values, NULL, value_size, duplicates);
+
+    size_t *order = malloc(count * sizeof(size_t));
+
+    if (order == NULL) return false;
+
+    bool merged = sparsearray_radix_sort(count, keys, order)
+        && sparsearray_merge_sorted(s, count, keys, values, order, value_size, duplicates);
+    free(order);
+
+    return merged;
+}
+
+bool sparsearray_merge(sparsearray *s, sparsearray *other, size_t value_size, int duplicates) {
+    if (sparsearray_count(other) == 0) return true;
+
+    if (other->tree == NULL && other->packed == NULL && other->dense == NULL) {
+        return sparsearray_merge_sorted(s, sparsearray_count(other), (uint64_t *) other->keys.data, other->values.data, NULL, value_size, duplicates);
+    }
+
+    sparsearray flat;
+
+    if (!sparsearray_flatten(other, &flat)) return false;
+
+    bool merged = sparsearray_merge_sorted(s, sparsearray_count(&flat), (uint64_t *) flat.keys.data, flat.values.data, NULL, value_size, duplicates);
+    sparsearray_destroy(&flat);
+
+    return merged;
+}
+
+static bool sparsearray_save_tree(sparsearray_tree *t, int fd) {
+    // Snapshots are always flat, the keys and then the values of every leaf
+    // in order.
+    snapshot_header header;
+    snapshot_header_create(&header, SNAPSHOT_SPARSEARRAY);
+    header.fields[0] = t->count;
+    header.fields[1] = t->value_size;
+
+    if (!snapshot_write_header(fd, &header)) return false;
+
+    for (sparsearray_tree_leaf *l = sparsearray_tree_first(t); l != NULL; l = sparsearray_tree_next(t, l)) {
+        if (!snapshot_write_data(fd, l->keys, l->node.size * sizeof(uint64_t))) return false;
+    }
+
+    if (!snapshot_write_padding(fd, t->count * sizeof(uint64_t))) return false;
+
+    for (sparsearray_tree_leaf *l = sparsearray_tree_first(t); l != NULL; l = sparsearray_tree_next(t, l)) {
+        if (!snapshot_write_data(fd, l->values, l->node.size * t->value_size)) return false;
+    }
+
+    return snapshot_write_padding(fd, t->count * t->value_size);
+}
+
+static bool sparsearray_save_packed(sparsearray_packed *p, int fd) {
+    // Keys are unpacked a block at a time.
+    uint64_t keys[SPARSEARRAY_PACKED_BLOCK_SIZE];
+
+    for (size_t b = 0; b < p->blocks; b++) {
+        size_t count = sparsearray_packed_unpack(p, b, keys);
+
+        if (!snapshot_write_data(fd, keys, count * sizeof(uint64_t))) return false;
+    }
+
+    return snapshot_write_padding(fd, p->count * sizeof(uint64_t));
+}
+
+bool sparsearray_save(sparsearray *s, int fd) {
+    if (s->tree != NULL) return sparsearray_save_tree(s->tree, fd);
+
+    if (s->dense != NULL) {
+        // Dense sparse arrays are saved flat.
+        sparsearray flat;
+
+        if (!sparsearray_flatten(s, &flat)) return false;
+
+        bool saved = sparsearray_save(&flat, fd);
+        sparsearray_destroy(&flat);
+
+        return saved;
+    }
+
+    // The value size isn't known to the sparse array, but every value has the
+    // same size.
+    size_t count = sparsearray_count(s);
+    snapshot_header header;
+    snapshot_header_create(&header, SNAPSHOT_SPARSEARRAY);
+    header.fields[0] = count;
+    header.fields[1] = count == 0 ? 0 : buffer_size(&s->values) / count;
+
+    if (!snapshot_write_header(fd, &header)) return false;
+
+    if (s->packed != NULL) {
+        if (!sparsearray_save_packed(s->packed, fd)) return false;
+    } else if (!snapshot_write_section(fd, s->keys.data, buffer_size(&s->keys))) {
+        return false;
+    }
+
+    return snapshot_write_section(fd, s->values.data, buffer_size(&s->values));
+}
+
+static void sparsearray_map_buffer(buffer *b, void *data, size_t size) {
+    // Buffers made from the mapped ones are allocated on the heap.
+    b->allocator = &allocator_heap;
+    b->data = data;
+    b->size = size;
+    b->capacity = size;
+}
+
+bool sparsearray_open_mapped(sparsearray *s, snapshot *snap, const char *path) {
+    if (!snapshot_open(snap, path, SNAPSHOT_SPARSEARRAY)) return false;
+
+    snapshot_header *header = snapshot_get_header(snap);
+    size_t count = (size_t) header->fields[0];
+    size_t value_size = (size_t) header->fields[1];
+
+    if (value_size > 0 && count > SIZE_MAX / value_size) {
+        snapshot_close(snap);
+        return false;
+    }
+
+    void *keys = snapshot_read_section(snap, count * sizeof(uint64_t));
+    void *values = snapshot_read_section(snap, count * value_size);
+
+    if (keys == NULL || values == NULL) {
+        snapshot_close(snap);
+        return false;
+    }
+
+    s->tree = NULL;
+    s->index = NULL;
+    s->packed = NULL;
+    s->dense = NULL;
+    sparsearray_map_buffer(&s->keys, keys, count * sizeof(uint64_t));
+    sparsearray_map_buffer(&s->values, values, count * value_size);
+
+    return true;
+}
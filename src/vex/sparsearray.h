@@ -5,14 +5,55 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "buffer.h"
+#include "snapshot.h"
+#include "sparsearray_tree.h"
+#include "sparsearray_index.h"
+#include "sparsearray_packed.h"
+#include "sparsearray_dense.h"
 
+// Keys are kept sorted in `keys`, with values of a fixed size in the same
+// order in `values`. Sparse arrays created with sparsearray_create_tree keep
+// them in the blocked nodes of `tree` instead. Flat sparse arrays searched
+// often can have an `index` of their keys, and packed ones keep their keys in
+// `packed` with `keys` left empty. Flat sparse arrays with close keys switch
+// to `dense` on their own, keeping each value in a slot of `values` for its
+// key, with `keys` left empty. Each is NULL otherwise.
 typedef struct {
     buffer keys;
     buffer values;
+    sparsearray_tree *tree;
+    sparsearray_index *index;
+    sparsearray_packed *packed;
+    sparsearray_dense *dense;
 } sparsearray;
 
+// Goes through the keys from a lower bound up to but not including an upper
+// bound, in order.
+typedef struct {
+    sparsearray *array;
+    // Index of the current key and of the first key past the range, and for
+    // trees the leaf and offset of the current key.
+    size_t index;
+    size_t end;
+    sparsearray_tree_leaf *leaf;
+    size_t offset;
+    bool started;
+} sparsearray_range_iterator;
+
 bool sparsearray_create(sparsearray *, size_t, size_t);
 
+// Creates a sparse array with its keys and values allocated by the given
+// allocator. Search indexes and packed keys built later stay on the heap.
+bool sparsearray_create_in(sparsearray *, allocator *, size_t, size_t);
+
+// Creates a sparse array stored in a B+-tree, with values of the given size.
+// Puts and removes in any order only move the keys in one node, where the flat
+// layout moves every key after the changed one. Getting keys and values by
+// index costs a search from the root, except when going through them in order.
+bool sparsearray_create_tree(sparsearray *, size_t);
+
+bool sparsearray_create_tree_in(sparsearray *, allocator *, size_t);
+
 void sparsearray_destroy(sparsearray *);
 
 void sparsearray_clear(sparsearray *);
@@ -31,4 +72,79 @@ bool sparsearray_remove(sparsearray *, uint64_t, size_t);
 
 void * sparsearray_get(sparsearray *, uint64_t, size_t);
 
+// Index of the first key not less than the given key, or the count if every
+// key is less.
+size_t sparsearray_lower_bound(sparsearray *, uint64_t);
+
+// Index of the first key greater than the given key, or the count if none is.
+size_t sparsearray_upper_bound(sparsearray *, uint64_t);
+
+// Iterates the keys from the first up to the second, excluding the second.
+// The sparse array must not change while iterating.
+sparsearray_range_iterator sparsearray_iterate_range(sparsearray *, uint64_t, uint64_t);
+
+bool sparsearray_iterate_range_next(sparsearray_range_iterator *);
+
+uint64_t sparsearray_iterate_range_key(sparsearray_range_iterator *);
+
+void * sparsearray_iterate_range_value(sparsearray_range_iterator *, size_t);
+
+// Removes the keys from the first up to the second, excluding the second. The
+// keys and values after them are moved once for the whole range.
+bool sparsearray_remove_range(sparsearray *, uint64_t, uint64_t, size_t);
+
+// Builds a search index over the keys of a flat sparse array, making gets on
+// large arrays faster. The index is dropped by the next change to the keys, so
+// it's for arrays that are read much more than they are changed. Trees are
+// searched by block already and aren't indexed.
+bool sparsearray_build_index(sparsearray *);
+
+// Frees the search index of a sparse array, if it has one. Mapped sparse
+// arrays, which aren't destroyed, drop their index with this.
+void sparsearray_drop_index(sparsearray *);
+
+// Packs the keys of a flat sparse array into as few bits as the differences
+// between nearby keys need, for arrays of many close keys that are mostly
+// read. Gets, access by index and iteration work on the packed keys directly.
+// Putting a new key or removing one unpacks the keys first. Trees and dense
+// sparse arrays aren't packed.
+bool sparsearray_pack(sparsearray *);
+
+bool sparsearray_unpack(sparsearray *);
+
+// Which value is kept for a key put more than once by sparsearray_put_sorted
+// and sparsearray_merge. Keys already in the sparse array come first, then
+// the keys put in the order given.
+#define SPARSEARRAY_KEEP_FIRST 0
+#define SPARSEARRAY_KEEP_LAST 1
+
+// Puts a number of keys with values stored in sequence in one pass over the
+// sparse array, instead of searching and moving keys for each one. Keys that
+// aren't sorted already are sorted with a radix sort first.
+bool sparsearray_put_sorted(sparsearray *, size_t, uint64_t *, void *, size_t, int);
+
+// Puts every key and value of the second sparse array into the first in one
+// pass over both.
+bool sparsearray_merge(sparsearray *, sparsearray *, size_t, int);
+
+// Makes the second sparse array a copy of the first that later changes to
+// either don't affect the other, to be destroyed when done with. Trees share
+// their nodes with the copy, and copy only the nodes on the path to a change
+// while shared, so taking a snapshot is constant time. Each can then be read
+// or changed from its own thread while the other changes, such as readers
+// working on a consistent version while a writer keeps putting. Values of a
+// shared tree must be changed through sparsearray_put rather than through a
+// pointer from a get. Trees created with an allocator that isn't thread safe
+// must only be destroyed on the thread using the allocator. Other sparse
+// arrays are copied into a flat one.
+bool sparsearray_snapshot(sparsearray *, sparsearray *);
+
+// Writes a snapshot of the sparse array to a file descriptor.
+bool sparsearray_save(sparsearray *, int);
+
+// Opens a sparse array from a snapshot file, using the keys and values in the
+// mapped file directly. It's read only and must not be destroyed, instead it's
+// valid until the snapshot is closed.
+bool sparsearray_open_mapped(sparsearray *, snapshot *, const char *);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "debug.h"
+#include "sparsearray_dense.h"
+
+static inline size_t sparsearray_dense_words(size_t slots) {
+    return (slots + 63) / 64;
+}
+
+static inline size_t sparsearray_dense_popcount(uint64_t word) {
+#ifdef __GNUC__
+    return (size_t) __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (size_t) ((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline size_t sparsearray_dense_first(uint64_t word) {
+    // Index of the lowest set bit of a word that isn't zero.
+#ifdef _MSC_VER
+    unsigned long index;
+
+    if (_BitScanForward(&index, (unsigned long) word)) return index;
+
+    _BitScanForward(&index, (unsigned long) (word >> 32));
+
+    return index + 32;
+#else
+    return (size_t) __builtin_ctzll(word);
+#endif
+}
+
+bool sparsearray_dense_create(sparsearray_dense *d, uint64_t base, size_t slots, size_t value_size) {
+    size_t words = sparsearray_dense_words(slots);
+    d->present = calloc(words + 1, sizeof(uint64_t));
+    d->ranks = malloc((words + 1) * sizeof(size_t));
+
+    if (d->present == NULL || d->ranks == NULL) {
+        free(d->present);
+        free(d->ranks);
+        return false;
+    }
+
+    d->base = base;
+    d->slots = slots;
+    d->count = 0;
+    d->value_size = value_size;
+    d->ranks_stale = true;
+    d->cursor_index = SIZE_MAX;
+    d->cursor_slot = 0;
+
+    return true;
+}
+
+void sparsearray_dense_destroy(sparsearray_dense *d) {
+    free(d->present);
+    free(d->ranks);
+}
+
+bool sparsearray_dense_rebase(sparsearray_dense *d, uint64_t base, size_t slots) {
+    assert(base <= d->base && slots >= d->base - base + d->slots);
+    sparsearray_dense moved;
+
+    if (!sparsearray_dense_create(&moved, base, slots, d->value_size)) return false;
+
+    // Set the bits again at their new slots.
+    size_t shift = (size_t) (d->base - base);
+
+    for (size_t w = 0, l = sparsearray_dense_words(d->slots); w < l; w++) {
+        for (uint64_t word = d->present[w]; word != 0; word &= word - 1) {
+            sparsearray_dense_set(&moved, shift + w * 64 + sparsearray_dense_first(word));
+        }
+    }
+
+    sparsearray_dense_destroy(d);
+    *d = moved;
+
+    return true;
+}
+
+static void sparsearray_dense_rank_all(sparsearray_dense *d) {
+    size_t words = sparsearray_dense_words(d->slots);
+    size_t rank = 0;
+
+    for (size_t w = 0; w < words; w++) {
+        d->ranks[w] = rank;
+        rank += sparsearray_dense_popcount(d->present[w]);
+    }
+
+    d->ranks[words] = rank;
+    d->ranks_stale = false;
+    d->cursor_index = SIZE_MAX;
+}
+
+size_t sparsearray_dense_rank(sparsearray_dense *d, size_t slot) {
+    assert(slot < d->slots);
+
+    if (d->ranks_stale) sparsearray_dense_rank_all(d);
+
+    uint64_t before = d->present[slot / 64] & (((uint64_t) 1 << (slot % 64)) - 1);
+
+    return d->ranks[slot / 64] + sparsearray_dense_popcount(before);
+}
+
+size_t sparsearray_dense_select(sparsearray_dense *d, size_t index) {
+    assert(index < d->count);
+
+    if (d->ranks_stale) sparsearray_dense_rank_all(d);
+
+    if (d->cursor_index == index) return d->cursor_slot;
+
+    if (d->cursor_index != SIZE_MAX && d->cursor_index + 1 == index) {
+        d->cursor_index = index;
+        d->cursor_slot = sparsearray_dense_next(d, d->cursor_slot + 1);
+
+        return d->cursor_slot;
+    }
+
+    // Last word with fewer keys before it than the index.
+    size_t left = 0;
+    size_t right = sparsearray_dense_words(d->slots);
+
+    while (right - left > 1) {
+        size_t middle = (left + right) / 2;
+
+        if (d->ranks[middle] <= index) {
+            left = middle;
+        } else {
+            right = middle;
+        }
+    }
+
+    uint64_t word = d->present[left];
+
+    for (size_t skip = index - d->ranks[left]; skip > 0; skip--) word &= word - 1;
+
+    d->cursor_index = index;
+    d->cursor_slot = left * 64 + sparsearray_dense_first(word);
+
+    return d->cursor_slot;
+}
+
+size_t sparsearray_dense_next(sparsearray_dense *d, size_t slot) {
+    if (slot >= d->slots) return d->slots;
+
+    size_t w = slot / 64;
+    uint64_t word = d->present[w] & (~(uint64_t) 0 << (slot % 64));
+    size_t words = sparsearray_dense_words(d->slots);
+
+    while (word == 0) {
+        if (++w == words) return d->slots;
+
+        word = d->present[w];
+    }
+
+    return w * 64 + sparsearray_dense_first(word);
+}
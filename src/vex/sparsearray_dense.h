@@ -0,0 +1,67 @@
+/* Presence bitmap of flat sparse arrays whose keys are close enough to index values directly. */
+#ifndef SPARSEARRAY_DENSE_H
+#define SPARSEARRAY_DENSE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Flat sparse arrays of at least this many keys switch to direct indexing
+// once they cover at least half of the keys between their first and last.
+#define SPARSEARRAY_DENSE_MIN_COUNT 64
+
+// They switch back once fewer than a quarter of their slots have keys, so
+// keys coming and going near the threshold don't switch back and forth.
+#define SPARSEARRAY_DENSE_MAX_SLOTS_PER_KEY 4
+
+// Slots for every key from `base`, with a bit per slot set for the keys that
+// are there. The values are kept in the slots of the sparse array's values.
+typedef struct {
+    uint64_t base;
+    size_t slots;
+    size_t count;
+    size_t value_size;
+    uint64_t *present;
+    // Number of keys before each word of `present`, for finding keys by index.
+    // Rebuilt on the first search after keys change.
+    size_t *ranks;
+    bool ranks_stale;
+    // Index and slot of the key last found by index, so going through the
+    // keys in order by index finds each from the one before.
+    size_t cursor_index;
+    size_t cursor_slot;
+} sparsearray_dense;
+
+bool sparsearray_dense_create(sparsearray_dense *, uint64_t, size_t, size_t);
+
+void sparsearray_dense_destroy(sparsearray_dense *);
+
+// Moves the slots to start at a lower or the same base, with at least as
+// many slots after the old ones.
+bool sparsearray_dense_rebase(sparsearray_dense *, uint64_t, size_t);
+
+static inline bool sparsearray_dense_has(sparsearray_dense *d, size_t slot) {
+    return (d->present[slot / 64] >> (slot % 64)) & 1;
+}
+
+static inline void sparsearray_dense_set(sparsearray_dense *d, size_t slot) {
+    d->present[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    d->count++;
+    d->ranks_stale = true;
+}
+
+static inline void sparsearray_dense_clear(sparsearray_dense *d, size_t slot) {
+    d->present[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+    d->count--;
+    d->ranks_stale = true;
+}
+
+// Number of keys in the slots before the slot.
+size_t sparsearray_dense_rank(sparsearray_dense *, size_t);
+
+// Slot of the key at the index.
+size_t sparsearray_dense_select(sparsearray_dense *, size_t);
+
+// First slot from the slot on with a key, or the number of slots if none has.
+size_t sparsearray_dense_next(sparsearray_dense *, size_t);
+
+#endif
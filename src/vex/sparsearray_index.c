@@ -0,0 +1,82 @@
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "debug.h"
+#include "sparsearray_index.h"
+
+static inline void sparsearray_index_prefetch(const void *p) {
+#ifdef _MSC_VER
+    _mm_prefetch((const char *) p, _MM_HINT_T0);
+#elif defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void) p;
+#endif
+}
+
+static size_t sparsearray_index_fill(sparsearray_index *x, uint64_t *keys, size_t block, size_t position) {
+    // Visits the positions in order, giving each the next block. Returns the
+    // block after the last one given.
+    if (position > x->count) return block;
+
+    block = sparsearray_index_fill(x, keys, block, position * 2);
+    x->keys[position] = keys[block * SPARSEARRAY_INDEX_BLOCK_SIZE];
+    x->blocks[position] = block;
+
+    return sparsearray_index_fill(x, keys, block + 1, position * 2 + 1);
+}
+
+bool sparsearray_index_create(sparsearray_index *x, size_t count, uint64_t *keys) {
+    x->count = (count + SPARSEARRAY_INDEX_BLOCK_SIZE - 1) / SPARSEARRAY_INDEX_BLOCK_SIZE;
+    // Position 0 is unused.
+    x->keys = malloc((x->count + 1) * sizeof(uint64_t));
+    x->blocks = malloc((x->count + 1) * sizeof(size_t));
+
+    if (x->keys == NULL || x->blocks == NULL) {
+        free(x->keys);
+        free(x->blocks);
+        return false;
+    }
+
+    size_t blocks = sparsearray_index_fill(x, keys, 0, 1);
+    assert(blocks == x->count);
+
+    return true;
+}
+
+void sparsearray_index_destroy(sparsearray_index *x) {
+    free(x->keys);
+    free(x->blocks);
+}
+
+size_t sparsearray_index_search(sparsearray_index *x, size_t count, uint64_t *keys, uint64_t key) {
+    if (x->count == 0) return 0;
+
+    // Find the first block starting after the key, remembering the last
+    // position where the search went left.
+    size_t position = 1;
+    size_t after = 0;
+
+    while (position <= x->count) {
+        // Three levels down from here are eight adjacent keys.
+        sparsearray_index_prefetch(x->keys + position * 8);
+        bool right = x->keys[position] <= key;
+        after = right ? after : position;
+        position = position * 2 + right;
+    }
+
+    // The key is in the block before, if it's anywhere. Keys before the first
+    // block go first.
+    if (after != 0 && x->blocks[after] == 0) return 0;
+
+    size_t block = after == 0 ? x->count - 1 : x->blocks[after] - 1;
+    size_t start = block * SPARSEARRAY_INDEX_BLOCK_SIZE;
+    size_t end = start + SPARSEARRAY_INDEX_BLOCK_SIZE < count ? start + SPARSEARRAY_INDEX_BLOCK_SIZE : count;
+    size_t index = start;
+
+    for (size_t i = start; i < end; i++) index += keys[i] < key;
+
+    return index;
+}
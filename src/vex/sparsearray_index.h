@@ -0,0 +1,30 @@
+/* Search index over the keys of flat sparse arrays, built by sparsearray_build_index. */
+#ifndef SPARSEARRAY_INDEX_H
+#define SPARSEARRAY_INDEX_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keys per block. A block of keys fills one cache line.
+#define SPARSEARRAY_INDEX_BLOCK_SIZE 8
+
+// The first key of every block, laid out in Eytzinger order: the children of
+// the key at position k are at 2k and 2k + 1, starting from 1. A search walks
+// down without branching on the keys, and the keys of the next few levels are
+// next to each other so they can be prefetched together.
+typedef struct {
+    uint64_t *keys;
+    // Block of each key in `keys`.
+    size_t *blocks;
+    size_t count;
+} sparsearray_index;
+
+bool sparsearray_index_create(sparsearray_index *, size_t, uint64_t *);
+
+void sparsearray_index_destroy(sparsearray_index *);
+
+// Index of the first of the sorted keys the index was built from that isn't
+// less than the given key, or the number of keys if every key is less.
+size_t sparsearray_index_search(sparsearray_index *, size_t, uint64_t *, uint64_t);
+
+#endif
@@ -0,0 +1,142 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "sparsearray_packed.h"
+
+static inline size_t sparsearray_packed_width(sparsearray_packed *p, size_t block) {
+    return p->offsets[block + 1] - p->offsets[block];
+}
+
+static inline size_t sparsearray_packed_block_count(sparsearray_packed *p, size_t block) {
+    size_t start = block * SPARSEARRAY_PACKED_BLOCK_SIZE;
+
+    return p->count - start < SPARSEARRAY_PACKED_BLOCK_SIZE ? p->count - start : SPARSEARRAY_PACKED_BLOCK_SIZE;
+}
+
+static inline uint64_t sparsearray_packed_get(uint64_t *words, size_t width, size_t index) {
+    // The value at the index of a block packed with the width, which may
+    // continue into the next word.
+    if (width == 0) return 0;
+
+    size_t bit = index * width;
+    size_t shift = bit % 64;
+    uint64_t value = words[bit / 64] >> shift;
+
+    if (shift + width > 64) value |= words[bit / 64 + 1] << (64 - shift);
+
+    return width == 64 ? value : value & (((uint64_t) 1 << width) - 1);
+}
+
+bool sparsearray_packed_create(sparsearray_packed *p, size_t count, uint64_t *keys) {
+    p->count = count;
+    p->blocks = (count + SPARSEARRAY_PACKED_BLOCK_SIZE - 1) / SPARSEARRAY_PACKED_BLOCK_SIZE;
+    p->firsts = malloc((p->blocks + 1) * sizeof(uint64_t));
+    p->offsets = malloc((p->blocks + 1) * sizeof(size_t));
+    p->words = NULL;
+
+    if (p->firsts == NULL || p->offsets == NULL) {
+        sparsearray_packed_destroy(p);
+        return false;
+    }
+
+    p->offsets[0] = 0;
+
+    for (size_t b = 0; b < p->blocks; b++) {
+        size_t start = b * SPARSEARRAY_PACKED_BLOCK_SIZE;
+        uint64_t span = keys[start + sparsearray_packed_block_count(p, b) - 1] - keys[start];
+        size_t width = 0;
+
+        while (width < 64 && (span >> width) != 0) width++;
+
+        p->firsts[b] = keys[start];
+        p->offsets[b + 1] = p->offsets[b] + width;
+    }
+
+    p->words = calloc(p->offsets[p->blocks] + 1, sizeof(uint64_t));
+
+    if (p->words == NULL) {
+        sparsearray_packed_destroy(p);
+        return false;
+    }
+
+    for (size_t b = 0; b < p->blocks; b++) {
+        uint64_t *words = p->words + p->offsets[b];
+        size_t width = sparsearray_packed_width(p, b);
+
+        if (width == 0) continue;
+
+        for (size_t i = 0, l = sparsearray_packed_block_count(p, b); i < l; i++) {
+            uint64_t value = keys[b * SPARSEARRAY_PACKED_BLOCK_SIZE + i] - p->firsts[b];
+            size_t bit = i * width;
+            size_t shift = bit % 64;
+            words[bit / 64] |= value << shift;
+
+            if (shift + width > 64) words[bit / 64 + 1] |= value >> (64 - shift);
+        }
+    }
+
+    return true;
+}
+
+void sparsearray_packed_destroy(sparsearray_packed *p) {
+    free(p->firsts);
+    free(p->offsets);
+    free(p->words);
+}
+
+uint64_t sparsearray_packed_key(sparsearray_packed *p, size_t index) {
+    assert(index < p->count);
+    size_t block = index / SPARSEARRAY_PACKED_BLOCK_SIZE;
+
+    return p->firsts[block]
+        + sparsearray_packed_get(p->words + p->offsets[block], sparsearray_packed_width(p, block), index % SPARSEARRAY_PACKED_BLOCK_SIZE);
+}
+
+size_t sparsearray_packed_search(sparsearray_packed *p, uint64_t key) {
+    if (p->count == 0) return 0;
+
+    // Last block starting at or before the key, or the first block.
+    uint64_t *base = p->firsts;
+    size_t n = p->blocks;
+
+    while (n > 1) {
+        size_t half = n / 2;
+        base = base[half] <= key ? base + half : base;
+        n -= half;
+    }
+
+    size_t block = (size_t) (base - p->firsts);
+
+    if (key < *base) return 0;
+
+    // Search the differences in the block the same way.
+    uint64_t *words = p->words + p->offsets[block];
+    size_t width = sparsearray_packed_width(p, block);
+    uint64_t difference = key - *base;
+    size_t index = 0;
+    n = sparsearray_packed_block_count(p, block);
+
+    while (n > 1) {
+        size_t half = n / 2;
+        index = sparsearray_packed_get(words, width, index + half) < difference ? index + half : index;
+        n -= half;
+    }
+
+    index += sparsearray_packed_get(words, width, index) < difference;
+
+    return block * SPARSEARRAY_PACKED_BLOCK_SIZE + index;
+}
+
+size_t sparsearray_packed_unpack(sparsearray_packed *p, size_t block, uint64_t *keys) {
+    uint64_t *words = p->words + p->offsets[block];
+    size_t width = sparsearray_packed_width(p, block);
+    size_t count = sparsearray_packed_block_count(p, block);
+
+    for (size_t i = 0; i < count; i++) keys[i] = p->firsts[block] + sparsearray_packed_get(words, width, i);
+
+    return count;
+}
+
+size_t sparsearray_packed_size(sparsearray_packed *p) {
+    return (p->blocks + 1) * (sizeof(uint64_t) + sizeof(size_t)) + (p->offsets[p->blocks] + 1) * sizeof(uint64_t);
+}
@@ -0,0 +1,43 @@
+/* Keys of flat sparse arrays packed into fewer bits, built by sparsearray_pack. */
+#ifndef SPARSEARRAY_PACKED_H
+#define SPARSEARRAY_PACKED_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keys per block. Packing a block of keys in w bits each takes w words.
+#define SPARSEARRAY_PACKED_BLOCK_SIZE 64
+
+// Keys in blocks, each key stored as its difference from the first key of
+// its block in as many bits as the largest difference in the block needs.
+// Close keys take a few bits each, and any key is unpacked without going
+// through the ones before it.
+typedef struct {
+    // First key of each block, searched to find the block of a key.
+    uint64_t *firsts;
+    // Word each block starts at in `words`, followed by the number of words.
+    // The number of words of a block is the bits per key.
+    size_t *offsets;
+    uint64_t *words;
+    size_t count;
+    size_t blocks;
+} sparsearray_packed;
+
+// Packs sorted keys without duplicates.
+bool sparsearray_packed_create(sparsearray_packed *, size_t, uint64_t *);
+
+void sparsearray_packed_destroy(sparsearray_packed *);
+
+uint64_t sparsearray_packed_key(sparsearray_packed *, size_t);
+
+// Index of the first key not less than the given key, or the count if every
+// key is less.
+size_t sparsearray_packed_search(sparsearray_packed *, uint64_t);
+
+// Unpacks the keys of a block, returning how many there are.
+size_t sparsearray_packed_unpack(sparsearray_packed *, size_t, uint64_t *);
+
+// Bytes allocated for the packed keys.
+size_t sparsearray_packed_size(sparsearray_packed *);
+
+#endif
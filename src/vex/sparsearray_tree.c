@@ -0,0 +1,675 @@
+#include <string.h>
+#include <assert.h>
+#include "debug.h"
+#include "sync.h"
+#include "sparsearray_tree.h"
+
+// Nodes other than the root are kept at least half full.
+#define SPARSEARRAY_TREE_LEAF_MIN (SPARSEARRAY_TREE_LEAF_SIZE / 2)
+#define SPARSEARRAY_TREE_BRANCH_MIN (SPARSEARRAY_TREE_BRANCH_SIZE / 2)
+
+static inline uint8_t * sparsearray_tree_leaf_value(sparsearray_tree *t, sparsearray_tree_leaf *l, size_t index) {
+    return l->values + index * t->value_size;
+}
+
+static inline size_t sparsearray_tree_node_size(sparsearray_tree *t, sparsearray_tree_node *node) {
+    // Bytes allocated for the node.
+    return node->leaf
+        ? sizeof(sparsearray_tree_leaf) + SPARSEARRAY_TREE_LEAF_SIZE * t->value_size
+        : sizeof(sparsearray_tree_branch);
+}
+
+static sparsearray_tree_leaf * sparsearray_tree_leaf_create(sparsearray_tree *t) {
+    sparsearray_tree_leaf *l = allocator_allocate(t->allocator, sizeof(sparsearray_tree_leaf) + SPARSEARRAY_TREE_LEAF_SIZE * t->value_size);
+
+    if (l == NULL) return NULL;
+
+    l->node.size = 0;
+    l->node.references = 1;
+    l->node.leaf = true;
+
+    return l;
+}
+
+static sparsearray_tree_branch * sparsearray_tree_branch_create(sparsearray_tree *t) {
+    sparsearray_tree_branch *b = allocator_allocate(t->allocator, sizeof(sparsearray_tree_branch));
+
+    if (b == NULL) return NULL;
+
+    b->node.size = 0;
+    b->node.references = 1;
+    b->node.leaf = false;
+
+    return b;
+}
+
+static void sparsearray_tree_node_free(sparsearray_tree *t, sparsearray_tree_node *node) {
+    if (node != NULL) allocator_free(t->allocator, node, sparsearray_tree_node_size(t, node));
+}
+
+static void sparsearray_tree_node_release(sparsearray_tree *t, sparsearray_tree_node *node) {
+    // Frees the node and releases its children once nothing points to it.
+    if (sync_fetch_add(&node->references, (size_t) -1) != 1) return;
+
+    if (!node->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+
+        for (size_t i = 0; i < b->node.size; i++) sparsearray_tree_node_release(t, b->children[i]);
+    }
+
+    sparsearray_tree_node_free(t, node);
+}
+
+static sparsearray_tree_node * sparsearray_tree_own(sparsearray_tree *t, sparsearray_tree_node **slot) {
+    // Returns the node pointed to by the slot of a node this tree owns, first
+    // replacing it with a copy if it's shared. The copy shares the children of
+    // the node. Returns NULL when out of memory.
+    sparsearray_tree_node *node = *slot;
+
+    if (sync_load(&node->references) == 1) return node;
+
+    size_t size = sparsearray_tree_node_size(t, node);
+    sparsearray_tree_node *copy = allocator_allocate(t->allocator, size);
+
+    if (copy == NULL) return NULL;
+
+    memcpy(copy, node, size);
+    copy->references = 1;
+
+    if (!copy->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) copy;
+
+        for (size_t i = 0; i < b->node.size; i++) sync_fetch_add(&b->children[i]->references, 1);
+    }
+
+    sparsearray_tree_node_release(t, node);
+    *slot = copy;
+    t->cursor = NULL;
+
+    return copy;
+}
+
+static size_t sparsearray_tree_node_count(sparsearray_tree_node *node) {
+    if (node->leaf) return node->size;
+
+    sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+    size_t count = 0;
+
+    for (size_t i = 0; i < b->node.size; i++) count += b->counts[i];
+
+    return count;
+}
+
+static inline bool sparsearray_tree_node_full(sparsearray_tree_node *node) {
+    return node->size == (node->leaf ? SPARSEARRAY_TREE_LEAF_SIZE : SPARSEARRAY_TREE_BRANCH_SIZE);
+}
+
+static inline size_t sparsearray_tree_leaf_search(sparsearray_tree_leaf *l, uint64_t key) {
+    // Index of the first key not less than the key. Counting instead of
+    // searching has no branches to mispredict, and nodes are only a few cache
+    // lines.
+    size_t index = 0;
+
+    for (size_t i = 0; i < l->node.size; i++) index += l->keys[i] < key;
+
+    return index;
+}
+
+static inline size_t sparsearray_tree_branch_search(sparsearray_tree_branch *b, uint64_t key) {
+    // Index of the child the key belongs under.
+    size_t index = 0;
+
+    for (size_t i = 1; i < b->node.size; i++) index += b->keys[i] <= key;
+
+    return index;
+}
+
+bool sparsearray_tree_create(sparsearray_tree *t, allocator *a, size_t value_size) {
+    t->allocator = a;
+    t->value_size = value_size;
+    t->count = 0;
+    t->cursor = NULL;
+    t->cursor_index = 0;
+    t->root = (sparsearray_tree_node *) sparsearray_tree_leaf_create(t);
+
+    return t->root != NULL;
+}
+
+void sparsearray_tree_destroy(sparsearray_tree *t) {
+    sparsearray_tree_node_release(t, t->root);
+}
+
+bool sparsearray_tree_clear(sparsearray_tree *t) {
+    sparsearray_tree_destroy(t);
+
+    return sparsearray_tree_create(t, t->allocator, t->value_size);
+}
+
+size_t sparsearray_tree_count(sparsearray_tree *t) {
+    return t->count;
+}
+
+static sparsearray_tree_leaf * sparsearray_tree_leaf_at(sparsearray_tree *t, size_t index, size_t *offset) {
+    // Finds the leaf with the key at the index, setting the offset to where
+    // the key is in it.
+    assert(index < t->count);
+    sparsearray_tree_leaf *cursor = t->cursor;
+
+    if (cursor != NULL && index >= t->cursor_index) {
+        if (index < t->cursor_index + cursor->node.size) {
+            *offset = index - t->cursor_index;
+            return cursor;
+        }
+
+        if (index == t->cursor_index + cursor->node.size) {
+            t->cursor_index += cursor->node.size;
+            t->cursor = sparsearray_tree_next(t, cursor);
+            *offset = 0;
+            return t->cursor;
+        }
+    }
+
+    sparsearray_tree_node *node = t->root;
+    size_t remaining = index;
+
+    while (!node->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+        size_t c = 0;
+
+        for (; remaining >= b->counts[c]; c++) remaining -= b->counts[c];
+
+        node = b->children[c];
+    }
+
+    t->cursor = (sparsearray_tree_leaf *) node;
+    t->cursor_index = index - remaining;
+    *offset = remaining;
+
+    return t->cursor;
+}
+
+uint64_t sparsearray_tree_key(sparsearray_tree *t, size_t index) {
+    size_t offset;
+    sparsearray_tree_leaf *l = sparsearray_tree_leaf_at(t, index, &offset);
+
+    return l->keys[offset];
+}
+
+void * sparsearray_tree_value(sparsearray_tree *t, size_t index) {
+    size_t offset;
+    sparsearray_tree_leaf *l = sparsearray_tree_leaf_at(t, index, &offset);
+
+    return sparsearray_tree_leaf_value(t, l, offset);
+}
+
+static uint8_t * sparsearray_tree_leaf_insert(sparsearray_tree *t,
+    sparsearray_tree_leaf *l,
+    uint64_t key,
+    bool *added,
+    sparsearray_tree_node **split,
+    uint64_t *split_key) {
+    size_t index = sparsearray_tree_leaf_search(l, key);
+
+    if (index < l->node.size && l->keys[index] == key) {
+        *added = false;
+        return sparsearray_tree_leaf_value(t, l, index);
+    }
+
+    if (l->node.size == SPARSEARRAY_TREE_LEAF_SIZE) {
+        // Move the upper half of the keys to a new leaf following this one.
+        sparsearray_tree_leaf *right = sparsearray_tree_leaf_create(t);
+
+        if (right == NULL) return NULL;
+
+        size_t half = SPARSEARRAY_TREE_LEAF_SIZE / 2;
+        right->node.size = SPARSEARRAY_TREE_LEAF_SIZE - half;
+        memcpy(right->keys, l->keys + half, right->node.size * sizeof(uint64_t));
+        memcpy(right->values, sparsearray_tree_leaf_value(t, l, half), right->node.size * t->value_size);
+        l->node.size = half;
+        *split = (sparsearray_tree_node *) right;
+        *split_key = right->keys[0];
+
+        if (index > half) {
+            l = right;
+            index -= half;
+        }
+    }
+
+    uint8_t *value = sparsearray_tree_leaf_value(t, l, index);
+    memmove(l->keys + index + 1, l->keys + index, (l->node.size - index) * sizeof(uint64_t));
+    memmove(value + t->value_size, value, (l->node.size - index) * t->value_size);
+    l->keys[index] = key;
+    l->node.size++;
+    *added = true;
+
+    return value;
+}
+
+static uint8_t * sparsearray_tree_insert(sparsearray_tree *t,
+    sparsearray_tree_node **slot,
+    uint64_t key,
+    bool *added,
+    sparsearray_tree_node **split,
+    uint64_t *split_key) {
+    // Inserts the key under the node in the slot if it's missing, returning
+    // its value. When the node is split, the new node following it is set in
+    // split along with the smallest key under it.
+    *split = NULL;
+    sparsearray_tree_node *node = sparsearray_tree_own(t, slot);
+
+    if (node == NULL) return NULL;
+
+    if (node->leaf) return sparsearray_tree_leaf_insert(t, (sparsearray_tree_leaf *) node, key, added, split, split_key);
+
+    sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+    sparsearray_tree_branch *right = NULL;
+
+    // Allocate the node to split into before changing anything below, so
+    // running out of memory leaves the tree as it was.
+    if (b->node.size == SPARSEARRAY_TREE_BRANCH_SIZE && (right = sparsearray_tree_branch_create(t)) == NULL) return NULL;
+
+    size_t c = sparsearray_tree_branch_search(b, key);
+    sparsearray_tree_node *child_split;
+    uint64_t child_split_key;
+    uint8_t *value = sparsearray_tree_insert(t, &b->children[c], key, added, &child_split, &child_split_key);
+
+    if (value == NULL || child_split == NULL) {
+        sparsearray_tree_node_free(t, (sparsearray_tree_node *) right);
+
+        if (value != NULL && *added) b->counts[c]++;
+
+        return value;
+    }
+
+    // Insert the new child after the split one, into a copy of the arrays
+    // one larger in case this node has to be split too.
+    uint64_t keys[SPARSEARRAY_TREE_BRANCH_SIZE + 1];
+    size_t counts[SPARSEARRAY_TREE_BRANCH_SIZE + 1];
+    sparsearray_tree_node *children[SPARSEARRAY_TREE_BRANCH_SIZE + 1];
+    size_t size = b->node.size + 1;
+    size_t split_count = sparsearray_tree_node_count(child_split);
+    memcpy(keys, b->keys, (c + 1) * sizeof(uint64_t));
+    memcpy(counts, b->counts, (c + 1) * sizeof(size_t));
+    memcpy(children, b->children, (c + 1) * sizeof(sparsearray_tree_node *));
+    memcpy(keys + c + 2, b->keys + c + 1, (b->node.size - c - 1) * sizeof(uint64_t));
+    memcpy(counts + c + 2, b->counts + c + 1, (b->node.size - c - 1) * sizeof(size_t));
+    memcpy(children + c + 2, b->children + c + 1, (b->node.size - c - 1) * sizeof(sparsearray_tree_node *));
+    keys[c + 1] = child_split_key;
+    counts[c] = counts[c] + (*added ? 1 : 0) - split_count;
+    counts[c + 1] = split_count;
+    children[c + 1] = child_split;
+
+    size_t left_size = right == NULL ? size : size / 2;
+    memcpy(b->keys, keys, left_size * sizeof(uint64_t));
+    memcpy(b->counts, counts, left_size * sizeof(size_t));
+    memcpy(b->children, children, left_size * sizeof(sparsearray_tree_node *));
+    b->node.size = left_size;
+
+    if (right != NULL) {
+        right->node.size = size - left_size;
+        memcpy(right->keys, keys + left_size, right->node.size * sizeof(uint64_t));
+        memcpy(right->counts, counts + left_size, right->node.size * sizeof(size_t));
+        memcpy(right->children, children + left_size, right->node.size * sizeof(sparsearray_tree_node *));
+        *split = (sparsearray_tree_node *) right;
+        *split_key = keys[left_size];
+    }
+
+    return value;
+}
+
+void * sparsearray_tree_put(sparsearray_tree *t, uint64_t key) {
+    // Allocate a new root up front in case the current one is split.
+    sparsearray_tree_branch *root = NULL;
+
+    if (sparsearray_tree_node_full(t->root) && (root = sparsearray_tree_branch_create(t)) == NULL) return NULL;
+
+    bool added;
+    sparsearray_tree_node *split;
+    uint64_t split_key;
+    uint8_t *value = sparsearray_tree_insert(t, &t->root, key, &added, &split, &split_key);
+
+    if (value != NULL && split != NULL) {
+        root->node.size = 2;
+        root->keys[0] = 0;
+        root->keys[1] = split_key;
+        root->counts[0] = sparsearray_tree_node_count(t->root);
+        root->counts[1] = sparsearray_tree_node_count(split);
+        root->children[0] = t->root;
+        root->children[1] = split;
+        t->root = (sparsearray_tree_node *) root;
+    } else {
+        sparsearray_tree_node_free(t, (sparsearray_tree_node *) root);
+    }
+
+    if (value != NULL && added) {
+        t->count++;
+        t->cursor = NULL;
+    }
+
+    return value;
+}
+
+static void sparsearray_tree_branch_erase(sparsearray_tree_branch *b, size_t index) {
+    size_t after = b->node.size - index - 1;
+    memmove(b->keys + index, b->keys + index + 1, after * sizeof(uint64_t));
+    memmove(b->counts + index, b->counts + index + 1, after * sizeof(size_t));
+    memmove(b->children + index, b->children + index + 1, after * sizeof(sparsearray_tree_node *));
+    b->node.size--;
+}
+
+static void sparsearray_tree_rebalance_leaves(sparsearray_tree *t, sparsearray_tree_branch *b, size_t left) {
+    // Merges or moves keys between the leaves at left and the one after it.
+    // Leaves that can't be copied from a snapshot are left as they are.
+    size_t right = left + 1;
+    sparsearray_tree_leaf *l = (sparsearray_tree_leaf *) sparsearray_tree_own(t, &b->children[left]);
+    sparsearray_tree_leaf *r = (sparsearray_tree_leaf *) sparsearray_tree_own(t, &b->children[right]);
+    size_t value_size = t->value_size;
+
+    if (l == NULL || r == NULL) return;
+
+    if (l->node.size + r->node.size <= SPARSEARRAY_TREE_LEAF_SIZE) {
+        memcpy(l->keys + l->node.size, r->keys, r->node.size * sizeof(uint64_t));
+        memcpy(sparsearray_tree_leaf_value(t, l, l->node.size), r->values, r->node.size * value_size);
+        l->node.size += r->node.size;
+        b->counts[left] += b->counts[right];
+        sparsearray_tree_branch_erase(b, right);
+        sparsearray_tree_node_free(t, (sparsearray_tree_node *) r);
+    } else if (l->node.size < r->node.size) {
+        l->keys[l->node.size] = r->keys[0];
+        memcpy(sparsearray_tree_leaf_value(t, l, l->node.size), r->values, value_size);
+        l->node.size++;
+        r->node.size--;
+        memmove(r->keys, r->keys + 1, r->node.size * sizeof(uint64_t));
+        memmove(r->values, r->values + value_size, r->node.size * value_size);
+        b->keys[right] = r->keys[0];
+        b->counts[left]++;
+        b->counts[right]--;
+    } else {
+        memmove(r->keys + 1, r->keys, r->node.size * sizeof(uint64_t));
+        memmove(r->values + value_size, r->values, r->node.size * value_size);
+        l->node.size--;
+        r->keys[0] = l->keys[l->node.size];
+        memcpy(r->values, sparsearray_tree_leaf_value(t, l, l->node.size), value_size);
+        r->node.size++;
+        b->keys[right] = r->keys[0];
+        b->counts[left]--;
+        b->counts[right]++;
+    }
+}
+
+static void sparsearray_tree_rebalance_branches(sparsearray_tree *t, sparsearray_tree_branch *b, size_t left) {
+    // Merges or moves children between the branches at left and the one after
+    // it. The key separating them in the parent is the smallest key under the
+    // right one, and becomes the key of its first child when moved.
+    size_t right = left + 1;
+    sparsearray_tree_branch *l = (sparsearray_tree_branch *) sparsearray_tree_own(t, &b->children[left]);
+    sparsearray_tree_branch *r = (sparsearray_tree_branch *) sparsearray_tree_own(t, &b->children[right]);
+
+    if (l == NULL || r == NULL) return;
+
+    if (l->node.size + r->node.size <= SPARSEARRAY_TREE_BRANCH_SIZE) {
+        memcpy(l->keys + l->node.size, r->keys, r->node.size * sizeof(uint64_t));
+        memcpy(l->counts + l->node.size, r->counts, r->node.size * sizeof(size_t));
+        memcpy(l->children + l->node.size, r->children, r->node.size * sizeof(sparsearray_tree_node *));
+        l->keys[l->node.size] = b->keys[right];
+        l->node.size += r->node.size;
+        b->counts[left] += b->counts[right];
+        sparsearray_tree_branch_erase(b, right);
+        sparsearray_tree_node_free(t, (sparsearray_tree_node *) r);
+    } else if (l->node.size < r->node.size) {
+        size_t count = r->counts[0];
+        l->keys[l->node.size] = b->keys[right];
+        l->counts[l->node.size] = count;
+        l->children[l->node.size] = r->children[0];
+        l->node.size++;
+        b->keys[right] = r->keys[1];
+        sparsearray_tree_branch_erase(r, 0);
+        b->counts[left] += count;
+        b->counts[right] -= count;
+    } else {
+        l->node.size--;
+        size_t count = l->counts[l->node.size];
+        memmove(r->keys + 1, r->keys, r->node.size * sizeof(uint64_t));
+        memmove(r->counts + 1, r->counts, r->node.size * sizeof(size_t));
+        memmove(r->children + 1, r->children, r->node.size * sizeof(sparsearray_tree_node *));
+        r->keys[1] = b->keys[right];
+        r->keys[0] = l->keys[l->node.size];
+        r->counts[0] = count;
+        r->children[0] = l->children[l->node.size];
+        r->node.size++;
+        b->keys[right] = r->keys[0];
+        b->counts[left] -= count;
+        b->counts[right] += count;
+    }
+}
+
+static bool sparsearray_tree_erase(sparsearray_tree *t, sparsearray_tree_node **slot, uint64_t key) {
+    // Removes the key under the node in the slot, returning whether it was
+    // found. A child left less than half full is merged with a sibling or
+    // takes from it.
+    sparsearray_tree_node *node = sparsearray_tree_own(t, slot);
+
+    if (node == NULL) return false;
+
+    if (node->leaf) {
+        sparsearray_tree_leaf *l = (sparsearray_tree_leaf *) node;
+        size_t index = sparsearray_tree_leaf_search(l, key);
+
+        if (index >= l->node.size || l->keys[index] != key) return false;
+
+        uint8_t *value = sparsearray_tree_leaf_value(t, l, index);
+        l->node.size--;
+        memmove(l->keys + index, l->keys + index + 1, (l->node.size - index) * sizeof(uint64_t));
+        memmove(value, value + t->value_size, (l->node.size - index) * t->value_size);
+
+        return true;
+    }
+
+    sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+    size_t c = sparsearray_tree_branch_search(b, key);
+
+    if (!sparsearray_tree_erase(t, &b->children[c], key)) return false;
+
+    sparsearray_tree_node *child = b->children[c];
+    b->counts[c]--;
+
+    if (child->size >= (child->leaf ? SPARSEARRAY_TREE_LEAF_MIN : SPARSEARRAY_TREE_BRANCH_MIN)) return true;
+
+    size_t left = c + 1 < b->node.size ? c : c - 1;
+
+    if (child->leaf) {
+        sparsearray_tree_rebalance_leaves(t, b, left);
+    } else {
+        sparsearray_tree_rebalance_branches(t, b, left);
+    }
+
+    return true;
+}
+
+bool sparsearray_tree_remove(sparsearray_tree *t, uint64_t key) {
+    // Keys missing from a tree shared with a snapshot are looked for first,
+    // so removing them doesn't copy nodes.
+    if (sync_load(&t->root->references) > 1 && sparsearray_tree_get(t, key) == NULL) return false;
+
+    if (!sparsearray_tree_erase(t, &t->root, key)) return false;
+
+    t->count--;
+    t->cursor = NULL;
+
+    // A root left with one child is replaced by it.
+    if (!t->root->leaf && t->root->size == 1) {
+        sparsearray_tree_node *root = t->root;
+        t->root = ((sparsearray_tree_branch *) root)->children[0];
+        sparsearray_tree_node_free(t, root);
+    }
+
+    return true;
+}
+
+void * sparsearray_tree_get(sparsearray_tree *t, uint64_t key) {
+    sparsearray_tree_node *node = t->root;
+
+    while (!node->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+        node = b->children[sparsearray_tree_branch_search(b, key)];
+    }
+
+    sparsearray_tree_leaf *l = (sparsearray_tree_leaf *) node;
+    size_t index = sparsearray_tree_leaf_search(l, key);
+
+    if (index >= l->node.size || l->keys[index] != key) return NULL;
+
+    return sparsearray_tree_leaf_value(t, l, index);
+}
+
+size_t sparsearray_tree_lower_bound(sparsearray_tree *t, uint64_t key, sparsearray_tree_leaf **leaf, size_t *offset) {
+    // Count the keys under the children passed over on the way down.
+    sparsearray_tree_node *node = t->root;
+    size_t index = 0;
+
+    while (!node->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+        size_t c = sparsearray_tree_branch_search(b, key);
+
+        for (size_t i = 0; i < c; i++) index += b->counts[i];
+
+        node = b->children[c];
+    }
+
+    *leaf = (sparsearray_tree_leaf *) node;
+    *offset = sparsearray_tree_leaf_search(*leaf, key);
+
+    return index + *offset;
+}
+
+static void sparsearray_tree_level_destroy(sparsearray_tree *t,
+    sparsearray_tree_node **level,
+    uint64_t *level_keys,
+    size_t *level_counts,
+    size_t parents,
+    size_t start,
+    size_t nodes) {
+    // Destroys the parents built so far for a level, and the nodes not yet
+    // moved into them.
+    if (level != NULL) {
+        for (size_t i = 0; i < parents; i++) sparsearray_tree_node_release(t, level[i]);
+
+        for (size_t i = start; i < nodes; i++) sparsearray_tree_node_release(t, level[i]);
+    }
+
+    free(level);
+    free(level_keys);
+    free(level_counts);
+}
+
+bool sparsearray_tree_build(sparsearray_tree *t, size_t count, uint64_t *keys, uint8_t *values) {
+    // Keys are spread evenly over as few leaves as they fit in, which leaves
+    // every leaf at least half full, and the same for each level of branches.
+    size_t nodes = count <= SPARSEARRAY_TREE_LEAF_SIZE ? 1 : (count + SPARSEARRAY_TREE_LEAF_SIZE - 1) / SPARSEARRAY_TREE_LEAF_SIZE;
+    sparsearray_tree_node **level = malloc(nodes * sizeof(sparsearray_tree_node *));
+    uint64_t *level_keys = malloc(nodes * sizeof(uint64_t));
+    size_t *level_counts = malloc(nodes * sizeof(size_t));
+
+    if (level == NULL || level_keys == NULL || level_counts == NULL) {
+        sparsearray_tree_level_destroy(t, level, level_keys, level_counts, 0, 0, 0);
+        return false;
+    }
+
+    for (size_t i = 0, start = 0; i < nodes; i++) {
+        size_t size = count / nodes + (i < count % nodes);
+        sparsearray_tree_leaf *l = sparsearray_tree_leaf_create(t);
+
+        if (l == NULL) {
+            sparsearray_tree_level_destroy(t, level, level_keys, level_counts, i, 0, 0);
+            return false;
+        }
+
+        memcpy(l->keys, keys + start, size * sizeof(uint64_t));
+        memcpy(l->values, values + start * t->value_size, size * t->value_size);
+        l->node.size = size;
+        level[i] = (sparsearray_tree_node *) l;
+        level_keys[i] = size > 0 ? keys[start] : 0;
+        level_counts[i] = size;
+        start += size;
+    }
+
+    while (nodes > 1) {
+        // Parents are stored over the children already moved into them.
+        size_t parents = (nodes + SPARSEARRAY_TREE_BRANCH_SIZE - 1) / SPARSEARRAY_TREE_BRANCH_SIZE;
+
+        for (size_t i = 0, start = 0; i < parents; i++) {
+            size_t size = nodes / parents + (i < nodes % parents);
+            sparsearray_tree_branch *b = sparsearray_tree_branch_create(t);
+
+            if (b == NULL) {
+                sparsearray_tree_level_destroy(t, level, level_keys, level_counts, i, start, nodes);
+                return false;
+            }
+
+            memcpy(b->children, level + start, size * sizeof(sparsearray_tree_node *));
+            memcpy(b->keys, level_keys + start, size * sizeof(uint64_t));
+            memcpy(b->counts, level_counts + start, size * sizeof(size_t));
+            b->node.size = size;
+            level[i] = (sparsearray_tree_node *) b;
+            level_keys[i] = b->keys[0];
+            level_counts[i] = sparsearray_tree_node_count((sparsearray_tree_node *) b);
+            start += size;
+        }
+
+        nodes = parents;
+    }
+
+    sparsearray_tree_node_release(t, t->root);
+    t->root = level[0];
+    t->count = count;
+    t->cursor = NULL;
+    free(level);
+    free(level_keys);
+    free(level_counts);
+
+    return true;
+}
+
+sparsearray_tree_leaf * sparsearray_tree_first(sparsearray_tree *t) {
+    sparsearray_tree_node *node = t->root;
+
+    while (!node->leaf) node = ((sparsearray_tree_branch *) node)->children[0];
+
+    return (sparsearray_tree_leaf *) node;
+}
+
+sparsearray_tree_leaf * sparsearray_tree_next(sparsearray_tree *t, sparsearray_tree_leaf *l) {
+    // Goes down to the leaf by its first key, then back up to the last branch
+    // with a child after the one gone through, and down its first children.
+    sparsearray_tree_branch *path[64];
+    size_t children[64];
+    size_t depth = 0;
+    sparsearray_tree_node *node = t->root;
+
+    if (l->node.size == 0) return NULL;
+
+    while (!node->leaf) {
+        sparsearray_tree_branch *b = (sparsearray_tree_branch *) node;
+        path[depth] = b;
+        children[depth] = sparsearray_tree_branch_search(b, l->keys[0]);
+        node = b->children[children[depth++]];
+    }
+
+    assert(node == (sparsearray_tree_node *) l);
+
+    while (depth > 0 && children[depth - 1] + 1 == path[depth - 1]->node.size) depth--;
+
+    if (depth == 0) return NULL;
+
+    node = path[depth - 1]->children[children[depth - 1] + 1];
+
+    while (!node->leaf) node = ((sparsearray_tree_branch *) node)->children[0];
+
+    return (sparsearray_tree_leaf *) node;
+}
+
+void sparsearray_tree_share(sparsearray_tree *t, sparsearray_tree *snapshot) {
+    sync_fetch_add(&t->root->references, 1);
+    *snapshot = *t;
+    snapshot->cursor = NULL;
+}
@@ -0,0 +1,97 @@
+/* B+-tree of blocked nodes backing sparse arrays created with sparsearray_create_tree. */
+#ifndef SPARSEARRAY_TREE_H
+#define SPARSEARRAY_TREE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "allocator.h"
+
+// Keys per leaf. The keys of a leaf fill eight cache lines, and with values
+// of up to 56 bytes a whole leaf fits in a 4 KiB page.
+#define SPARSEARRAY_TREE_LEAF_SIZE 64
+
+// Children per branch. Keys, counts and children take four cache lines each.
+#define SPARSEARRAY_TREE_BRANCH_SIZE 32
+
+typedef struct {
+    // Number of keys in a leaf, or children in a branch.
+    size_t size;
+    // Number of branches, and trees for the root, pointing to the node. Nodes
+    // pointed to more than once are shared with snapshots, and copied before
+    // they're changed.
+    volatile size_t references;
+    bool leaf;
+} sparsearray_tree_node;
+
+typedef struct {
+    sparsearray_tree_node node;
+    uint64_t keys[SPARSEARRAY_TREE_LEAF_SIZE];
+    // Values in the same order as the keys.
+    uint8_t values[];
+} sparsearray_tree_leaf;
+
+typedef struct {
+    sparsearray_tree_node node;
+    // Smallest key under each child, except the first which is only a lower
+    // bound. Searches start at the second.
+    uint64_t keys[SPARSEARRAY_TREE_BRANCH_SIZE];
+    // Number of keys under each child, for finding keys by index.
+    size_t counts[SPARSEARRAY_TREE_BRANCH_SIZE];
+    sparsearray_tree_node *children[SPARSEARRAY_TREE_BRANCH_SIZE];
+} sparsearray_tree_branch;
+
+// Keys are kept in leaves, so puts and removes only move the keys and values
+// of one leaf instead of the whole array.
+typedef struct {
+    sparsearray_tree_node *root;
+    size_t count;
+    size_t value_size;
+    // Leaf found by the last access by index and the index of its first key,
+    // so accessing keys in order by index doesn't search from the root.
+    sparsearray_tree_leaf *cursor;
+    size_t cursor_index;
+    // Where the nodes are allocated, shared with snapshots.
+    allocator *allocator;
+} sparsearray_tree;
+
+bool sparsearray_tree_create(sparsearray_tree *, allocator *, size_t);
+
+void sparsearray_tree_destroy(sparsearray_tree *);
+
+bool sparsearray_tree_clear(sparsearray_tree *);
+
+size_t sparsearray_tree_count(sparsearray_tree *);
+
+uint64_t sparsearray_tree_key(sparsearray_tree *, size_t);
+
+void * sparsearray_tree_value(sparsearray_tree *, size_t);
+
+void * sparsearray_tree_put(sparsearray_tree *, uint64_t);
+
+bool sparsearray_tree_remove(sparsearray_tree *, uint64_t);
+
+void * sparsearray_tree_get(sparsearray_tree *, uint64_t);
+
+// Index of the first key not less than the given key, or the count if every
+// key is less. Sets the leaf and offset in it where the key is, which can be
+// just past the end of the leaf, in which case it's the first key of the next.
+size_t sparsearray_tree_lower_bound(sparsearray_tree *, uint64_t, sparsearray_tree_leaf **, size_t *);
+
+// Replaces the keys and values with the given ones, which must be sorted
+// without duplicates, building the tree bottom up.
+bool sparsearray_tree_build(sparsearray_tree *, size_t, uint64_t *, uint8_t *);
+
+// First leaf, the start of the keys in order.
+sparsearray_tree_leaf * sparsearray_tree_first(sparsearray_tree *);
+
+// Leaf after the given one, or NULL after the last. Leaves aren't linked, since
+// a leaf can be shared by trees where different leaves come before it.
+sparsearray_tree_leaf * sparsearray_tree_next(sparsearray_tree *, sparsearray_tree_leaf *);
+
+// Makes the second tree a snapshot of the first, sharing all of its nodes.
+// Each tree copies the shared nodes it changes, so changes to one aren't seen
+// by the other, and they can be used from different threads. Nodes are freed
+// once neither tree needs them.
+void sparsearray_tree_share(sparsearray_tree *, sparsearray_tree *);
+
+#endif
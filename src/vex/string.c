@@ -12,6 +12,10 @@ string * string_create(size_t capacity) {
     return array_create(capacity);
 }
 
+string * string_create_in(allocator *a, size_t capacity) {
+    return array_create_in(a, capacity);
+}
+
 void string_free(string *s) {
     array_free(s);
 }
@@ -12,6 +12,8 @@ string * string_empty();
 
 string * string_create(size_t);
 
+string * string_create_in(allocator *, size_t);
+
 void string_free(string *);
 
 void string_clear(string *);
@@ -0,0 +1,14 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+#include "sync.h"
+
+void sync_yield() {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
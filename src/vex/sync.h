@@ -0,0 +1,146 @@
+/* Minimal portable atomics and spin locks for the concurrent datastructures. */
+#ifndef SYNC_H
+#define SYNC_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SYNC_MSVC
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define SYNC_PAUSE() _mm_pause()
+#else
+#define SYNC_PAUSE() do {} while (0)
+#endif
+
+// Size of a cache line, used to pad data written by different threads so
+// they don't share a line.
+#define SYNC_CACHE_LINE 64
+
+// Loads are acquire, stores are release, and read-modify-write operations
+// are sequentially consistent. MSVC is assumed to target x86 or x64, where
+// plain loads and stores already have acquire and release semantics.
+
+static inline size_t sync_load(volatile size_t *p) {
+#ifdef SYNC_MSVC
+    size_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void sync_store(volatile size_t *p, size_t v) {
+#ifdef SYNC_MSVC
+    _ReadWriteBarrier();
+    *p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline size_t sync_fetch_add(volatile size_t *p, size_t v) {
+#if defined(SYNC_MSVC) && defined(_WIN64)
+    return (size_t) _InterlockedExchangeAdd64((volatile __int64 *) p, (__int64) v);
+#elif defined(SYNC_MSVC)
+    return (size_t) _InterlockedExchangeAdd((volatile long *) p, (long) v);
+#else
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline bool sync_compare_exchange(volatile size_t *p, size_t expected, size_t desired) {
+#if defined(SYNC_MSVC) && defined(_WIN64)
+    return (size_t) _InterlockedCompareExchange64((volatile __int64 *) p, (__int64) desired, (__int64) expected) == expected;
+#elif defined(SYNC_MSVC)
+    return (size_t) _InterlockedCompareExchange((volatile long *) p, (long) desired, (long) expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void * sync_load_ptr(void * volatile *p) {
+#ifdef SYNC_MSVC
+    void *v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void sync_store_ptr(void * volatile *p, void *v) {
+#ifdef SYNC_MSVC
+    _ReadWriteBarrier();
+    *p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline void * sync_exchange_ptr(void * volatile *p, void *v) {
+#ifdef SYNC_MSVC
+    return _InterlockedExchangePointer(p, v);
+#else
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline bool sync_compare_exchange_ptr(void * volatile *p, void *expected, void *desired) {
+#ifdef SYNC_MSVC
+    return _InterlockedCompareExchangePointer(p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void sync_store_byte(volatile uint8_t *p, uint8_t v) {
+#ifdef SYNC_MSVC
+    _ReadWriteBarrier();
+    *p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline void sync_fence() {
+#ifdef SYNC_MSVC
+    volatile long barrier = 0;
+    _InterlockedOr(&barrier, 0);
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// Gives up the rest of the time slice to other threads.
+void sync_yield();
+
+// Spin lock, spinning a while before yielding to other threads.
+typedef struct {
+    volatile size_t locked;
+} sync_lock;
+
+static inline void sync_lock_create(sync_lock *l) {
+    l->locked = 0;
+}
+
+static inline void sync_lock_acquire(sync_lock *l) {
+    for (size_t spins = 0; !sync_compare_exchange(&l->locked, 0, 1); spins++) {
+        if (spins < 64) {
+            SYNC_PAUSE();
+        } else {
+            sync_yield();
+        }
+    }
+}
+
+static inline void sync_lock_release(sync_lock *l) {
+    sync_store(&l->locked, 0);
+}
+
+#endif
\ No newline at end of file
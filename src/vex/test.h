@@ -1,5 +1,10 @@
 #pragma once
 #include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 typedef char * test;
 
@@ -53,3 +58,58 @@ typedef char * test;
             printf("All tests succeed\n");                                    \
         }                                                                     \
     } while(0)
+
+/// <summary>
+/// Function and index handed to a thread started by test_threads.
+/// </summary>
+typedef struct {
+    void (*function)(size_t);
+    size_t index;
+} test_thread;
+
+#ifdef _WIN32
+static DWORD WINAPI test_thread_start(LPVOID argument) {
+    test_thread *thread = argument;
+    thread->function(thread->index);
+
+    return 0;
+}
+#else
+static void * test_thread_start(void *argument) {
+    test_thread *thread = argument;
+    thread->function(thread->index);
+
+    return NULL;
+}
+#endif
+
+/// <summary>
+/// Run the function on up to 64 threads at once, passing each its index, and
+/// wait for all of them. Used by tests and benchmarks of concurrent code.
+/// </summary>
+static inline void test_threads(size_t count, void (*function)(size_t)) {
+    test_thread arguments[64];
+
+    for (size_t i = 0; i < count; i++) {
+        arguments[i].function = function;
+        arguments[i].index = i;
+    }
+
+#ifdef _WIN32
+    HANDLE threads[64];
+
+    for (size_t i = 0; i < count; i++)
+        threads[i] = CreateThread(NULL, 0, test_thread_start, &arguments[i], 0, NULL);
+
+    WaitForMultipleObjects((DWORD) count, threads, TRUE, INFINITE);
+
+    for (size_t i = 0; i < count; i++) CloseHandle(threads[i]);
+#else
+    pthread_t threads[64];
+
+    for (size_t i = 0; i < count; i++)
+        pthread_create(&threads[i], NULL, test_thread_start, &arguments[i]);
+
+    for (size_t i = 0; i < count; i++) pthread_join(threads[i], NULL);
+#endif
+}
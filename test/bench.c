@@ -0,0 +1,1011 @@
+// Benchmarks, built as a separate executable from the same sources as the
+// tests in main.c.
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "../src/vex/debug.h"
+#include "../src/vex/test.h"
+#include "../src/vex/sync.h"
+#include "../src/vex/hashtable.h"
+#include "../src/vex/hashtable_typed.h"
+#include "../src/vex/hashtable_concurrent.h"
+#include "../src/vex/hashtable_bytes.h"
+#include "../src/vex/sparsearray.h"
+#include "../src/vex/string.h"
+#include "../src/vex/buffer_gap.h"
+#include "../src/vex/buffer_io.h"
+#include "../src/vex/buffer_ring.h"
+#include "../src/vex/buffer_segmented.h"
+#include "../src/vex/queue_typed.h"
+
+/// <summary>
+/// Time the statement, printing the nanoseconds spent per operation.
+/// </summary>
+#define bench_run(title, operations, statement) do {                          \
+        clock_t bench_start = clock();                                        \
+        statement;                                                            \
+        double bench_ns = (double) (clock() - bench_start) * 1e9 /            \
+            CLOCKS_PER_SEC / (double) (operations);                           \
+        printf("%-46s %8.2f ns/op\n", title, bench_ns);                       \
+    } while(0)
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static size_t bench_cores(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t cores = info.dwNumberOfProcessors;
+#else
+    size_t cores = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return cores < 1 ? 1 : cores > 64 ? 64 : cores;
+}
+
+// Sink for results, so benchmarked lookups aren't optimized away.
+static volatile uint64_t bench_sink;
+
+static uint64_t bench_random(uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ULL;
+}
+
+uint64_t bench_hash_uint64_ptr(uint64_t *k) {
+    return *k;
+}
+
+bool bench_equals_uint64_ptr(uint64_t *a, uint64_t *b) {
+    return *a == *b;
+}
+
+uint64_t bench_hash_uint64(uint64_t k) {
+    return k;
+}
+
+bool bench_equals_uint64(uint64_t a, uint64_t b) {
+    return a == b;
+}
+
+uint64_t bench_hash_char_ptr(char *c) {
+    return *c;
+}
+
+bool bench_equals_char_ptr(char *a, char *b) {
+    return *a == *b;
+}
+
+uint64_t bench_hash_char(char c) {
+    return c;
+}
+
+bool bench_equals_char(char a, char b) {
+    return a == b;
+}
+
+HASHTABLE_REGISTER_TYPE(bench_u64, uint64_t, uint64_t, bench_hash_uint64, bench_equals_uint64)
+
+HASHTABLE_REGISTER_TYPE(bench_ci, char, uint64_t, bench_hash_char, bench_equals_char)
+
+#define BENCH_KEYS 1000000
+#define BENCH_CHAR_LOOKUPS 10000000
+
+void hashtable_generic_bench(uint64_t *keys) {
+    hashtable h;
+    hashtable_create(&h, 0, 0, 0);
+
+    bench_run("hashtable_put (uint64 -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            hashtable_put(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], sizeof(uint64_t), &keys[i], sizeof(uint64_t));
+        });
+
+    bench_run("hashtable_get (uint64 -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], sizeof(uint64_t), sizeof(uint64_t));
+            bench_sink += *v;
+        });
+
+    uint64_t **values = malloc(BENCH_KEYS * sizeof(uint64_t *));
+
+    bench_run("hashtable_get_many (uint64 -> uint64)", BENCH_KEYS,
+        hashtable_get_many(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, BENCH_KEYS, keys, sizeof(uint64_t), sizeof(uint64_t), (void **) values));
+
+    free(values);
+    hashtable_destroy(&h);
+    hashtable_create(&h, 0, 0, 0);
+
+    bench_run("hashtable_put_many (uint64 -> uint64)", BENCH_KEYS,
+        hashtable_put_many(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, BENCH_KEYS, keys, sizeof(uint64_t), keys, sizeof(uint64_t)));
+
+    hashtable_destroy(&h);
+    hashtable_create(&h, 0, 0, 0);
+
+    bench_run("hashtable_get (char -> uint64)", BENCH_CHAR_LOOKUPS,
+        for (char c = 0; c < 127; c++) {
+            uint64_t v = c;
+            hashtable_put(&h, (uint64_t (*)(void *)) bench_hash_char_ptr, (bool (*)(void *, void *)) bench_equals_char_ptr, &c, sizeof(char), &v, sizeof(uint64_t));
+        }
+
+        for (size_t i = 0; i < BENCH_CHAR_LOOKUPS; i++) {
+            char c = (char) (i % 127);
+            uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) bench_hash_char_ptr, (bool (*)(void *, void *)) bench_equals_char_ptr, &c, sizeof(char), sizeof(uint64_t));
+            bench_sink += *v;
+        });
+
+    hashtable_destroy(&h);
+}
+
+void hashtable_typed_bench(uint64_t *keys) {
+    hashtable_bench_u64 h;
+    hashtable_create_bench_u64(&h, 0);
+
+    bench_run("hashtable_put_<type> (uint64 -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            hashtable_put_bench_u64(&h, keys[i], keys[i]);
+        });
+
+    bench_run("hashtable_get_<type> (uint64 -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            bench_sink += *hashtable_get_bench_u64(&h, keys[i]);
+        });
+
+    uint64_t **values = malloc(BENCH_KEYS * sizeof(uint64_t *));
+
+    bench_run("hashtable_get_many_<type> (uint64 -> uint64)", BENCH_KEYS,
+        hashtable_get_many_bench_u64(&h, BENCH_KEYS, keys, values));
+
+    free(values);
+    hashtable_destroy_bench_u64(&h);
+    hashtable_create_bench_u64(&h, 0);
+
+    bench_run("hashtable_put_many_<type> (uint64 -> uint64)", BENCH_KEYS,
+        hashtable_put_many_bench_u64(&h, BENCH_KEYS, keys, keys));
+
+    hashtable_destroy_bench_u64(&h);
+
+    hashtable_bench_ci hc;
+    hashtable_create_bench_ci(&hc, 0);
+
+    bench_run("hashtable_get_<type> (char -> uint64)", BENCH_CHAR_LOOKUPS,
+        for (char c = 0; c < 127; c++) {
+            hashtable_put_bench_ci(&hc, c, c);
+        }
+
+        for (size_t i = 0; i < BENCH_CHAR_LOOKUPS; i++) {
+            bench_sink += *hashtable_get_bench_ci(&hc, (char) (i % 127));
+        });
+
+    hashtable_destroy_bench_ci(&hc);
+}
+
+void hashtable_latency_bench(uint64_t *keys, bool incremental) {
+    // Worst time spent on a single put, which is where a rehash stalls.
+    hashtable_bench_u64 h;
+    hashtable_create_bench_u64(&h, 0);
+    hashtable_rehash_incremental_bench_u64(&h, incremental);
+    uint64_t worst_ns = 0;
+
+    for (size_t i = 0; i < BENCH_KEYS; i++) {
+        uint64_t start = bench_now_ns();
+        hashtable_put_bench_u64(&h, keys[i], keys[i]);
+        uint64_t ns = bench_now_ns() - start;
+
+        if (ns > worst_ns) worst_ns = ns;
+    }
+
+    printf("%-46s %8.2f us\n",
+        incremental
+            ? "hashtable_put_<type> worst, incremental"
+            : "hashtable_put_<type> worst",
+        (double) worst_ns / 1000.0);
+    hashtable_destroy_bench_u64(&h);
+}
+
+uint64_t bench_hash_string_ptr(char **s) {
+    return hashtable_bytes_hash(*s, strlen(*s));
+}
+
+bool bench_equals_string_ptr(char **a, char **b) {
+    return strcmp(*a, *b) == 0;
+}
+
+void hashtable_bytes_bench(uint64_t *keys) {
+    // String keys stored as pointers to separately allocated strings, against
+    // the same keys copied into the table.
+    char **strings = malloc(BENCH_KEYS * sizeof(char *));
+    size_t *sizes = malloc(BENCH_KEYS * sizeof(size_t));
+
+    for (size_t i = 0; i < BENCH_KEYS; i++) {
+        strings[i] = malloc(32);
+        sizes[i] = sprintf(strings[i], "key %llu", (unsigned long long) keys[i]);
+    }
+
+    hashtable h;
+    hashtable_create(&h, 0, 0, 0);
+
+    for (size_t i = 0; i < BENCH_KEYS; i++)
+        hashtable_put(&h, (uint64_t (*)(void *)) bench_hash_string_ptr, (bool (*)(void *, void *)) bench_equals_string_ptr, &strings[i], sizeof(char *), &keys[i], sizeof(uint64_t));
+
+    bench_run("hashtable_get (char * -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) bench_hash_string_ptr, (bool (*)(void *, void *)) bench_equals_string_ptr, &strings[i], sizeof(char *), sizeof(uint64_t));
+            bench_sink += *v;
+        });
+
+    hashtable_destroy(&h);
+    hashtable_bytes b;
+    hashtable_bytes_create(&b, 0, sizeof(uint64_t));
+
+    bench_run("hashtable_bytes_put (bytes -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            hashtable_bytes_put(&b, strings[i], sizes[i], &keys[i]);
+        });
+
+    bench_run("hashtable_bytes_get (bytes -> uint64)", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            uint64_t *v = hashtable_bytes_get(&b, strings[i], sizes[i]);
+            bench_sink += *v;
+        });
+
+    hashtable_bytes_destroy(&b);
+
+    for (size_t i = 0; i < BENCH_KEYS; i++) free(strings[i]);
+
+    free(strings);
+    free(sizes);
+}
+
+void hashtable_snapshot_bench(uint64_t *keys) {
+    // Opening a saved hashtable, against building it again from the keys.
+    const char *path = "hashtable_snapshot_bench.bin";
+    hashtable h;
+    hashtable_create(&h, 0, 0, 0);
+    uint64_t start = bench_now_ns();
+
+    for (size_t i = 0; i < BENCH_KEYS; i++)
+        hashtable_put(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], sizeof(uint64_t), &keys[i], sizeof(uint64_t));
+
+    printf("%-46s %8.2f ms\n", "hashtable build", (bench_now_ns() - start) / 1e6);
+    FILE *file = fopen(path, "wb");
+    hashtable_save(&h, fileno(file));
+    fclose(file);
+    hashtable_destroy(&h);
+
+    snapshot snap;
+    start = bench_now_ns();
+    hashtable_open_mapped(&h, &snap, path);
+
+    for (size_t i = 0; i < 1000; i++) {
+        uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], sizeof(uint64_t), sizeof(uint64_t));
+        bench_sink += *v;
+    }
+
+    printf("%-46s %8.2f ms\n", "hashtable_open_mapped + 1000 gets", (bench_now_ns() - start) / 1e6);
+    snapshot_close(&snap);
+    remove(path);
+}
+
+#define BENCH_THREAD_OPERATIONS 1000000
+
+// Keys looked up by the threaded benchmarks, every 20th operation is a put.
+static uint64_t *bench_thread_keys;
+static hashtable_concurrent bench_concurrent;
+static hashtable bench_locked;
+static sync_lock bench_locked_lock;
+
+void hashtable_concurrent_bench_thread(size_t index) {
+    hashtable_concurrent_thread *t = hashtable_concurrent_register(&bench_concurrent);
+    uint64_t v;
+
+    for (size_t i = 0; i < BENCH_THREAD_OPERATIONS; i++) {
+        uint64_t *k = &bench_thread_keys[(i * 7919 + index * 104729) % BENCH_KEYS];
+
+        if (i % 20 == 0) {
+            hashtable_concurrent_put(&bench_concurrent, t, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, k, k);
+        } else if (hashtable_concurrent_get(&bench_concurrent, t, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, k, &v)) {
+            bench_sink += v;
+        }
+    }
+}
+
+void hashtable_locked_bench_thread(size_t index) {
+    for (size_t i = 0; i < BENCH_THREAD_OPERATIONS; i++) {
+        uint64_t *k = &bench_thread_keys[(i * 7919 + index * 104729) % BENCH_KEYS];
+        sync_lock_acquire(&bench_locked_lock);
+
+        if (i % 20 == 0) {
+            hashtable_put(&bench_locked, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, k, sizeof(uint64_t), k, sizeof(uint64_t));
+        } else {
+            uint64_t *v = hashtable_get(&bench_locked, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, k, sizeof(uint64_t), sizeof(uint64_t));
+
+            if (v != NULL) bench_sink += *v;
+        }
+
+        sync_lock_release(&bench_locked_lock);
+    }
+}
+
+void hashtable_concurrent_bench(uint64_t *keys) {
+    // Throughput of a read mostly workload as threads are added, compared to
+    // a hashtable behind one lock.
+    bench_thread_keys = keys;
+    hashtable_concurrent_create(&bench_concurrent, BENCH_KEYS, sizeof(uint64_t), sizeof(uint64_t));
+    hashtable_create(&bench_locked, BENCH_KEYS, 0, 0);
+    sync_lock_create(&bench_locked_lock);
+    hashtable_concurrent_thread *t = hashtable_concurrent_register(&bench_concurrent);
+
+    for (size_t i = 0; i < BENCH_KEYS; i += 2) {
+        hashtable_concurrent_put(&bench_concurrent, t, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], &keys[i]);
+        hashtable_put(&bench_locked, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, &keys[i], sizeof(uint64_t), &keys[i], sizeof(uint64_t));
+    }
+
+    for (size_t threads = 1, cores = bench_cores(); threads <= cores; threads *= 2) {
+        uint64_t start = bench_now_ns();
+        test_threads(threads, hashtable_concurrent_bench_thread);
+        double concurrent_mops = threads * BENCH_THREAD_OPERATIONS * 1000.0 / (double) (bench_now_ns() - start);
+
+        start = bench_now_ns();
+        test_threads(threads, hashtable_locked_bench_thread);
+        double locked_mops = threads * BENCH_THREAD_OPERATIONS * 1000.0 / (double) (bench_now_ns() - start);
+
+        printf("hashtable_concurrent %2zu threads %8.2f Mops/s, locked hashtable %8.2f Mops/s\n",
+            threads, concurrent_mops, locked_mops);
+    }
+
+    hashtable_concurrent_destroy(&bench_concurrent);
+    hashtable_destroy(&bench_locked);
+}
+
+#define BENCH_QUEUE_ELEMENTS 1000000
+#define BENCH_QUEUE_BATCH 64
+#define BENCH_QUEUE_ROUNDS 100000
+
+QUEUE_REGISTER_TYPE(u64, uint64_t)
+
+static queue_spsc_u64 bench_spsc;
+static queue_spsc_u64 bench_spsc_back;
+static queue_mpmc_u64 bench_mpmc;
+static buffer_ring bench_ring;
+static sync_lock bench_ring_lock;
+static size_t bench_queue_threads;
+
+static void bench_queue_wait(size_t *spins) {
+    // Spins a while on a full or empty queue before letting the other side run.
+    if (++*spins < 64) {
+        SYNC_PAUSE();
+    } else {
+        sync_yield();
+        *spins = 0;
+    }
+}
+
+void queue_spsc_bench_thread(size_t index) {
+    size_t spins = 0;
+    uint64_t v;
+
+    for (uint64_t i = 0; i < BENCH_QUEUE_ELEMENTS; i++) {
+        if (index == 0) {
+            while (!queue_spsc_push_u64(&bench_spsc, i)) bench_queue_wait(&spins);
+        } else {
+            while (!queue_spsc_pop_u64(&bench_spsc, &v)) bench_queue_wait(&spins);
+
+            bench_sink += v;
+        }
+    }
+}
+
+void queue_spsc_batch_bench_thread(size_t index) {
+    size_t spins = 0;
+    uint64_t values[BENCH_QUEUE_BATCH];
+
+    for (size_t i = 0; i < BENCH_QUEUE_BATCH; i++) values[i] = i;
+
+    for (size_t done = 0; done < BENCH_QUEUE_ELEMENTS;) {
+        size_t count = index == 0
+            ? queue_spsc_push_batch_u64(&bench_spsc, values, BENCH_QUEUE_BATCH)
+            : queue_spsc_pop_batch_u64(&bench_spsc, values, BENCH_QUEUE_BATCH);
+
+        if (count == 0) bench_queue_wait(&spins);
+
+        done += count;
+    }
+
+    bench_sink += values[0];
+}
+
+void queue_locked_bench_thread(size_t index) {
+    // The queue behind a lock the typed queues replace.
+    size_t spins = 0;
+
+    for (uint64_t i = 0; i < BENCH_QUEUE_ELEMENTS;) {
+        uint64_t v = i;
+        sync_lock_acquire(&bench_ring_lock);
+        bool done = index == 0 ? buffer_ring_push(&bench_ring, &v, sizeof(uint64_t)) : buffer_ring_pop_front(&bench_ring, &v, sizeof(uint64_t));
+        sync_lock_release(&bench_ring_lock);
+
+        if (done) {
+            bench_sink += v;
+            i++;
+        } else {
+            bench_queue_wait(&spins);
+        }
+    }
+}
+
+void queue_mpmc_bench_thread(size_t index) {
+    // Half the threads push and half pop.
+    size_t spins = 0;
+    size_t count = BENCH_QUEUE_ELEMENTS / (bench_queue_threads / 2);
+    uint64_t v;
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (index % 2 == 0) {
+            while (!queue_mpmc_push_u64(&bench_mpmc, i)) bench_queue_wait(&spins);
+        } else {
+            while (!queue_mpmc_pop_u64(&bench_mpmc, &v)) bench_queue_wait(&spins);
+
+            bench_sink += v;
+        }
+    }
+}
+
+void queue_latency_bench_thread(size_t index) {
+    // Passes one value back and forth, so each handoff waits for the last.
+    size_t spins = 0;
+    uint64_t v = 0;
+
+    for (size_t i = 0; i < BENCH_QUEUE_ROUNDS; i++) {
+        if (index == 0) {
+            queue_spsc_push_u64(&bench_spsc, v);
+
+            while (!queue_spsc_pop_u64(&bench_spsc_back, &v)) bench_queue_wait(&spins);
+        } else {
+            while (!queue_spsc_pop_u64(&bench_spsc, &v)) bench_queue_wait(&spins);
+
+            queue_spsc_push_u64(&bench_spsc_back, v + 1);
+        }
+    }
+}
+
+static double bench_queue_run(size_t threads, void (*function)(size_t)) {
+    // Returns millions of elements passed per second.
+    bench_queue_threads = threads;
+    uint64_t start = bench_now_ns();
+    test_threads(threads, function);
+
+    return BENCH_QUEUE_ELEMENTS * 1000.0 / (double) (bench_now_ns() - start);
+}
+
+void queue_bench(void) {
+    // Elements passed from one thread to another, then between more threads.
+    queue_spsc_create_u64(&bench_spsc, 1024);
+    queue_spsc_create_u64(&bench_spsc_back, 1024);
+    queue_mpmc_create_u64(&bench_mpmc, 1024);
+    buffer_ring_create(&bench_ring, 1024 * sizeof(uint64_t));
+    sync_lock_create(&bench_ring_lock);
+
+    printf("queue_spsc %8.2f Mops/s, batches of %d %8.2f Mops/s, locked ring %8.2f Mops/s\n",
+        bench_queue_run(2, queue_spsc_bench_thread), BENCH_QUEUE_BATCH,
+        bench_queue_run(2, queue_spsc_batch_bench_thread), bench_queue_run(2, queue_locked_bench_thread));
+
+    for (size_t threads = 2, cores = bench_cores(); threads <= (cores < 2 ? 2 : cores); threads *= 2) {
+        printf("queue_mpmc %2zu threads %8.2f Mops/s\n", threads, bench_queue_run(threads, queue_mpmc_bench_thread));
+    }
+
+    uint64_t start = bench_now_ns();
+    test_threads(2, queue_latency_bench_thread);
+    printf("%-46s %8.2f ns/op\n", "queue_spsc handoff latency", (bench_now_ns() - start) / (2.0 * BENCH_QUEUE_ROUNDS));
+
+    queue_spsc_destroy_u64(&bench_spsc);
+    queue_spsc_destroy_u64(&bench_spsc_back);
+    queue_mpmc_destroy_u64(&bench_mpmc);
+    buffer_ring_destroy(&bench_ring);
+}
+
+#define BENCH_SPARSE_KEYS 100000
+
+void sparsearray_bench(uint64_t *keys, bool tree) {
+    // Random keys, where every put into the flat layout moves the keys after it.
+    sparsearray s;
+    const char *layout = tree ? "tree" : "flat";
+    char title[64];
+
+    if (tree) {
+        sparsearray_create_tree(&s, sizeof(uint64_t));
+    } else {
+        sparsearray_create(&s, 0, 0);
+    }
+
+    sprintf(title, "sparsearray_put random (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+            *(uint64_t *) sparsearray_put(&s, keys[i], sizeof(uint64_t)) = keys[i];
+        });
+
+    sprintf(title, "sparsearray_get random (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+            bench_sink += *(uint64_t *) sparsearray_get(&s, keys[i], sizeof(uint64_t));
+        });
+
+    if (!tree) {
+        sparsearray_build_index(&s);
+        bench_run("sparsearray_get random (flat, indexed)", BENCH_SPARSE_KEYS,
+            for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+                bench_sink += *(uint64_t *) sparsearray_get(&s, keys[i], sizeof(uint64_t));
+            });
+
+        sparsearray_pack(&s);
+        bench_run("sparsearray_get random (flat, packed)", BENCH_SPARSE_KEYS,
+            for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+                bench_sink += *(uint64_t *) sparsearray_get(&s, keys[i], sizeof(uint64_t));
+            });
+
+        bench_run("sparsearray_key in order (flat, packed)", BENCH_SPARSE_KEYS,
+            for (size_t i = 0, l = sparsearray_count(&s); i < l; i++) {
+                bench_sink += sparsearray_key(&s, i);
+            });
+
+        sparsearray_unpack(&s);
+    }
+
+    sprintf(title, "sparsearray_key + value in order (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        for (size_t i = 0, l = sparsearray_count(&s); i < l; i++) {
+            bench_sink += sparsearray_key(&s, i) + *(uint64_t *) sparsearray_value(&s, i, sizeof(uint64_t));
+        });
+
+    sprintf(title, "sparsearray_iterate_range all (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        sparsearray_range_iterator it = sparsearray_iterate_range(&s, 0, UINT64_MAX);
+
+        while (sparsearray_iterate_range_next(&it)) {
+            bench_sink += sparsearray_iterate_range_key(&it) + *(uint64_t *) sparsearray_iterate_range_value(&it, sizeof(uint64_t));
+        });
+
+    sprintf(title, "sparsearray_remove random (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+            sparsearray_remove(&s, keys[i], sizeof(uint64_t));
+        });
+
+    sparsearray_destroy(&s);
+}
+
+void sparsearray_dense_bench(uint64_t *keys) {
+    // Nine in ten keys of a range, which flat sparse arrays index directly.
+    sparsearray s;
+    sparsearray_create(&s, 0, 0);
+
+    for (uint64_t key = 0; key < BENCH_SPARSE_KEYS; key++) {
+        if (key % 10 != 0) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key;
+    }
+
+    bench_run("sparsearray_get random (flat, dense)", BENCH_SPARSE_KEYS,
+        for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+            uint64_t *value = sparsearray_get(&s, keys[i] % BENCH_SPARSE_KEYS, sizeof(uint64_t));
+            bench_sink += value == NULL ? 0 : *value;
+        });
+
+    bench_run("sparsearray_key + value in order (flat, dense)", BENCH_SPARSE_KEYS,
+        for (size_t i = 0, l = sparsearray_count(&s); i < l; i++) {
+            bench_sink += sparsearray_key(&s, i) + *(uint64_t *) sparsearray_value(&s, i, sizeof(uint64_t));
+        });
+
+    sparsearray_destroy(&s);
+}
+
+void sparsearray_bulk_bench(uint64_t *keys, bool tree) {
+    // The same random keys as sparsearray_bench, put at once.
+    sparsearray s;
+    const char *layout = tree ? "tree" : "flat";
+    char title[64];
+
+    if (tree) {
+        sparsearray_create_tree(&s, sizeof(uint64_t));
+    } else {
+        sparsearray_create(&s, 0, 0);
+    }
+
+    sprintf(title, "sparsearray_put_sorted random (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        sparsearray_put_sorted(&s, BENCH_SPARSE_KEYS, keys, keys, sizeof(uint64_t), SPARSEARRAY_KEEP_LAST));
+
+    sprintf(title, "sparsearray_put_sorted again (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        sparsearray_put_sorted(&s, BENCH_SPARSE_KEYS, keys, keys, sizeof(uint64_t), SPARSEARRAY_KEEP_LAST));
+
+    sparsearray_destroy(&s);
+}
+
+void sparsearray_snapshot_bench(uint64_t *keys, bool tree) {
+    // Taking snapshots of a sparse array being put into, where trees share
+    // their nodes and flat arrays are copied.
+    sparsearray s;
+    sparsearray snapshot;
+    const char *layout = tree ? "tree" : "flat";
+    char title[64];
+
+    if (tree) {
+        sparsearray_create_tree(&s, sizeof(uint64_t));
+    } else {
+        sparsearray_create(&s, 0, 0);
+    }
+
+    for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) *(uint64_t *) sparsearray_put(&s, keys[i], sizeof(uint64_t)) = keys[i];
+
+    sprintf(title, "sparsearray_snapshot + destroy (%s)", layout);
+    bench_run(title, 1000,
+        for (size_t i = 0; i < 1000; i++) {
+            sparsearray_snapshot(&s, &snapshot);
+            sparsearray_destroy(&snapshot);
+        });
+
+    // The first put after a snapshot copies the nodes on its path.
+    sprintf(title, "sparsearray_put with a snapshot per 100 (%s)", layout);
+    bench_run(title, BENCH_SPARSE_KEYS,
+        for (size_t i = 0; i < BENCH_SPARSE_KEYS; i++) {
+            if (i % 100 == 0) sparsearray_snapshot(&s, &snapshot);
+
+            *(uint64_t *) sparsearray_put(&s, keys[i], sizeof(uint64_t)) = i;
+
+            if (i % 100 == 99) sparsearray_destroy(&snapshot);
+        });
+
+    sparsearray_destroy(&s);
+}
+
+void buffer_small_bench(uint64_t *keys) {
+    // Short lived buffers holding a key or two, kept in the buffer itself.
+    bench_run("buffer_create + 2 pushes + destroy", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            buffer b;
+            buffer_create(&b, sizeof(uint64_t));
+            *(uint64_t *) buffer_push(&b, sizeof(uint64_t)) = keys[i];
+            *(uint64_t *) buffer_push(&b, sizeof(uint64_t)) = keys[i] + 1;
+            bench_sink += *(uint64_t *) buffer_get(&b, sizeof(uint64_t));
+            buffer_destroy(&b);
+        });
+}
+
+#define BENCH_LARGE_SIZE (256 * 1024 * 1024)
+
+void buffer_large_bench(allocator *a, const char *title) {
+    // Growing a buffer to a large size a megabyte at a time.
+    buffer b;
+    size_t step = 1024 * 1024;
+    uint64_t start = bench_now_ns();
+    buffer_create_in(&b, a, step);
+    buffer_advise(&b, ALLOCATOR_ADVISE_SEQUENTIAL);
+
+    for (size_t size = 0; size < BENCH_LARGE_SIZE; size += step) memset(buffer_push(&b, step), 1, step);
+
+    printf("%-46s %8.2f ms\n", title, (bench_now_ns() - start) / 1e6);
+    buffer_destroy(&b);
+}
+
+#define BENCH_FILE_SIZE (64 * 1024 * 1024)
+
+void buffer_map_file_bench(void) {
+    // Summing a file read into a buffer, which copies every byte, and in a
+    // buffer mapping the file.
+    const char *path = "bench_map_file.bin";
+    FILE *file = fopen(path, "wb");
+    buffer b;
+    buffer_create(&b, 1024 * 1024);
+    memset(buffer_push(&b, 1024 * 1024), 1, 1024 * 1024);
+
+    for (size_t i = 0; i < BENCH_FILE_SIZE / (1024 * 1024); i++) fwrite(b.data, 1, 1024 * 1024, file);
+
+    fclose(file);
+    buffer_clear(&b);
+
+    uint64_t start = bench_now_ns();
+    file = fopen(path, "rb");
+
+    size_t read;
+
+    do {
+        read = fread(buffer_push(&b, 1024 * 1024), 1, 1024 * 1024, file);
+        buffer_pop(&b, 1024 * 1024 - read);
+    } while (read > 0);
+
+    fclose(file);
+
+    for (size_t i = 0; i < buffer_size(&b); i += sizeof(uint64_t)) bench_sink += *(uint64_t *) buffer_get(&b, i);
+
+    printf("%-46s %8.2f ms\n", "fread into buffer + sum 64 MiB", (bench_now_ns() - start) / 1e6);
+    buffer_destroy(&b);
+
+    start = bench_now_ns();
+    buffer_map_file(&b, path, BUFFER_MAP_READ);
+
+    for (size_t i = 0; i < buffer_size(&b); i += sizeof(uint64_t)) bench_sink += *(uint64_t *) buffer_get(&b, i);
+
+    printf("%-46s %8.2f ms\n", "buffer_map_file + sum 64 MiB", (bench_now_ns() - start) / 1e6);
+    buffer_destroy(&b);
+    remove(path);
+}
+
+#define BENCH_IO_BLOCKS 16384
+#define BENCH_IO_BLOCK_SIZE 4096
+#define BENCH_IO_BATCH 64
+
+void buffer_io_bench(void) {
+    // Writing and reading 64 MiB in blocks of 4 KiB, a call per block against
+    // calls covering many blocks.
+    const char *path = "bench_io.bin";
+    buffer *blocks = malloc(BENCH_IO_BLOCKS * sizeof(buffer));
+    buffer b;
+    buffer_create(&b, 0);
+
+    for (size_t i = 0; i < BENCH_IO_BLOCKS; i++) {
+        buffer_create(&blocks[i], BENCH_IO_BLOCK_SIZE);
+        memset(buffer_push(&blocks[i], BENCH_IO_BLOCK_SIZE), (int) i, BENCH_IO_BLOCK_SIZE);
+    }
+
+    FILE *file = fopen(path, "wb");
+    uint64_t start = bench_now_ns();
+
+    for (size_t i = 0; i < BENCH_IO_BLOCKS; i++) buffer_write_fd(&blocks[i], fileno(file));
+
+    printf("%-46s %8.2f ms\n", "buffer_write_fd 64 MiB in 4 KiB blocks", (bench_now_ns() - start) / 1e6);
+    fclose(file);
+
+    file = fopen(path, "wb");
+    start = bench_now_ns();
+    buffer_write_fd_many(blocks, BENCH_IO_BLOCKS, fileno(file));
+    printf("%-46s %8.2f ms\n", "buffer_write_fd_many 64 MiB in 4 KiB blocks", (bench_now_ns() - start) / 1e6);
+    fclose(file);
+
+    file = fopen(path, "rb");
+    start = bench_now_ns();
+
+    size_t read;
+
+    do {
+        read = fread(buffer_push(&b, BENCH_IO_BLOCK_SIZE), 1, BENCH_IO_BLOCK_SIZE, file);
+        buffer_pop(&b, BENCH_IO_BLOCK_SIZE - read);
+    } while (read > 0);
+
+    printf("%-46s %8.2f ms\n", "fread 64 MiB in 4 KiB blocks", (bench_now_ns() - start) / 1e6);
+    fclose(file);
+    buffer_clear(&b);
+
+    file = fopen(path, "rb");
+    start = bench_now_ns();
+    buffer_read_fd(&b, fileno(file));
+    printf("%-46s %8.2f ms\n", "buffer_read_fd 64 MiB", (bench_now_ns() - start) / 1e6);
+    fclose(file);
+
+    // Blocks read at offsets, submitted in batches.
+    buffer_io io;
+    buffer_io_request requests[BENCH_IO_BATCH];
+    buffer_io_create(&io, BENCH_IO_BATCH);
+    file = fopen(path, "rb");
+    start = bench_now_ns();
+
+    for (size_t i = 0; i < BENCH_IO_BLOCKS; i += BENCH_IO_BATCH) {
+        for (size_t j = 0; j < BENCH_IO_BATCH; j++) {
+            buffer_clear(&blocks[i + j]);
+            requests[j].callback = NULL;
+            buffer_io_read(&io, &requests[j], &blocks[i + j], fileno(file), (uint64_t) (i + j) * BENCH_IO_BLOCK_SIZE, BENCH_IO_BLOCK_SIZE);
+        }
+
+        buffer_io_submit(&io);
+
+        while (buffer_io_pending(&io) > 0) buffer_io_poll(&io, true);
+    }
+
+#ifdef BUFFER_IO_URING
+    printf("%-46s %8.2f ms\n", "buffer_io 64 MiB in 4 KiB reads (io_uring)", (bench_now_ns() - start) / 1e6);
+#else
+    printf("%-46s %8.2f ms\n", "buffer_io 64 MiB in 4 KiB reads (pread)", (bench_now_ns() - start) / 1e6);
+#endif
+    fclose(file);
+    buffer_io_destroy(&io);
+
+    for (size_t i = 0; i < BENCH_IO_BLOCKS; i++) buffer_destroy(&blocks[i]);
+
+    free(blocks);
+    buffer_destroy(&b);
+    remove(path);
+}
+
+#define BENCH_GAP_INSERTS 100000
+
+void buffer_gap_bench(uint64_t *keys) {
+    // Inserting at the front, where a buffer moves everything after it.
+    buffer b;
+    buffer_gap g;
+    buffer_create(&b, 0);
+    buffer_gap_create(&g, 0);
+
+    bench_run("buffer_add at front", BENCH_GAP_INSERTS,
+        for (size_t i = 0; i < BENCH_GAP_INSERTS; i++) *(uint64_t *) buffer_add(&b, 0, sizeof(uint64_t)) = keys[i]);
+
+    bench_run("buffer_gap_add at front", BENCH_GAP_INSERTS,
+        for (size_t i = 0; i < BENCH_GAP_INSERTS; i++) *(uint64_t *) buffer_gap_add(&g, 0, sizeof(uint64_t)) = keys[i]);
+
+    // Edits around a cursor moving forward through the data.
+    bench_run("buffer_gap_add + remove near a cursor", BENCH_GAP_INSERTS,
+        for (size_t i = 0; i < BENCH_GAP_INSERTS; i++) {
+            size_t cursor = (i % (BENCH_GAP_INSERTS / 2)) * sizeof(uint64_t);
+            *(uint64_t *) buffer_gap_add(&g, cursor, sizeof(uint64_t)) = keys[i];
+            buffer_gap_remove(&g, cursor + sizeof(uint64_t), sizeof(uint64_t));
+        });
+
+    bench_sink += *(uint64_t *) buffer_gap_view(&g);
+    buffer_destroy(&b);
+    buffer_gap_destroy(&g);
+}
+
+void buffer_segmented_bench(uint64_t *keys) {
+    // Growing one element at a time, where a buffer moves its data as it
+    // reallocates and a segmented buffer only allocates.
+    buffer b;
+    buffer_segmented s;
+    buffer_create(&b, 0);
+    buffer_segmented_create(&s, sizeof(uint64_t), 0);
+
+    bench_run("buffer_push", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) *(uint64_t *) buffer_push(&b, sizeof(uint64_t)) = keys[i]);
+
+    bench_run("buffer_segmented_push", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) *(uint64_t *) buffer_segmented_push(&s) = keys[i]);
+
+    bench_run("buffer_get random", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) bench_sink += *(uint64_t *) buffer_get(&b, (keys[i] % BENCH_KEYS) * sizeof(uint64_t)));
+
+    bench_run("buffer_segmented_get random", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) bench_sink += *(uint64_t *) buffer_segmented_get(&s, keys[i] % BENCH_KEYS));
+
+    buffer_destroy(&b);
+    buffer_segmented_destroy(&s);
+}
+
+#define BENCH_QUEUE_SIZE 1000
+
+void buffer_ring_bench(uint64_t *keys) {
+    // A queue of a thousand values, taking from the front and adding to the
+    // back, where a buffer moves all the values each time.
+    buffer b;
+    buffer_ring r;
+    buffer_create(&b, 0);
+    buffer_ring_create(&r, 0);
+
+    for (size_t i = 0; i < BENCH_QUEUE_SIZE; i++) {
+        *(uint64_t *) buffer_push(&b, sizeof(uint64_t)) = keys[i];
+        buffer_ring_push(&r, &keys[i], sizeof(uint64_t));
+    }
+
+    bench_run("buffer_remove at front + buffer_push", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            bench_sink += *(uint64_t *) buffer_get(&b, 0);
+            buffer_remove(&b, 0, sizeof(uint64_t));
+            *(uint64_t *) buffer_push(&b, sizeof(uint64_t)) = keys[i];
+        });
+
+    bench_run("buffer_ring_pop_front + buffer_ring_push", BENCH_KEYS,
+        for (size_t i = 0; i < BENCH_KEYS; i++) {
+            uint64_t v;
+            buffer_ring_pop_front(&r, &v, sizeof(uint64_t));
+            bench_sink += v;
+            buffer_ring_push(&r, &keys[i], sizeof(uint64_t));
+        });
+
+    buffer_destroy(&b);
+    buffer_ring_destroy(&r);
+}
+
+#define BENCH_REQUESTS 100000
+
+static void bench_request(allocator *a, uint64_t *keys, size_t request) {
+    // A request making a small hashtable, buffers and strings, freed at the end.
+    hashtable h;
+    buffer buffers[16];
+    string *strings[4];
+    hashtable_create_in(&h, a, 16, 0, 0);
+
+    for (size_t i = 0; i < 16; i++) {
+        uint64_t *k = &keys[(request * 16 + i) % BENCH_KEYS];
+        hashtable_put(&h, (uint64_t (*)(void *)) bench_hash_uint64_ptr, (bool (*)(void *, void *)) bench_equals_uint64_ptr, k, sizeof(uint64_t), k, sizeof(uint64_t));
+        buffer_create_in(&buffers[i], a, 16);
+        *(uint64_t *) buffer_push(&buffers[i], sizeof(uint64_t)) = *k;
+    }
+
+    for (size_t i = 0; i < 4; i++) strings[i] = string_append_chars(string_create_in(a, 8), 20, (uint8_t *) "a short request name");
+
+    bench_sink += hashtable_count(&h) + string_size(strings[0]);
+
+    for (size_t i = 0; i < 4; i++) string_free(strings[i]);
+
+    for (size_t i = 0; i < 16; i++) buffer_destroy(&buffers[i]);
+
+    hashtable_destroy(&h);
+}
+
+void allocator_bench(uint64_t *keys) {
+    allocator_arena arena;
+    allocator_cache cache;
+    allocator_arena_create(&arena, 64 * 1024);
+    allocator_cache_create(&cache);
+
+    bench_run("request (heap)", BENCH_REQUESTS,
+        for (size_t i = 0; i < BENCH_REQUESTS; i++) bench_request(&allocator_heap, keys, i));
+
+    bench_run("request (arena, reset per request)", BENCH_REQUESTS,
+        for (size_t i = 0; i < BENCH_REQUESTS; i++) {
+            bench_request(&arena.allocator, keys, i);
+            allocator_arena_reset(&arena);
+        });
+
+    bench_run("request (cache)", BENCH_REQUESTS,
+        for (size_t i = 0; i < BENCH_REQUESTS; i++) bench_request(&cache.allocator, keys, i));
+
+    allocator_arena_destroy(&arena);
+    allocator_cache_destroy(&cache);
+}
+
+int main() {
+    uint64_t *keys = malloc(BENCH_KEYS * sizeof(uint64_t));
+    uint64_t state = 88172645463325252ULL;
+
+    if (keys == NULL) return EXIT_FAILURE;
+
+    for (size_t i = 0; i < BENCH_KEYS; i++) keys[i] = bench_random(&state);
+
+    printf("Running benchmarks - Hashtable...\n");
+    hashtable_generic_bench(keys);
+    hashtable_typed_bench(keys);
+    hashtable_bytes_bench(keys);
+    hashtable_snapshot_bench(keys);
+    hashtable_latency_bench(keys, false);
+    hashtable_latency_bench(keys, true);
+    hashtable_concurrent_bench(keys);
+
+    printf("Running benchmarks - Queue...\n");
+    queue_bench();
+
+    printf("Running benchmarks - Buffer...\n");
+    buffer_small_bench(keys);
+    buffer_gap_bench(keys);
+    buffer_ring_bench(keys);
+    buffer_segmented_bench(keys);
+    buffer_large_bench(&allocator_heap, "buffer_push 256 MiB (heap)");
+    buffer_large_bench(&allocator_pages, "buffer_push 256 MiB (pages)");
+    buffer_map_file_bench();
+    buffer_io_bench();
+
+    printf("Running benchmarks - Allocator...\n");
+    allocator_bench(keys);
+
+    printf("Running benchmarks - Sparse array...\n");
+    sparsearray_bench(keys, false);
+    sparsearray_bench(keys, true);
+    sparsearray_dense_bench(keys);
+    sparsearray_bulk_bench(keys, false);
+    sparsearray_bulk_bench(keys, true);
+    sparsearray_snapshot_bench(keys, false);
+    sparsearray_snapshot_bench(keys, true);
+    free(keys);
+
+    return EXIT_SUCCESS;
+}
@@ -1,15 +1,23 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include "../src/vex/debug.h"
 #include "../src/vex/test.h"
 #include "../src/vex/string.h"
 #include "../src/vex/buffer.h"
 #include "../src/vex/buffer_typed.h"
+#include "../src/vex/buffer_gap.h"
+#include "../src/vex/buffer_io.h"
+#include "../src/vex/buffer_ring.h"
+#include "../src/vex/buffer_segmented.h"
 #include "../src/vex/sparsearray.h"
 #include "../src/vex/hashtable.h"
 #include "../src/vex/hashtable_typed.h"
+#include "../src/vex/hashtable_concurrent.h"
+#include "../src/vex/hashtable_bytes.h"
+#include "../src/vex/queue_typed.h"
 
 test buffer_test() {
     buffer b;
@@ -45,6 +53,339 @@ test buffer_test() {
     succeed;
 }
 
+test buffer_small_test() {
+    // Short data is kept in the buffer itself
+    buffer b;
+    bool b_init = buffer_create(&b, 4);
+    expect(b_init, "Failed to create buffer");
+    expect(b.data == (uint8_t *) b.small, "Expected small buffer");
+
+    for (uint8_t i = 0; i < BUFFER_SMALL_SIZE; i++) *(uint8_t *) buffer_push(&b, 1) = i;
+
+    expect(b.data == (uint8_t *) b.small, "Expected small buffer");
+
+    // Moving keeps the data
+    buffer moved;
+    buffer_move(&moved, &b);
+    expect(moved.data == (uint8_t *) moved.small, "Expected moved buffer to be small");
+
+    // Growing past the small size allocates, trimming moves it back
+    for (uint8_t i = BUFFER_SMALL_SIZE; i < 100; i++) *(uint8_t *) buffer_push(&moved, 1) = i;
+
+    expect(moved.data != (uint8_t *) moved.small, "Expected allocated buffer");
+
+    for (uint8_t i = 0; i < 100; i++) expect(*(uint8_t *) buffer_get(&moved, i) == i, "Unexpected value");
+
+    buffer_pop(&moved, 90);
+    expect(buffer_trim(&moved), "Failed to trim buffer");
+    expect(moved.data == (uint8_t *) moved.small, "Expected trimmed buffer to be small");
+
+    for (uint8_t i = 0; i < 10; i++) expect(*(uint8_t *) buffer_get(&moved, i) == i, "Unexpected value");
+
+    buffer_destroy(&moved);
+    succeed;
+}
+
+test buffer_pages_test() {
+    buffer b;
+    bool b_init = buffer_create_in(&b, &allocator_pages, 1000);
+    expect(b_init, "Failed to create buffer");
+    expect(buffer_advise(&b, ALLOCATOR_ADVISE_SEQUENTIAL), "Failed to advise buffer");
+
+    // Grow through many pages
+    for (size_t i = 0; i < 1000000; i++) *(size_t *) buffer_push(&b, sizeof(size_t)) = i;
+
+    for (size_t i = 0; i < 1000000; i += 999) expect(*(size_t *) buffer_get(&b, i * sizeof(size_t)) == i, "Unexpected value");
+
+    // Trimming keeps the data before the end
+    buffer_pop(&b, 900000 * sizeof(size_t));
+    expect(buffer_trim(&b), "Failed to trim buffer");
+    expect(buffer_advise(&b, ALLOCATOR_ADVISE_RANDOM), "Failed to advise buffer");
+
+    for (size_t i = 0; i < 100000; i++) expect(*(size_t *) buffer_get(&b, i * sizeof(size_t)) == i, "Unexpected value");
+
+    *(size_t *) buffer_push(&b, sizeof(size_t)) = 7;
+    expect(*(size_t *) buffer_get(&b, 100000 * sizeof(size_t)) == 7, "Unexpected value");
+    buffer_destroy(&b);
+    succeed;
+}
+
+test buffer_map_file_test() {
+    const char *path = "buffer_map_file_test.bin";
+    remove(path);
+    buffer b;
+    bool b_map = buffer_map_file(&b, path, BUFFER_MAP_WRITE);
+    expect(b_map, "Failed to map new file");
+    expect(buffer_size(&b) == 0, "Unexpected size of new file");
+
+    for (size_t i = 0; i < 100000; i++) *(size_t *) buffer_push(&b, sizeof(size_t)) = i;
+
+    expect(buffer_sync(&b), "Failed to sync buffer");
+    buffer_destroy(&b);
+
+    // The file ends at the size of the buffer
+    FILE *file = fopen(path, "rb");
+    expect(file != NULL, "Failed to open mapped file");
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fclose(file);
+    expect(length == 100000 * sizeof(size_t), "Unexpected file length");
+
+    // Removing from the front of a file mapped again
+    b_map = buffer_map_file(&b, path, BUFFER_MAP_WRITE);
+    expect(b_map && buffer_size(&b) == 100000 * sizeof(size_t), "Failed to map file again");
+    expect(buffer_remove(&b, 0, 1000 * sizeof(size_t)), "Failed to remove from buffer");
+    expect(buffer_sync(&b), "Failed to sync buffer");
+    buffer_destroy(&b);
+
+    b_map = buffer_map_file(&b, path, BUFFER_MAP_READ);
+    expect(b_map && buffer_size(&b) == 99000 * sizeof(size_t), "Failed to map file for reading");
+
+    for (size_t i = 0; i < 99000; i++) expect(*(size_t *) buffer_get(&b, i * sizeof(size_t)) == i + 1000, "Unexpected value");
+
+    expect(buffer_push(&b, sizeof(size_t)) == NULL, "Pushed to file mapped for reading");
+    buffer_destroy(&b);
+
+    expect(!buffer_map_file(&b, "buffer_map_file_test_missing.bin", BUFFER_MAP_READ), "Mapped missing file");
+    remove(path);
+    succeed;
+}
+
+static void buffer_io_test_callback(buffer_io_request *r) {
+    (*(size_t *) r->data)++;
+}
+
+test buffer_io_test() {
+    const char *path = "buffer_io_test.bin";
+    buffer parts[3];
+
+    for (size_t i = 0; i < 3; i++) {
+        buffer_create(&parts[i], 0);
+
+        for (size_t j = 0; j < 10000 * (i + 1); j++) *(uint8_t *) buffer_push(&parts[i], 1) = (uint8_t) (i + j);
+    }
+
+    // Write the parts one by one, then all at once
+    FILE *file = fopen(path, "wb");
+    expect(file != NULL, "Failed to create file");
+
+    for (size_t i = 0; i < 3; i++) expect(buffer_write_fd(&parts[i], fileno(file)), "Failed to write buffer");
+
+    expect(buffer_write_fd_many(parts, 3, fileno(file)), "Failed to write buffers");
+    fclose(file);
+
+    buffer b;
+    buffer_create(&b, 0);
+    file = fopen(path, "rb");
+    expect(buffer_read_fd(&b, fileno(file)), "Failed to read file");
+    fclose(file);
+    expect(buffer_size(&b) == 120000, "Unexpected size read");
+
+    for (size_t i = 0, offset = 0; i < 6; offset += buffer_size(&parts[i % 3]), i++) {
+        expect(memcmp(buffer_get(&b, offset), parts[i % 3].data, buffer_size(&parts[i % 3])) == 0, "Unexpected data read");
+    }
+
+    // Reading once into the free capacity of several buffers in order
+    buffer targets[3];
+    size_t read_size;
+
+    for (size_t i = 0; i < 3; i++) buffer_create(&targets[i], 1000 * (i + 1));
+
+    file = fopen(path, "rb");
+    expect(buffer_read_fd_many(targets, 3, fileno(file), &read_size), "Failed to read into buffers");
+    fclose(file);
+    expect(read_size == 6000 && buffer_size(&targets[2]) == 3000, "Unexpected size read");
+    expect(memcmp(targets[1].data, b.data + 1000, 2000) == 0, "Unexpected data read");
+
+    // Reading parts of the file at offsets in one batch
+    buffer_io io;
+    buffer_io_request requests[3];
+    size_t completed = 0;
+    expect(buffer_io_create(&io, 4), "Failed to create buffer_io");
+    file = fopen(path, "rb");
+
+    for (size_t i = 0; i < 3; i++) {
+        buffer_clear(&targets[i]);
+        requests[i].callback = buffer_io_test_callback;
+        requests[i].data = &completed;
+        expect(buffer_io_read(&io, &requests[i], &targets[i], fileno(file), 10000 * i, 5000), "Failed to queue read");
+    }
+
+    expect(buffer_io_submit(&io), "Failed to submit reads");
+
+    while (buffer_io_pending(&io) > 0) buffer_io_poll(&io, true);
+
+    fclose(file);
+    expect(completed == 3, "Unexpected number of callbacks");
+
+    for (size_t i = 0; i < 3; i++) {
+        expect(!requests[i].failed && requests[i].transferred == 5000 && buffer_size(&targets[i]) == 5000, "Unexpected read");
+        expect(memcmp(targets[i].data, b.data + 10000 * i, 5000) == 0, "Unexpected data read");
+    }
+
+    // Writing a buffer back over the start of the file
+    file = fopen(path, "rb+");
+    requests[0].callback = NULL;
+    expect(buffer_io_write(&io, &requests[0], &targets[2], fileno(file), 0), "Failed to queue write");
+    expect(buffer_io_submit(&io) && buffer_io_poll(&io, true) == 1, "Failed to write");
+    fclose(file);
+    expect(requests[0].transferred == 5000, "Unexpected write");
+
+    buffer_clear(&b);
+    file = fopen(path, "rb");
+    buffer_read_fd(&b, fileno(file));
+    fclose(file);
+    expect(buffer_size(&b) == 120000 && memcmp(b.data, targets[2].data, 5000) == 0, "Unexpected data written");
+
+    buffer_io_destroy(&io);
+    buffer_destroy(&b);
+
+    for (size_t i = 0; i < 3; i++) {
+        buffer_destroy(&parts[i]);
+        buffer_destroy(&targets[i]);
+    }
+
+    remove(path);
+    succeed;
+}
+
+test buffer_gap_test() {
+    buffer_gap b;
+    bool b_init = buffer_gap_create(&b, 10);
+    expect(b_init, "Failed to create buffer");
+
+    // Add 100 in reverse order
+    for (size_t i = 0; i < 100; i++) {
+        size_t *v = buffer_gap_add(&b, 0, sizeof(size_t));
+        expect(v != NULL, "Failed to insert into buffer");
+        *v = i;
+    }
+
+    // Remove 50 from the middle, then add 10 back after the first 25
+    for (size_t i = 75 - 1; i > 25 - 1; i--) {
+        bool b_remove = buffer_gap_remove(&b, i * sizeof(size_t), sizeof(size_t));
+        expect(b_remove, "Failed to remove from buffer");
+    }
+
+    for (size_t i = 0; i < 10; i++) *(size_t *) buffer_gap_add(&b, (25 + i) * sizeof(size_t), sizeof(size_t)) = 1000 + i;
+
+    expect(buffer_gap_size(&b) == 60 * sizeof(size_t), "Unexpected size");
+
+    for (size_t i = 0; i < 60; i++) {
+        size_t *n = buffer_gap_get(&b, i * sizeof(size_t));
+        expect((uintptr_t) n % sizeof(size_t) == 0, "Misaligned element");
+        size_t expected = i < 25 ? 99 - i : i < 35 ? 1000 + i - 25 : 99 - i - 40;
+        expect(*n == expected, "Unexpected value");
+    }
+
+    // The same values in one piece
+    size_t *view = buffer_gap_view(&b);
+
+    for (size_t i = 0; i < 60; i++) expect(view[i] == *(size_t *) buffer_gap_get(&b, i * sizeof(size_t)), "Unexpected value in view");
+
+    expect(view[0] == 99 && view[59] == 0, "Unexpected value in view");
+
+    buffer_gap_destroy(&b);
+    succeed;
+}
+
+test buffer_ring_test() {
+    buffer_ring r;
+    bool r_init = buffer_ring_create(&r, 0);
+    expect(r_init, "Failed to create ring");
+
+    // Move the start forward so the data wraps around the end when it grows
+    size_t v;
+
+    for (size_t i = 0; i < 10; i++) buffer_ring_push(&r, &i, sizeof(size_t));
+
+    for (size_t i = 0; i < 9; i++) {
+        expect(buffer_ring_pop_front(&r, &v, sizeof(size_t)) && v == i, "Unexpected value at front");
+    }
+
+    for (size_t i = 10; i < 1000; i++) {
+        bool r_push = buffer_ring_push(&r, &i, sizeof(size_t));
+        expect(r_push, "Failed to push to ring");
+    }
+
+    for (size_t i = 1; i < 10; i++) {
+        size_t front = 9 - i;
+        expect(buffer_ring_push_front(&r, &front, sizeof(size_t)), "Failed to push to front of ring");
+    }
+
+    expect(buffer_ring_size(&r) == 1000 * sizeof(size_t), "Unexpected size");
+
+    for (size_t i = 0; i < 1000; i += 7) {
+        expect(buffer_ring_read(&r, i * sizeof(size_t), &v, sizeof(size_t)) && v == i, "Unexpected value");
+    }
+
+    expect(buffer_ring_pop(&r, &v, sizeof(size_t)) && v == 999, "Unexpected value at back");
+    expect(!buffer_ring_read(&r, 999 * sizeof(size_t), &v, sizeof(size_t)), "Read past the end");
+
+    // The spans hold the data in order
+    buffer_ring_span spans[2];
+    size_t count = buffer_ring_spans(&r, spans);
+    size_t next = 0;
+
+    for (size_t s = 0; s < count; s++) {
+        for (size_t i = 0; i < spans[s].size; i += sizeof(size_t)) {
+            memcpy(&v, (uint8_t *) spans[s].data + i, sizeof(size_t));
+            expect(v == next++, "Unexpected value in span");
+        }
+    }
+
+    expect(next == 999, "Unexpected size of spans");
+    buffer_ring_pop_front(&r, NULL, 990 * sizeof(size_t));
+
+    // Bytes written to the free spans are added to the back
+    expect(buffer_ring_reserve(&r, 100), "Failed to reserve");
+    count = buffer_ring_free_spans(&r, spans);
+    expect(count > 0 && spans[0].size + (count > 1 ? spans[1].size : 0) >= 100, "Unexpected free spans");
+
+    for (size_t i = 0; i < 100; i++) {
+        uint8_t *byte = i < spans[0].size ? (uint8_t *) spans[0].data + i : (uint8_t *) spans[1].data + i - spans[0].size;
+        *byte = (uint8_t) i;
+    }
+
+    buffer_ring_commit(&r, 100);
+    expect(buffer_ring_size(&r) == 9 * sizeof(size_t) + 100, "Unexpected size after commit");
+
+    uint8_t bytes[100];
+    expect(buffer_ring_read(&r, 9 * sizeof(size_t), bytes, 100), "Failed to read");
+
+    for (size_t i = 0; i < 100; i++) expect(bytes[i] == i, "Unexpected committed byte");
+
+    buffer_ring_destroy(&r);
+    succeed;
+}
+
+BUFFER_RING_REGISTER_TYPE(long, long)
+
+test buffer_ring_typed_test() {
+    buffer_ring_long r;
+    bool r_init = buffer_ring_create_long(&r, 4);
+    expect(r_init, "Failed to create ring");
+
+    for (long i = 0; i < 100; i++) {
+        expect(buffer_ring_push_long(&r, i) && buffer_ring_push_front_long(&r, -i - 1), "Failed to push to ring");
+    }
+
+    expect(buffer_ring_size_long(&r) == 200, "Unexpected size");
+
+    long v;
+    expect(buffer_ring_get_long(&r, 0, &v) && v == -100, "Unexpected value");
+    expect(buffer_ring_get_long(&r, 100, &v) && v == 0, "Unexpected value");
+
+    for (long i = 99; i >= 0; i--) {
+        expect(buffer_ring_pop_long(&r, &v) && v == i, "Unexpected value at back");
+        expect(buffer_ring_pop_front_long(&r, &v) && v == -i - 1, "Unexpected value at front");
+    }
+
+    expect(!buffer_ring_pop_front_long(&r, &v), "Popped from empty ring");
+    buffer_ring_destroy_long(&r);
+    succeed;
+}
+
 BUFFER_REGISTER_TYPE(long, long)
 
 test buffer_typed_test() {
@@ -124,6 +465,433 @@ bool equals_char_ptr(char *a, char *b) {
     return *a == *b;
 }
 
+test sparsearray_tree_test() {
+    // Compare against a flat sparse array with the same keys
+    sparsearray s, flat;
+    bool s_init = sparsearray_create_tree(&s, sizeof(uint64_t));
+    expect(s_init, "Failed to create sparsearray");
+    bool flat_init = sparsearray_create(&flat, 0, 0);
+    expect(flat_init, "Failed to create sparsearray");
+    uint64_t state = 1;
+
+    for (size_t i = 0; i < 20000; i++) {
+        // Random keys in a range small enough to put some keys twice
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t key = (state >> 33) % 50000;
+        uint64_t *v = sparsearray_put(&s, key, sizeof(uint64_t));
+        expect(v != NULL, "Failed to insert into sparsearray");
+        *v = key * 3;
+        *(uint64_t *) sparsearray_put(&flat, key, sizeof(uint64_t)) = key * 3;
+    }
+
+    expect(sparsearray_count(&s) == sparsearray_count(&flat), "Unexpected count");
+
+    for (size_t i = 0, l = sparsearray_count(&s); i < l; i++) {
+        expect(sparsearray_key(&s, i) == sparsearray_key(&flat, i), "Unexpected key order");
+        expect(*(uint64_t *) sparsearray_value(&s, i, sizeof(uint64_t)) == sparsearray_key(&flat, i) * 3, "Unexpected value");
+    }
+
+    // Remove most keys, merging nodes, then check the rest in reverse order
+    for (uint64_t key = 0; key < 50000; key++) {
+        if (key % 7 == 0) continue;
+
+        bool found = sparsearray_get(&flat, key, sizeof(uint64_t)) != NULL;
+        expect(sparsearray_remove(&s, key, sizeof(uint64_t)) == found, "Unexpected remove result");
+        sparsearray_remove(&flat, key, sizeof(uint64_t));
+    }
+
+    expect(sparsearray_count(&s) == sparsearray_count(&flat), "Unexpected count");
+
+    for (size_t i = sparsearray_count(&s); i > 0; i--) {
+        expect(sparsearray_key(&s, i - 1) == sparsearray_key(&flat, i - 1), "Unexpected key order");
+    }
+
+    for (uint64_t key = 0; key < 50000; key++) {
+        uint64_t *v = sparsearray_get(&s, key, sizeof(uint64_t));
+        expect((v != NULL) == (sparsearray_get(&flat, key, sizeof(uint64_t)) != NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == key * 3, "Unexpected value");
+    }
+
+    // Remove the rest in order
+    for (uint64_t key = 0; key < 50000; key += 7) sparsearray_remove(&s, key, sizeof(uint64_t));
+
+    expect(sparsearray_count(&s) == 0, "Expected empty sparsearray");
+    expect(sparsearray_get(&s, 7, sizeof(uint64_t)) == NULL, "Unexpected key");
+
+    sparsearray_destroy(&s);
+    sparsearray_destroy(&flat);
+    succeed;
+}
+
+test sparsearray_index_test() {
+    // Gets with and without an index, on every size up to a few blocks and one
+    // large size
+    for (size_t count = 0; count < 1100; count = count < 40 ? count + 1 : count * 25) {
+        sparsearray s;
+        bool s_init = sparsearray_create(&s, 0, 0);
+        expect(s_init, "Failed to create sparsearray");
+
+        // Every third key, from 1
+        for (uint64_t i = 0; i < count; i++) *(uint64_t *) sparsearray_put(&s, i * 3 + 1, sizeof(uint64_t)) = i;
+
+        bool indexed = sparsearray_build_index(&s);
+        expect(indexed && s.index != NULL, "Failed to build index");
+
+        for (uint64_t key = 0; key < count * 3 + 3; key++) {
+            uint64_t *v = sparsearray_get(&s, key, sizeof(uint64_t));
+            expect((v != NULL) == (key % 3 == 1 && key / 3 < count), "Unexpected presence of key");
+            expect(v == NULL || *v == key / 3, "Unexpected value");
+        }
+
+        // Changing the keys drops the index
+        *(uint64_t *) sparsearray_put(&s, 0, sizeof(uint64_t)) = 5;
+        expect(s.index == NULL, "Expected the index to be dropped");
+        sparsearray_build_index(&s);
+        expect(sparsearray_remove(&s, 0, sizeof(uint64_t)), "Failed to remove from sparsearray");
+        expect(s.index == NULL, "Expected the index to be dropped");
+        expect(sparsearray_get(&s, 0, sizeof(uint64_t)) == NULL, "Unexpected key");
+
+        sparsearray_destroy(&s);
+    }
+
+    succeed;
+}
+
+test sparsearray_range_test() {
+    for (int tree = 0; tree < 2; tree++) {
+        sparsearray s;
+        bool s_init = tree ? sparsearray_create_tree(&s, sizeof(uint64_t)) : sparsearray_create(&s, 0, 0);
+        expect(s_init, "Failed to create sparsearray");
+
+        // Even keys from 10 to 5998
+        for (uint64_t key = 10; key < 6000; key += 2) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key * 3;
+
+        expect(sparsearray_lower_bound(&s, 0) == 0, "Unexpected lower bound");
+        expect(sparsearray_lower_bound(&s, 10) == 0, "Unexpected lower bound");
+        expect(sparsearray_upper_bound(&s, 10) == 1, "Unexpected upper bound");
+        expect(sparsearray_lower_bound(&s, 11) == 1, "Unexpected lower bound");
+        expect(sparsearray_lower_bound(&s, 6000) == sparsearray_count(&s), "Unexpected lower bound");
+        expect(sparsearray_upper_bound(&s, UINT64_MAX) == sparsearray_count(&s), "Unexpected upper bound");
+
+        for (uint64_t key = 0; key < 6100; key += 7) {
+            size_t lower = sparsearray_lower_bound(&s, key);
+            size_t upper = sparsearray_upper_bound(&s, key);
+            expect(lower == sparsearray_count(&s) || sparsearray_key(&s, lower) >= key, "Unexpected lower bound");
+            expect(lower == 0 || sparsearray_key(&s, lower - 1) < key, "Unexpected lower bound");
+            expect(upper == sparsearray_count(&s) || sparsearray_key(&s, upper) > key, "Unexpected upper bound");
+            expect(upper == 0 || sparsearray_key(&s, upper - 1) <= key, "Unexpected upper bound");
+        }
+
+        // Ranges starting and ending on and between keys
+        for (uint64_t start = 0; start < 6100; start += 301) {
+            uint64_t end = start + start % 1000;
+            uint64_t expected = start < 10 ? 10 : start + start % 2;
+            sparsearray_range_iterator it = sparsearray_iterate_range(&s, start, end);
+
+            while (sparsearray_iterate_range_next(&it)) {
+                uint64_t key = sparsearray_iterate_range_key(&it);
+                expect(key == expected, "Unexpected key in range");
+                expect(*(uint64_t *) sparsearray_iterate_range_value(&it, sizeof(uint64_t)) == key * 3, "Unexpected value");
+                expected += 2;
+            }
+
+            expect(expected >= end || expected >= 6000, "Expected more keys in range");
+        }
+
+        // Remove a range in the middle, then the start
+        bool removed = sparsearray_remove_range(&s, 1001, 5001, sizeof(uint64_t));
+        expect(removed, "Failed to remove range");
+        expect(sparsearray_count(&s) == 496 + 499, "Unexpected count");
+        expect(sparsearray_get(&s, 1000, sizeof(uint64_t)) != NULL, "Expected key before range");
+        expect(sparsearray_get(&s, 1002, sizeof(uint64_t)) == NULL, "Unexpected key in range");
+        expect(sparsearray_get(&s, 5000, sizeof(uint64_t)) == NULL, "Unexpected key in range");
+        expect(sparsearray_get(&s, 5002, sizeof(uint64_t)) != NULL, "Expected key after range");
+        sparsearray_remove_range(&s, 0, 1001, sizeof(uint64_t));
+        expect(sparsearray_count(&s) == 499, "Unexpected count");
+        expect(sparsearray_key(&s, 0) == 5002, "Unexpected first key");
+        sparsearray_remove_range(&s, 0, UINT64_MAX, sizeof(uint64_t));
+        expect(sparsearray_count(&s) == 0, "Expected empty sparsearray");
+
+        sparsearray_range_iterator it = sparsearray_iterate_range(&s, 0, UINT64_MAX);
+        expect(!sparsearray_iterate_range_next(&it), "Unexpected key in empty sparsearray");
+
+        sparsearray_destroy(&s);
+    }
+
+    succeed;
+}
+
+test sparsearray_packed_test() {
+    // Close keys, then keys spread over the whole range
+    for (int spread = 0; spread < 2; spread++) {
+        sparsearray s, flat;
+        bool s_init = sparsearray_create(&s, 0, 0);
+        expect(s_init, "Failed to create sparsearray");
+        bool flat_init = sparsearray_create(&flat, 0, 0);
+        expect(flat_init, "Failed to create sparsearray");
+        uint64_t state = 3;
+        uint64_t key = spread ? 0 : 1000;
+
+        for (size_t i = 0; i < 10000; i++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            key += spread ? state >> 51 << 32 | 1 : 1 + (state >> 62);
+            *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key ^ 5;
+            *(uint64_t *) sparsearray_put(&flat, key, sizeof(uint64_t)) = key ^ 5;
+        }
+
+        // The largest difference there can be
+        if (spread) {
+            *(uint64_t *) sparsearray_put(&s, UINT64_MAX, sizeof(uint64_t)) = UINT64_MAX ^ 5;
+            *(uint64_t *) sparsearray_put(&flat, UINT64_MAX, sizeof(uint64_t)) = UINT64_MAX ^ 5;
+        }
+
+        bool packed = sparsearray_pack(&s);
+        expect(packed && s.packed != NULL, "Failed to pack sparsearray");
+        expect(sparsearray_count(&s) == sparsearray_count(&flat), "Unexpected count");
+        expect(spread || sparsearray_packed_size(s.packed) * 4 < buffer_size(&flat.keys), "Expected packed keys to be smaller");
+
+        for (size_t i = 0, l = sparsearray_count(&flat); i < l; i++) {
+            uint64_t k = sparsearray_key(&flat, i);
+            expect(sparsearray_key(&s, i) == k, "Unexpected key");
+            uint64_t *v = sparsearray_get(&s, k, sizeof(uint64_t));
+            expect(v != NULL && *v == (k ^ 5), "Unexpected value");
+            expect(sparsearray_lower_bound(&s, k) == i, "Unexpected lower bound");
+            bool next = sparsearray_get(&flat, k + 1, sizeof(uint64_t)) != NULL;
+            expect((sparsearray_get(&s, k + 1, sizeof(uint64_t)) != NULL) == next, "Unexpected presence of key");
+            expect(sparsearray_lower_bound(&s, k + 1) == sparsearray_lower_bound(&flat, k + 1), "Unexpected lower bound");
+        }
+
+        expect(sparsearray_get(&s, 0, sizeof(uint64_t)) == NULL, "Unexpected key");
+
+        // Iterating in order
+        size_t index = 0;
+        sparsearray_range_iterator it = sparsearray_iterate_range(&s, 0, UINT64_MAX);
+
+        while (sparsearray_iterate_range_next(&it)) {
+            expect(sparsearray_iterate_range_key(&it) == sparsearray_key(&flat, index++), "Unexpected key order");
+        }
+
+        // Putting an existing key keeps the keys packed, new ones unpack them
+        uint64_t first = sparsearray_key(&flat, 0);
+        *(uint64_t *) sparsearray_put(&s, first, sizeof(uint64_t)) = 1;
+        expect(s.packed != NULL, "Expected packed keys");
+        *(uint64_t *) sparsearray_put(&s, 1, sizeof(uint64_t)) = 1;
+        expect(s.packed == NULL, "Expected unpacked keys");
+        expect(sparsearray_count(&s) == sparsearray_count(&flat) + 1, "Unexpected count");
+        expect(sparsearray_key(&s, 1) == first, "Unexpected key");
+        sparsearray_pack(&s);
+        expect(!sparsearray_remove(&s, 2, sizeof(uint64_t)) && s.packed != NULL, "Expected packed keys");
+        expect(sparsearray_remove(&s, 1, sizeof(uint64_t)) && s.packed == NULL, "Expected unpacked keys");
+
+        sparsearray_destroy(&s);
+        sparsearray_destroy(&flat);
+    }
+
+    succeed;
+}
+
+test sparsearray_dense_test() {
+    sparsearray s;
+    bool s_init = sparsearray_create(&s, 0, 0);
+    expect(s_init, "Failed to create sparsearray");
+
+    // Close keys switch to direct indexing
+    for (uint64_t key = 1000; key < 2000; key++) {
+        if (key % 7 != 0) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key * 3;
+    }
+
+    expect(s.dense != NULL, "Expected a dense sparsearray");
+
+    for (uint64_t key = 1000, i = 0; key < 2000; key++) {
+        if (key % 7 == 0) continue;
+
+        expect(sparsearray_key(&s, i) == key, "Unexpected key order");
+        expect(*(uint64_t *) sparsearray_value(&s, i, sizeof(uint64_t)) == key * 3, "Unexpected value");
+        expect(sparsearray_lower_bound(&s, key) == i++, "Unexpected lower bound");
+    }
+
+    for (uint64_t key = 0; key < 3000; key++) {
+        uint64_t *v = sparsearray_get(&s, key, sizeof(uint64_t));
+        expect((v != NULL) == (key >= 1000 && key < 2000 && key % 7 != 0), "Unexpected presence of key");
+        expect(v == NULL || *v == key * 3, "Unexpected value");
+    }
+
+    // Keys just outside are added to the slots, far keys make it flat again
+    *(uint64_t *) sparsearray_put(&s, 900, sizeof(uint64_t)) = 900 * 3;
+    *(uint64_t *) sparsearray_put(&s, 2100, sizeof(uint64_t)) = 2100 * 3;
+    expect(s.dense != NULL, "Expected a dense sparsearray");
+    *(uint64_t *) sparsearray_put(&s, 1000000, sizeof(uint64_t)) = 1000000 * 3;
+    expect(s.dense == NULL, "Expected a flat sparsearray");
+    expect(sparsearray_count(&s) == 860, "Unexpected count");
+    expect(sparsearray_key(&s, 0) == 900 && sparsearray_key(&s, 859) == 1000000, "Unexpected key order");
+    sparsearray_remove(&s, 1000000, sizeof(uint64_t));
+    *(uint64_t *) sparsearray_put(&s, 1001, sizeof(uint64_t)) = 1001 * 3;
+    expect(s.dense != NULL, "Expected a dense sparsearray");
+
+    // Removing most keys makes it flat again
+    bool removed = sparsearray_remove_range(&s, 1100, 2000, sizeof(uint64_t));
+    expect(removed && sparsearray_count(&s) == 88, "Unexpected count");
+    expect(s.dense == NULL, "Expected a flat sparsearray");
+
+    for (uint64_t key = 1000; key < 1100; key++) sparsearray_remove(&s, key, sizeof(uint64_t));
+
+    expect(sparsearray_count(&s) == 2, "Unexpected count");
+    expect(*(uint64_t *) sparsearray_get(&s, 2100, sizeof(uint64_t)) == 2100 * 3, "Unexpected value");
+
+    // Merging from and into dense sparse arrays
+    sparsearray other;
+    bool other_init = sparsearray_create(&other, 0, 0);
+    expect(other_init, "Failed to create sparsearray");
+
+    for (uint64_t key = 0; key < 500; key++) *(uint64_t *) sparsearray_put(&other, key * 2, sizeof(uint64_t)) = key;
+
+    expect(other.dense != NULL, "Expected a dense sparsearray");
+    bool merged = sparsearray_merge(&s, &other, sizeof(uint64_t), SPARSEARRAY_KEEP_LAST);
+    expect(merged && sparsearray_count(&s) == 501, "Failed to merge sparsearrays");
+    merged = sparsearray_merge(&other, &s, sizeof(uint64_t), SPARSEARRAY_KEEP_LAST);
+    expect(merged && sparsearray_count(&other) == 501, "Failed to merge sparsearrays");
+    expect(*(uint64_t *) sparsearray_get(&other, 2100, sizeof(uint64_t)) == 2100 * 3, "Unexpected value");
+    expect(*(uint64_t *) sparsearray_get(&other, 998, sizeof(uint64_t)) == 499, "Unexpected value");
+
+    sparsearray_destroy(&s);
+    sparsearray_destroy(&other);
+    succeed;
+}
+
+test sparsearray_snapshot_test() {
+    for (int tree = 0; tree < 2; tree++) {
+        sparsearray s;
+        bool s_init = tree ? sparsearray_create_tree(&s, sizeof(uint64_t)) : sparsearray_create(&s, 0, 0);
+        expect(s_init, "Failed to create sparsearray");
+
+        for (uint64_t key = 0; key < 20000; key += 2) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key;
+
+        sparsearray first;
+        expect(sparsearray_snapshot(&s, &first), "Failed to take snapshot");
+
+        // Change values, add odd keys and remove every fourth key
+        for (uint64_t key = 0; key < 20000; key += 2) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key * 3;
+
+        for (uint64_t key = 1; key < 20000; key += 2) *(uint64_t *) sparsearray_put(&s, key, sizeof(uint64_t)) = key * 3;
+
+        sparsearray second;
+        expect(sparsearray_snapshot(&s, &second), "Failed to take snapshot");
+
+        for (uint64_t key = 0; key < 20000; key += 4) expect(sparsearray_remove(&s, key, sizeof(uint64_t)), "Failed to remove key");
+
+        // Each snapshot still has the keys and values it was taken with
+        expect(sparsearray_count(&first) == 10000, "Unexpected count in snapshot");
+        expect(sparsearray_count(&second) == 20000, "Unexpected count in snapshot");
+        expect(sparsearray_count(&s) == 15000, "Unexpected count");
+
+        for (size_t i = 0; i < sparsearray_count(&first); i++) {
+            expect(sparsearray_key(&first, i) == i * 2, "Unexpected key in snapshot");
+            expect(*(uint64_t *) sparsearray_value(&first, i, sizeof(uint64_t)) == i * 2, "Unexpected value in snapshot");
+        }
+
+        sparsearray_range_iterator it = sparsearray_iterate_range(&second, 0, UINT64_MAX);
+
+        for (uint64_t key = 0; sparsearray_iterate_range_next(&it); key++) {
+            expect(sparsearray_iterate_range_key(&it) == key, "Unexpected key in snapshot");
+            expect(*(uint64_t *) sparsearray_iterate_range_value(&it, sizeof(uint64_t)) == key * 3, "Unexpected value in snapshot");
+        }
+
+        for (uint64_t key = 0; key < 20000; key++) {
+            uint64_t *value = sparsearray_get(&s, key, sizeof(uint64_t));
+            expect((key % 4 == 0) == (value == NULL), "Unexpected presence of key");
+            expect(value == NULL || *value == key * 3, "Unexpected value");
+        }
+
+        // Snapshots change independently, and outlive what they were taken from
+        sparsearray_destroy(&s);
+        sparsearray_remove_range(&second, 1000, 19000, sizeof(uint64_t));
+        *(uint64_t *) sparsearray_put(&first, 1, sizeof(uint64_t)) = 1;
+        expect(sparsearray_count(&second) == 2000, "Unexpected count in snapshot");
+        expect(sparsearray_count(&first) == 10001, "Unexpected count in snapshot");
+        expect(*(uint64_t *) sparsearray_get(&first, 2, sizeof(uint64_t)) == 2, "Unexpected value in snapshot");
+        expect(*(uint64_t *) sparsearray_get(&second, 999, sizeof(uint64_t)) == 999 * 3, "Unexpected value in snapshot");
+        sparsearray_destroy(&first);
+        sparsearray_destroy(&second);
+    }
+
+    succeed;
+}
+
+test sparsearray_bulk_test() {
+    // Bulk puts into flat and tree layouts, compared against single puts
+    for (int tree = 0; tree < 2; tree++) {
+        sparsearray s, single, other;
+        bool s_init = tree ? sparsearray_create_tree(&s, sizeof(uint64_t)) : sparsearray_create(&s, 0, 0);
+        expect(s_init, "Failed to create sparsearray");
+        bool single_init = sparsearray_create(&single, 0, 0);
+        expect(single_init, "Failed to create sparsearray");
+        uint64_t keys[3000];
+        uint64_t values[3000];
+        uint64_t state = 7;
+
+        // Sorted keys, every third one put twice
+        for (size_t i = 0; i < 3000; i++) {
+            keys[i] = (i - i / 3) * 5;
+            values[i] = i;
+        }
+
+        bool sorted_put = sparsearray_put_sorted(&s, 3000, keys, values, sizeof(uint64_t), SPARSEARRAY_KEEP_FIRST);
+        expect(sorted_put, "Failed to put sorted keys");
+
+        for (size_t i = 0; i < 3000; i++) {
+            if (sparsearray_get(&single, keys[i], sizeof(uint64_t)) == NULL)
+                *(uint64_t *) sparsearray_put(&single, keys[i], sizeof(uint64_t)) = values[i];
+        }
+
+        // Unsorted keys, some already present
+        for (size_t i = 0; i < 3000; i++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            keys[i] = (state >> 33) % 20000;
+            values[i] = i + 10000;
+        }
+
+        bool unsorted_put = sparsearray_put_sorted(&s, 3000, keys, values, sizeof(uint64_t), SPARSEARRAY_KEEP_LAST);
+        expect(unsorted_put, "Failed to put unsorted keys");
+
+        for (size_t i = 0; i < 3000; i++) *(uint64_t *) sparsearray_put(&single, keys[i], sizeof(uint64_t)) = values[i];
+
+        expect(sparsearray_count(&s) == sparsearray_count(&single), "Unexpected count");
+
+        for (size_t i = 0, l = sparsearray_count(&s); i < l; i++) {
+            expect(sparsearray_key(&s, i) == sparsearray_key(&single, i), "Unexpected key order");
+            expect(*(uint64_t *) sparsearray_value(&s, i, sizeof(uint64_t)) == *(uint64_t *) sparsearray_value(&single, i, sizeof(uint64_t)), "Unexpected value");
+        }
+
+        // Merge in a sparse array of the other layout, keeping existing values
+        bool other_init = tree ? sparsearray_create(&other, 0, 0) : sparsearray_create_tree(&other, sizeof(uint64_t));
+        expect(other_init, "Failed to create sparsearray");
+
+        for (uint64_t key = 0; key < 30000; key += 3) *(uint64_t *) sparsearray_put(&other, key, sizeof(uint64_t)) = 1;
+
+        bool merged = sparsearray_merge(&s, &other, sizeof(uint64_t), SPARSEARRAY_KEEP_FIRST);
+        expect(merged, "Failed to merge sparsearrays");
+
+        for (uint64_t key = 0; key < 30000; key++) {
+            uint64_t *v = sparsearray_get(&s, key, sizeof(uint64_t));
+            uint64_t *expected = sparsearray_get(&single, key, sizeof(uint64_t));
+
+            if (expected != NULL) {
+                expect(v != NULL && *v == *expected, "Expected existing value");
+            } else if (key % 3 == 0) {
+                expect(v != NULL && *v == 1, "Expected merged value");
+            } else {
+                expect(v == NULL, "Unexpected key");
+            }
+        }
+
+        sparsearray_destroy(&s);
+        sparsearray_destroy(&single);
+        sparsearray_destroy(&other);
+    }
+
+    succeed;
+}
+
 test hashtable_test() {
     hashtable h;
     bool h_init = hashtable_create(&h, 10, 10, 10);
@@ -198,6 +966,9 @@ test hashtable_typed_test() {
         hashtable_put_ci(&h, c, *v * 2);
     }
 
+    hashtable_entry_ci *e = hashtable_get_entry_ci(&h, 'A');
+    expect(e != NULL && e->key == 'A' && e->value == 200, "Unexpected entry");
+
     // Remove some keys
     char *keys = "azbngGNBAZ";
 
@@ -219,6 +990,1047 @@ test hashtable_typed_test() {
     succeed;
 }
 
+uint64_t hash_uint64_ptr(uint64_t *k) {
+    return *k;
+}
+
+bool equals_uint64_ptr(uint64_t *a, uint64_t *b) {
+    return *a == *b;
+}
+
+test hashtable_grow_test() {
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+
+    // Add enough keys to grow the table several times
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t v = k * 3;
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &v, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    expect(hashtable_count(&h) == 10000, "Unexpected count");
+
+    // Remove every odd key, then put them back to reuse deleted slots
+    for (uint64_t k = 1; k < 10000; k += 2) {
+        bool h_remove = hashtable_remove(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect(h_remove, "Failed to remove from hashtable");
+    }
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect((k % 2 == 0) == (v != NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 3, "Unexpected value");
+    }
+
+    for (uint64_t k = 1; k < 10000; k += 2) {
+        uint64_t v = k * 3;
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &v, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    // Every key is seen exactly once when iterating
+    uint64_t key_sum = 0;
+    size_t key_count = 0;
+    hashtable_iterator it = hashtable_iterate(&h);
+
+    while (hashtable_iterate_next(&it, sizeof(uint64_t), sizeof(uint64_t))) {
+        uint64_t *key = hashtable_iterate_key(&it);
+        uint64_t *value = hashtable_iterate_value(&it, sizeof(uint64_t));
+        expect(*value == *key * 3, "Unexpected value");
+        key_sum += *key;
+        key_count++;
+    }
+
+    expect(key_count == 10000, "Unexpected iteration count");
+    expect(key_sum == 10000 * 9999 / 2, "Unexpected iterated keys");
+
+    hashtable_destroy(&h);
+    succeed;
+}
+
+uint64_t hash_uint64(uint64_t k) {
+    return k;
+}
+
+bool equals_uint64(uint64_t a, uint64_t b) {
+    return a == b;
+}
+
+HASHTABLE_REGISTER_TYPE(u64, uint64_t, uint64_t, hash_uint64, equals_uint64)
+
+test hashtable_batch_test() {
+    uint64_t keys[1000];
+    uint64_t values[1000];
+    uint64_t *found[1000];
+
+    for (size_t i = 0; i < 1000; i++) {
+        keys[i] = i * 7;
+        values[i] = i;
+    }
+
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+
+    // Put the first half, then get all keys, half of which are missing
+    bool h_put = hashtable_put_many(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, 500, keys, sizeof(uint64_t), values, sizeof(uint64_t));
+    expect(h_put, "Failed to insert into hashtable");
+
+    size_t h_found = hashtable_get_many(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, 1000, keys, sizeof(uint64_t), sizeof(uint64_t), (void **) found);
+    expect(h_found == 500, "Unexpected number of keys found");
+
+    for (size_t i = 0; i < 1000; i++) {
+        expect((i < 500) == (found[i] != NULL), "Unexpected presence of key");
+        expect(found[i] == NULL || *found[i] == i, "Unexpected value");
+    }
+
+    hashtable_destroy(&h);
+
+    hashtable_u64 ht;
+    bool ht_init = hashtable_create_u64(&ht, 0);
+    expect(ht_init, "Failed to create hashtable");
+
+    bool ht_put = hashtable_put_many_u64(&ht, 500, keys, values);
+    expect(ht_put, "Failed to insert into hashtable");
+
+    size_t ht_found = hashtable_get_many_u64(&ht, 1000, keys, found);
+    expect(ht_found == 500, "Unexpected number of keys found");
+
+    for (size_t i = 0; i < 1000; i++) {
+        expect((i < 500) == (found[i] != NULL), "Unexpected presence of key");
+        expect(found[i] == NULL || *found[i] == i, "Unexpected value");
+    }
+
+    hashtable_destroy_u64(&ht);
+    succeed;
+}
+
+static size_t hash_calls;
+
+uint64_t hash_uint64_counted(uint64_t *k) {
+    hash_calls++;
+    return *k;
+}
+
+test hashtable_hashed_test() {
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+    hash_calls = 0;
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t v = k * 2;
+        bool h_put = hashtable_put_hashed(&h, (uint64_t (*)(void *)) hash_uint64_counted, (bool (*)(void *, void *)) equals_uint64_ptr, k, &k, sizeof(uint64_t), &v, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    // Only growing the table hashes the entries again
+    size_t put_calls = hash_calls;
+
+    for (uint64_t k = 0; k < 1000; k += 2) {
+        bool h_remove = hashtable_remove_hashed(&h, (uint64_t (*)(void *)) hash_uint64_counted, (bool (*)(void *, void *)) equals_uint64_ptr, k, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect(h_remove, "Failed to remove from hashtable");
+    }
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t *v = hashtable_get_hashed(&h, (bool (*)(void *, void *)) equals_uint64_ptr, k, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect((k % 2 == 0) == (v == NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 2, "Unexpected value");
+    }
+
+    expect(hash_calls == put_calls, "Unexpected calls to hash function");
+
+    // Hashed and unhashed functions find the same entries
+    uint64_t key = 7;
+    uint64_t *value = hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &key, sizeof(uint64_t), sizeof(uint64_t));
+    expect(value != NULL && *value == 14, "Unexpected value");
+    hashtable_destroy(&h);
+
+    hashtable_u64 ht;
+    bool ht_init = hashtable_create_u64(&ht, 0);
+    expect(ht_init, "Failed to create hashtable");
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        bool ht_put = hashtable_put_hashed_u64(&ht, hash_uint64(k), k, k * 2);
+        expect(ht_put, "Failed to insert into hashtable");
+    }
+
+    for (uint64_t k = 0; k < 1000; k += 2) {
+        bool ht_remove = hashtable_remove_hashed_u64(&ht, hash_uint64(k), k);
+        expect(ht_remove, "Failed to remove from hashtable");
+    }
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t *v = hashtable_get_hashed_u64(&ht, hash_uint64(k), k);
+        expect((k % 2 == 0) == (v == NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 2, "Unexpected value");
+        expect(v == hashtable_get_u64(&ht, k), "Unexpected entry");
+    }
+
+    expect(hashtable_count_u64(&ht) == 500, "Unexpected count");
+    hashtable_destroy_u64(&ht);
+    succeed;
+}
+
+test hashtable_bytes_test() {
+    hashtable_bytes h;
+    bool h_init = hashtable_bytes_create(&h, 0, sizeof(uint64_t));
+    expect(h_init, "Failed to create hashtable");
+    char key[32];
+
+    // Keys of different lengths, growing the table and the key arena
+    for (uint64_t k = 0; k < 5000; k++) {
+        int key_size = sprintf(key, "key %llu", (unsigned long long) (k * k));
+        bool h_put = hashtable_bytes_put(&h, key, key_size, &k);
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    for (uint64_t k = 0; k < 5000; k++) {
+        if (k % 4 == 0) continue;
+
+        int key_size = sprintf(key, "key %llu", (unsigned long long) (k * k));
+        bool h_remove = hashtable_bytes_remove(&h, key, key_size);
+        expect(h_remove, "Failed to remove from hashtable");
+    }
+
+    expect(hashtable_bytes_count(&h) == 1250, "Unexpected count");
+
+    // Put more keys, so the removed keys are dropped from the arena when growing
+    for (uint64_t k = 5000; k < 10000; k++) {
+        int key_size = sprintf(key, "key %llu", (unsigned long long) (k * k));
+        bool h_put = hashtable_bytes_put(&h, key, key_size, &k);
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        int key_size = sprintf(key, "key %llu", (unsigned long long) (k * k));
+        uint64_t *v = hashtable_bytes_get_hashed(&h, hashtable_bytes_hash(key, key_size), key, key_size);
+        expect((k < 5000 && k % 4 != 0) == (v == NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k, "Unexpected value");
+    }
+
+    // Keys that are prefixes of others, or empty, are distinct keys. Empty
+    // keys may be NULL.
+    uint64_t empty_value = 1;
+    bool h_put = hashtable_bytes_put(&h, NULL, 0, &empty_value);
+    expect(h_put, "Failed to insert into hashtable");
+    expect(hashtable_bytes_get(&h, "key", 3) == NULL, "Unexpected prefix key");
+    expect(*(uint64_t *) hashtable_bytes_get(&h, "", 0) == 1, "Unexpected value");
+    expect(*(uint64_t *) hashtable_bytes_get(&h, NULL, 0) == 1, "Unexpected value");
+
+    size_t key_count = 0;
+    hashtable_bytes_iterator it = hashtable_bytes_iterate(&h);
+
+    while (hashtable_bytes_iterate_next(&it)) {
+        size_t key_size;
+        char *k = hashtable_bytes_iterate_key(&it, &key_size);
+        uint64_t *v = hashtable_bytes_iterate_value(&it);
+        expect(hashtable_bytes_get(&h, k, key_size) == v, "Unexpected iterated entry");
+        key_count++;
+    }
+
+    expect(key_count == 6251, "Unexpected iteration count");
+    hashtable_bytes_destroy(&h);
+    succeed;
+}
+
+uint64_t hash_uint64_constant(uint64_t *k) {
+    unused(k);
+    return 0;
+}
+
+test hashtable_stats_test() {
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &k, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    for (uint64_t k = 0; k < 100; k++) {
+        bool h_remove = hashtable_remove(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect(h_remove, "Failed to remove from hashtable");
+    }
+
+    for (uint64_t k = 0; k < 200; k++) {
+        hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+    }
+
+    hashtable_stats stats;
+    hashtable_get_stats(&h, (uint64_t (*)(void *)) hash_uint64_ptr, &stats);
+    expect(stats.count == 900, "Unexpected count");
+    expect(stats.capacity == hashtable_bucket_count(&h), "Unexpected capacity");
+    expect(stats.deleted == 100, "Unexpected deleted slots");
+    expect(stats.load_factor > 0 && stats.load_factor <= 0.875, "Unexpected load factor");
+    expect(stats.bytes_used == 900 * 2 * sizeof(uint64_t), "Unexpected bytes used");
+    expect(stats.bytes_allocated >= stats.bytes_used, "Unexpected bytes allocated");
+
+    size_t probed = 0;
+
+    for (size_t i = 0; i < HASHTABLE_STATS_PROBE_LENGTHS; i++) probed += stats.probe_lengths[i];
+
+    expect(probed == 900, "Unexpected probe length histogram");
+    expect(stats.probe_length_average >= 1 && stats.probe_length_max <= 3, "Unexpected probe lengths with a mixed hash");
+
+#ifdef HASHTABLE_COUNTERS
+    expect(stats.hits == 100 && stats.misses == 100, "Unexpected lookup counters");
+    expect(stats.rehashes > 0 && stats.reallocs > stats.rehashes, "Unexpected rehash counters");
+#endif
+
+    hashtable_destroy(&h);
+
+    // Every key hashing the same probes through the whole table
+    hashtable_create(&h, 0, 0, 0);
+
+    for (uint64_t k = 0; k < 100; k++) {
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_constant, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &k, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    hashtable_get_stats(&h, (uint64_t (*)(void *)) hash_uint64_constant, &stats);
+    expect(stats.probe_length_max >= 100 / HASHTABLE_GROUP_WIDTH, "Expected long probes with a constant hash");
+    expect(stats.probe_lengths[0] == HASHTABLE_GROUP_WIDTH, "Expected one group of entries found first");
+    hashtable_destroy(&h);
+
+    hashtable_u64 ht;
+    hashtable_create_u64(&ht, 0);
+
+    for (uint64_t k = 0; k < 1000; k++) hashtable_put_u64(&ht, k, k);
+
+    hashtable_get_stats_u64(&ht, &stats);
+    expect(stats.count == 1000, "Unexpected count");
+    expect(stats.bytes_used == 1000 * sizeof(hashtable_entry_u64), "Unexpected bytes used");
+    hashtable_destroy_u64(&ht);
+    succeed;
+}
+
+static bool snapshot_test_swap(const char *path, size_t offset, void *data, size_t size) {
+    // Swaps bytes of a snapshot file with the data, so swapping again puts
+    // the file back.
+    uint8_t previous[16];
+    FILE *file = fopen(path, "r+b");
+
+    if (file == NULL) return false;
+
+    bool swapped = size <= sizeof(previous)
+        && fseek(file, (long) offset, SEEK_SET) == 0 && fread(previous, 1, size, file) == size
+        && fseek(file, (long) offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+    fclose(file);
+
+    if (swapped) memcpy(data, previous, size);
+
+    return swapped;
+}
+
+test hashtable_snapshot_test() {
+    const char *path = "hashtable_snapshot_test.bin";
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+    hashtable_rehash_incremental(&h, true);
+
+    // Stop in the middle of a migration, so the old slots are saved as well
+    uint64_t count = 0;
+
+    for (; count < 1000 || hashtable_rehash_remaining(&h) == 0; count++) {
+        uint64_t v = count * 3;
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &count, sizeof(uint64_t), &v, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    FILE *file = fopen(path, "wb");
+    expect(file != NULL, "Failed to create snapshot file");
+    bool h_save = hashtable_save(&h, fileno(file));
+    fclose(file);
+    hashtable_destroy(&h);
+    expect(h_save, "Failed to save hashtable");
+
+    hashtable mapped;
+    snapshot snap;
+    bool h_open = hashtable_open_mapped(&mapped, &snap, path);
+    expect(h_open, "Failed to open hashtable snapshot");
+    expect(hashtable_count(&mapped) == count, "Unexpected count");
+
+    for (uint64_t k = 0; k < count * 2; k++) {
+        uint64_t *v = hashtable_get(&mapped, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect((k < count) == (v != NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 3, "Unexpected value");
+    }
+
+    size_t old_capacity = (size_t) snapshot_get_header(&snap)->fields[3];
+    snapshot_close(&snap);
+
+    // Snapshots of builds probing groups of another width are refused, and
+    // so are headers with a count or migration past the slots
+    uint32_t width = HASHTABLE_GROUP_WIDTH * 2;
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, parameter), &width, sizeof(width)), "Failed to change snapshot");
+    expect(!hashtable_open_mapped(&mapped, &snap, path), "Unexpected hashtable opened with another group width");
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, parameter), &width, sizeof(width)), "Failed to change snapshot");
+    width = HASHTABLE_GROUP_WIDTH / 2;
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, parameter), &width, sizeof(width)), "Failed to change snapshot");
+    expect(!hashtable_open_mapped(&mapped, &snap, path), "Unexpected hashtable opened with another group width");
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, parameter), &width, sizeof(width)), "Failed to change snapshot");
+
+    uint64_t rehash_index = old_capacity + 1;
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, fields[4]), &rehash_index, sizeof(rehash_index)), "Failed to change snapshot");
+    expect(!hashtable_open_mapped(&mapped, &snap, path), "Unexpected hashtable opened with migration past the old slots");
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, fields[4]), &rehash_index, sizeof(rehash_index)), "Failed to change snapshot");
+
+    uint64_t large_count = UINT64_MAX;
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, fields[1]), &large_count, sizeof(large_count)), "Failed to change snapshot");
+    expect(!hashtable_open_mapped(&mapped, &snap, path), "Unexpected hashtable opened with count past the slots");
+    expect(snapshot_test_swap(path, offsetof(snapshot_header, fields[1]), &large_count, sizeof(large_count)), "Failed to change snapshot");
+
+    h_open = hashtable_open_mapped(&mapped, &snap, path);
+    expect(h_open && hashtable_count(&mapped) == count, "Failed to open restored hashtable snapshot");
+    snapshot_close(&snap);
+
+    // Sparse arrays are saved and opened the same way
+    sparsearray s;
+    bool s_init = sparsearray_create(&s, 0, 0);
+    expect(s_init, "Failed to create sparsearray");
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t *v = sparsearray_put(&s, k * 5, sizeof(uint64_t));
+        expect(v != NULL, "Failed to insert into sparsearray");
+        *v = k;
+    }
+
+    file = fopen(path, "wb");
+    expect(file != NULL, "Failed to create snapshot file");
+    bool s_save = sparsearray_save(&s, fileno(file));
+    fclose(file);
+    sparsearray_destroy(&s);
+    expect(s_save, "Failed to save sparsearray");
+
+    sparsearray mapped_s;
+    bool s_open = sparsearray_open_mapped(&mapped_s, &snap, path);
+    expect(s_open, "Failed to open sparsearray snapshot");
+    expect(sparsearray_count(&mapped_s) == 1000, "Unexpected count");
+
+    for (uint64_t k = 0; k < 5000; k++) {
+        uint64_t *v = sparsearray_get(&mapped_s, k, sizeof(uint64_t));
+        expect((k % 5 == 0) == (v != NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k / 5, "Unexpected value");
+    }
+
+    snapshot_close(&snap);
+
+    // Sparse arrays stored in a tree are saved flat
+    s_init = sparsearray_create_tree(&s, sizeof(uint64_t));
+    expect(s_init, "Failed to create sparsearray");
+
+    for (uint64_t k = 1000; k > 0; k--) *(uint64_t *) sparsearray_put(&s, (k - 1) * 5, sizeof(uint64_t)) = k - 1;
+
+    file = fopen(path, "wb");
+    expect(file != NULL, "Failed to create snapshot file");
+    s_save = sparsearray_save(&s, fileno(file));
+    fclose(file);
+    sparsearray_destroy(&s);
+    expect(s_save, "Failed to save sparsearray");
+
+    s_open = sparsearray_open_mapped(&mapped_s, &snap, path);
+    expect(s_open, "Failed to open sparsearray snapshot");
+    expect(sparsearray_count(&mapped_s) == 1000, "Unexpected count");
+
+    for (uint64_t k = 0; k < 5000; k++) {
+        uint64_t *v = sparsearray_get(&mapped_s, k, sizeof(uint64_t));
+        expect((k % 5 == 0) == (v != NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k / 5, "Unexpected value");
+    }
+
+    snapshot_close(&snap);
+
+    // Packed sparse arrays are saved unpacked
+    s_init = sparsearray_create(&s, 0, 0);
+    expect(s_init, "Failed to create sparsearray");
+
+    for (uint64_t k = 0; k < 1000; k++) *(uint64_t *) sparsearray_put(&s, k * 5, sizeof(uint64_t)) = k;
+
+    expect(sparsearray_pack(&s), "Failed to pack sparsearray");
+    file = fopen(path, "wb");
+    expect(file != NULL, "Failed to create snapshot file");
+    s_save = sparsearray_save(&s, fileno(file));
+    fclose(file);
+    sparsearray_destroy(&s);
+    expect(s_save, "Failed to save sparsearray");
+
+    s_open = sparsearray_open_mapped(&mapped_s, &snap, path);
+    expect(s_open, "Failed to open sparsearray snapshot");
+    expect(sparsearray_count(&mapped_s) == 1000, "Unexpected count");
+
+    for (uint64_t k = 0; k < 1000; k++) expect(sparsearray_key(&mapped_s, k) == k * 5, "Unexpected key");
+
+    // Snapshots of other kinds are refused
+    expect(!hashtable_open_mapped(&mapped, &snap, path), "Unexpected hashtable opened from sparsearray snapshot");
+
+    snapshot_close(&snap);
+    remove(path);
+    succeed;
+}
+
+test hashtable_incremental_test() {
+    hashtable h;
+    bool h_init = hashtable_create(&h, 0, 0, 0);
+    expect(h_init, "Failed to create hashtable");
+    hashtable_rehash_incremental(&h, true);
+    bool migrated = false;
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t v = k * 3;
+        bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &v, sizeof(uint64_t));
+        expect(h_put, "Failed to insert into hashtable");
+        migrated = migrated || hashtable_rehash_remaining(&h) > 0;
+
+        // Remove every fourth key while entries may be split across old and
+        // new slots
+        if (k % 4 == 3) {
+            uint64_t r = k - 1;
+            bool h_remove = hashtable_remove(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &r, sizeof(uint64_t), sizeof(uint64_t));
+            expect(h_remove, "Failed to remove from hashtable");
+        }
+    }
+
+    expect(migrated, "Expected an incremental migration");
+    expect(hashtable_count(&h) == 7500, "Unexpected count");
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t));
+        expect((k % 4 == 2) == (v == NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 3, "Unexpected value");
+    }
+
+    size_t key_count = 0;
+    hashtable_iterator it = hashtable_iterate(&h);
+
+    while (hashtable_iterate_next(&it, sizeof(uint64_t), sizeof(uint64_t))) key_count++;
+
+    expect(key_count == 7500, "Unexpected iteration count");
+
+    while (hashtable_rehash_step(&h, (uint64_t (*)(void *)) hash_uint64_ptr, 100));
+
+    expect(hashtable_rehash_remaining(&h) == 0, "Expected migration to finish");
+    hashtable_destroy(&h);
+
+    hashtable_u64 ht;
+    bool ht_init = hashtable_create_u64(&ht, 0);
+    expect(ht_init, "Failed to create hashtable");
+    hashtable_rehash_incremental_u64(&ht, true);
+    migrated = false;
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        bool ht_put = hashtable_put_u64(&ht, k, k * 3);
+        expect(ht_put, "Failed to insert into hashtable");
+        migrated = migrated || hashtable_rehash_remaining_u64(&ht) > 0;
+
+        if (k % 4 == 3) {
+            bool ht_remove = hashtable_remove_u64(&ht, k - 1);
+            expect(ht_remove, "Failed to remove from hashtable");
+        }
+    }
+
+    expect(migrated, "Expected an incremental migration");
+    expect(hashtable_count_u64(&ht) == 7500, "Unexpected count");
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t *v = hashtable_get_u64(&ht, k);
+        expect((k % 4 == 2) == (v == NULL), "Unexpected presence of key");
+        expect(v == NULL || *v == k * 3, "Unexpected value");
+    }
+
+    key_count = 0;
+    hashtable_iterator_u64 itt = hashtable_iterate_u64(&ht);
+
+    while (hashtable_iterate_next_u64(&itt)) key_count++;
+
+    expect(key_count == 7500, "Unexpected iteration count");
+
+    while (hashtable_rehash_step_u64(&ht, 100));
+
+    expect(hashtable_rehash_remaining_u64(&ht) == 0, "Expected migration to finish");
+    hashtable_destroy_u64(&ht);
+    succeed;
+}
+
+test hashtable_concurrent_test() {
+    hashtable_concurrent h;
+    bool h_init = hashtable_concurrent_create(&h, 0, sizeof(uint64_t), sizeof(uint64_t));
+    expect(h_init, "Failed to create hashtable");
+    hashtable_concurrent_thread *t = hashtable_concurrent_register(&h);
+    expect(t != NULL, "Failed to register thread");
+
+    // Add enough keys to grow and retire several tables
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t v = k * 3;
+        bool h_put = hashtable_concurrent_put(&h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v);
+        expect(h_put, "Failed to insert into hashtable");
+    }
+
+    // Replace even values and remove odd keys
+    for (uint64_t k = 0; k < 10000; k++) {
+        if (k % 2 == 0) {
+            uint64_t v = k * 5;
+            bool h_put = hashtable_concurrent_put(&h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v);
+            expect(h_put, "Failed to insert into hashtable");
+        } else {
+            bool h_remove = hashtable_concurrent_remove(&h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k);
+            expect(h_remove, "Failed to remove from hashtable");
+        }
+    }
+
+    expect(hashtable_concurrent_count(&h) == 5000, "Unexpected count");
+
+    for (uint64_t k = 0; k < 10000; k++) {
+        uint64_t v;
+        bool h_get = hashtable_concurrent_get(&h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v);
+        expect((k % 2 == 0) == h_get, "Unexpected presence of key");
+        expect(!h_get || v == k * 5, "Unexpected value");
+    }
+
+    // A record given back is reused by the next thread to register
+    hashtable_concurrent_unregister(&h, t);
+    hashtable_concurrent_thread *t2 = hashtable_concurrent_register(&h);
+    expect(t2 == t, "Expected record to be reused");
+    hashtable_concurrent_thread *t3 = hashtable_concurrent_register(&h);
+    expect(t3 != NULL && t3 != t2, "Expected a new record");
+    hashtable_concurrent_unregister(&h, t3);
+    hashtable_concurrent_unregister(&h, t2);
+
+    hashtable_concurrent_destroy(&h);
+    succeed;
+}
+
+#define HASHTABLE_CONCURRENT_TEST_KEYS 4096
+#define HASHTABLE_CONCURRENT_TEST_ROUNDS 4
+#define HASHTABLE_CONCURRENT_TEST_WRITERS 2
+
+static hashtable_concurrent hashtable_concurrent_threaded;
+static volatile size_t hashtable_concurrent_threaded_writing;
+static volatile size_t hashtable_concurrent_threaded_errors;
+
+static void hashtable_concurrent_threaded_run(size_t index) {
+    hashtable_concurrent *h = &hashtable_concurrent_threaded;
+    hashtable_concurrent_thread *t = hashtable_concurrent_register(h);
+
+    if (t == NULL) {
+        sync_fetch_add(&hashtable_concurrent_threaded_errors, 1);
+        return;
+    }
+
+    if (index < HASHTABLE_CONCURRENT_TEST_WRITERS) {
+        // Writers put every key and remove the odd ones, over the same keys,
+        // so each odd key ends removed by whichever writer touches it last
+        for (size_t round = 0; round < HASHTABLE_CONCURRENT_TEST_ROUNDS; round++) {
+            for (uint64_t k = 0; k < HASHTABLE_CONCURRENT_TEST_KEYS; k++) {
+                uint64_t v = k * 3;
+
+                if (!hashtable_concurrent_put(h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v))
+                    sync_fetch_add(&hashtable_concurrent_threaded_errors, 1);
+            }
+
+            for (uint64_t k = 1; k < HASHTABLE_CONCURRENT_TEST_KEYS; k += 2)
+                hashtable_concurrent_remove(h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k);
+        }
+
+        sync_fetch_add(&hashtable_concurrent_threaded_writing, (size_t) -1);
+    } else {
+        // Readers only ever see complete entries, whose values match the key
+        uint64_t k = index;
+
+        while (sync_load(&hashtable_concurrent_threaded_writing) > 0) {
+            uint64_t v;
+            k = (k * 2654435761u + 1) % HASHTABLE_CONCURRENT_TEST_KEYS;
+
+            if (hashtable_concurrent_get(h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v) && v != k * 3)
+                sync_fetch_add(&hashtable_concurrent_threaded_errors, 1);
+        }
+    }
+
+    hashtable_concurrent_unregister(h, t);
+}
+
+test hashtable_concurrent_threaded_test() {
+    hashtable_concurrent *h = &hashtable_concurrent_threaded;
+    bool h_init = hashtable_concurrent_create(h, 0, sizeof(uint64_t), sizeof(uint64_t));
+    expect(h_init, "Failed to create hashtable");
+
+    // Start small so the table grows while readers use it
+    hashtable_concurrent_threaded_writing = HASHTABLE_CONCURRENT_TEST_WRITERS;
+    hashtable_concurrent_threaded_errors = 0;
+    test_threads(HASHTABLE_CONCURRENT_TEST_WRITERS + 2, hashtable_concurrent_threaded_run);
+    expect(hashtable_concurrent_threaded_errors == 0, "Unexpected value or failed call");
+    expect(hashtable_concurrent_count(h) == HASHTABLE_CONCURRENT_TEST_KEYS / 2, "Unexpected count");
+
+    hashtable_concurrent_thread *t = hashtable_concurrent_register(h);
+    expect(t != NULL, "Failed to register thread");
+
+    for (uint64_t k = 0; k < HASHTABLE_CONCURRENT_TEST_KEYS; k++) {
+        uint64_t v;
+        bool h_get = hashtable_concurrent_get(h, t, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, &v);
+        expect((k % 2 == 0) == h_get, "Unexpected presence of key");
+        expect(!h_get || v == k * 3, "Unexpected value");
+    }
+
+    hashtable_concurrent_unregister(h, t);
+    hashtable_concurrent_destroy(h);
+    succeed;
+}
+
+BUFFER_SEGMENTED_REGISTER_TYPE(u64, uint64_t)
+
+test buffer_segmented_test() {
+    buffer_segmented_u64 b;
+    bool b_init = buffer_segmented_create_u64(&b, 10);
+    expect(b_init, "Failed to create buffer");
+
+    for (uint64_t i = 0; i < 100; i++) *buffer_segmented_push_u64(&b) = i;
+
+    // Pointers stay valid as the buffer grows
+    uint64_t *first = buffer_segmented_get_u64(&b, 0);
+    uint64_t *middle = buffer_segmented_get_u64(&b, 50);
+
+    for (uint64_t i = 100; i < 100000; i++) {
+        uint64_t *v = buffer_segmented_push_u64(&b);
+        expect(v != NULL, "Failed to push to buffer");
+        *v = i;
+    }
+
+    expect(first == buffer_segmented_get_u64(&b, 0) && *first == 0, "Element moved");
+    expect(middle == buffer_segmented_get_u64(&b, 50) && *middle == 50, "Element moved");
+    expect(buffer_segmented_size_u64(&b) == 100000, "Unexpected size");
+
+    for (uint64_t i = 0; i < 100000; i++) expect(*buffer_segmented_get_u64(&b, i) == i, "Unexpected value");
+
+    // Popped elements are replaced in the same place
+    uint64_t *last = buffer_segmented_get_u64(&b, 99999);
+    buffer_segmented_pop_u64(&b);
+    expect(buffer_segmented_push_u64(&b) == last, "Unexpected place of pushed element");
+
+    // Values of a hashtable kept in the buffer, with the table holding their
+    // pointers
+    hashtable h;
+    hashtable_create(&h, 0, 0, 0);
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t *v = buffer_segmented_get_u64(&b, k * 7);
+        hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &v, sizeof(uint64_t *));
+    }
+
+    uint64_t key = 10;
+    uint64_t *held = *(uint64_t **) hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &key, sizeof(uint64_t), sizeof(uint64_t *));
+
+    for (uint64_t i = 0; i < 100000; i++) *buffer_segmented_push_u64(&b) = i;
+
+    expect(*held == 70, "Unexpected value through held pointer");
+
+    for (uint64_t k = 0; k < 1000; k++) {
+        uint64_t **v = hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), sizeof(uint64_t *));
+        expect(v != NULL && **v == k * 7, "Unexpected value in hashtable");
+    }
+
+    hashtable_destroy(&h);
+    buffer_segmented_destroy_u64(&b);
+    succeed;
+}
+
+QUEUE_REGISTER_TYPE(u64, uint64_t)
+
+test queue_test() {
+    queue_spsc_u64 s;
+    queue_mpmc_u64 m;
+    bool s_init = queue_spsc_create_u64(&s, 100);
+    bool m_init = queue_mpmc_create_u64(&m, 100);
+    expect(s_init && m_init, "Failed to create queues");
+    expect(s.q.capacity == 128 && m.q.capacity == 128, "Unexpected capacity");
+
+    // Go around the queues several times, filling them each time
+    uint64_t next = 0, expected = 0, v;
+
+    for (size_t lap = 0; lap < 5; lap++) {
+        for (size_t i = 0; i < 128; i++, next++) {
+            expect(queue_spsc_push_u64(&s, next) && queue_mpmc_push_u64(&m, next), "Failed to push");
+        }
+
+        expect(!queue_spsc_push_u64(&s, next) && !queue_mpmc_push_u64(&m, next), "Pushed to full queue");
+
+        for (size_t i = 0; i < 100; i++, expected++) {
+            expect(queue_spsc_pop_u64(&s, &v) && v == expected, "Unexpected value from spsc queue");
+            expect(queue_mpmc_pop_u64(&m, &v) && v == expected, "Unexpected value from mpmc queue");
+        }
+
+        for (size_t i = 100; i < 128; i++) {
+            queue_spsc_pop_u64(&s, &v);
+            queue_mpmc_pop_u64(&m, &v);
+        }
+
+        expected = next;
+        expect(!queue_spsc_pop_u64(&s, &v) && !queue_mpmc_pop_u64(&m, &v), "Popped from empty queue");
+    }
+
+    // Batches wrap around the end and stop when full or empty
+    uint64_t values[200], popped[200];
+
+    for (size_t i = 0; i < 200; i++) values[i] = i;
+
+    for (size_t i = 0; i < 100; i++) {
+        queue_spsc_push_u64(&s, 0);
+        queue_mpmc_push_u64(&m, 0);
+    }
+
+    queue_spsc_pop_batch_u64(&s, popped, 100);
+    queue_mpmc_pop_batch_u64(&m, popped, 100);
+    expect(queue_spsc_push_batch_u64(&s, values, 200) == 128, "Unexpected spsc batch push");
+    expect(queue_mpmc_push_batch_u64(&m, values, 200) == 128, "Unexpected mpmc batch push");
+
+    expect(queue_spsc_pop_batch_u64(&s, popped, 200) == 128, "Unexpected spsc batch pop");
+
+    for (size_t i = 0; i < 128; i++) expect(popped[i] == i, "Unexpected value from spsc batch");
+
+    expect(queue_mpmc_pop_batch_u64(&m, popped, 200) == 128, "Unexpected mpmc batch pop");
+
+    for (size_t i = 0; i < 128; i++) expect(popped[i] == i, "Unexpected value from mpmc batch");
+
+    queue_spsc_destroy_u64(&s);
+    queue_mpmc_destroy_u64(&m);
+    succeed;
+}
+
+#define QUEUE_TEST_VALUES 30000
+#define QUEUE_TEST_PRODUCERS 3
+
+static queue_spsc_u64 queue_threaded_spsc;
+static queue_mpmc_u64 queue_threaded_mpmc;
+static volatile size_t queue_threaded_count;
+static volatile size_t queue_threaded_sum;
+static volatile size_t queue_threaded_errors;
+
+static void queue_threaded_spsc_run(size_t index) {
+    // Alternates single values with batches of changing size on both sides,
+    // the consumer checking the values arrive in the order pushed
+    uint64_t values[37];
+    uint64_t next = 0;
+
+    for (size_t round = 0; next < QUEUE_TEST_VALUES; round++) {
+        size_t batch = round % 37 + 1;
+
+        if (index == 0) {
+            size_t pushed;
+
+            if (batch == 1) {
+                pushed = queue_spsc_push_u64(&queue_threaded_spsc, next) ? 1 : 0;
+            } else {
+                if (batch > QUEUE_TEST_VALUES - next) batch = QUEUE_TEST_VALUES - next;
+
+                for (size_t i = 0; i < batch; i++) values[i] = next + i;
+
+                pushed = queue_spsc_push_batch_u64(&queue_threaded_spsc, values, batch);
+            }
+
+            next += pushed;
+
+            if (pushed == 0) sync_yield();
+        } else {
+            size_t popped;
+
+            if (batch == 1) {
+                popped = queue_spsc_pop_u64(&queue_threaded_spsc, values) ? 1 : 0;
+            } else {
+                popped = queue_spsc_pop_batch_u64(&queue_threaded_spsc, values, batch);
+            }
+
+            for (size_t i = 0; i < popped; i++, next++) {
+                if (values[i] != next) queue_threaded_errors++;
+
+                queue_threaded_sum += (size_t) values[i];
+            }
+
+            queue_threaded_count += popped;
+
+            if (popped == 0) sync_yield();
+        }
+    }
+}
+
+static void queue_threaded_mpmc_run(size_t index) {
+    // Producers push their index times the number of values each plus a
+    // sequence. Values from one producer reach each consumer in order.
+    uint64_t values[16];
+
+    if (index < QUEUE_TEST_PRODUCERS) {
+        uint64_t next = 0;
+
+        for (size_t round = 0; next < QUEUE_TEST_VALUES; round++) {
+            size_t batch = round % 16 + 1;
+
+            if (batch > QUEUE_TEST_VALUES - next) batch = QUEUE_TEST_VALUES - next;
+
+            for (size_t i = 0; i < batch; i++) values[i] = index * QUEUE_TEST_VALUES + next + i;
+
+            size_t pushed;
+
+            if (batch == 1) {
+                pushed = queue_mpmc_push_u64(&queue_threaded_mpmc, values[0]) ? 1 : 0;
+            } else {
+                pushed = queue_mpmc_push_batch_u64(&queue_threaded_mpmc, values, batch);
+            }
+
+            next += pushed;
+
+            if (pushed == 0) sync_yield();
+        }
+    } else {
+        uint64_t last[QUEUE_TEST_PRODUCERS];
+        bool seen[QUEUE_TEST_PRODUCERS] = { false };
+
+        for (size_t round = 0; sync_load(&queue_threaded_count) < QUEUE_TEST_PRODUCERS * QUEUE_TEST_VALUES; round++) {
+            size_t batch = round % 16 + 1;
+            size_t popped;
+
+            if (batch == 1) {
+                popped = queue_mpmc_pop_u64(&queue_threaded_mpmc, values) ? 1 : 0;
+            } else {
+                popped = queue_mpmc_pop_batch_u64(&queue_threaded_mpmc, values, batch);
+            }
+
+            for (size_t i = 0; i < popped; i++) {
+                size_t producer = (size_t) (values[i] / QUEUE_TEST_VALUES);
+
+                if (producer >= QUEUE_TEST_PRODUCERS || (seen[producer] && values[i] <= last[producer])) {
+                    sync_fetch_add(&queue_threaded_errors, 1);
+                    continue;
+                }
+
+                seen[producer] = true;
+                last[producer] = values[i];
+                sync_fetch_add(&queue_threaded_sum, (size_t) values[i]);
+            }
+
+            if (popped == 0) {
+                sync_yield();
+            } else {
+                sync_fetch_add(&queue_threaded_count, popped);
+            }
+        }
+    }
+}
+
+test queue_threaded_test() {
+    bool s_init = queue_spsc_create_u64(&queue_threaded_spsc, 64);
+    bool m_init = queue_mpmc_create_u64(&queue_threaded_mpmc, 64);
+    expect(s_init && m_init, "Failed to create queues");
+
+    // One producer and one consumer, each value arriving once and in order
+    queue_threaded_count = 0;
+    queue_threaded_sum = 0;
+    queue_threaded_errors = 0;
+    test_threads(2, queue_threaded_spsc_run);
+    expect(queue_threaded_errors == 0, "Unexpected order from spsc queue");
+    expect(queue_threaded_count == QUEUE_TEST_VALUES, "Unexpected count from spsc queue");
+    expect(queue_threaded_sum == (size_t) QUEUE_TEST_VALUES * (QUEUE_TEST_VALUES - 1) / 2, "Unexpected sum from spsc queue");
+
+    // Several of each, values of every producer arriving once
+    size_t total = (size_t) QUEUE_TEST_PRODUCERS * QUEUE_TEST_VALUES;
+    queue_threaded_count = 0;
+    queue_threaded_sum = 0;
+    test_threads(QUEUE_TEST_PRODUCERS * 2, queue_threaded_mpmc_run);
+    expect(queue_threaded_errors == 0, "Unexpected order from mpmc queue");
+    expect(queue_threaded_count == total, "Unexpected count from mpmc queue");
+    expect(queue_threaded_sum == total * (total - 1) / 2, "Unexpected sum from mpmc queue");
+
+    uint64_t v;
+    expect(!queue_spsc_pop_u64(&queue_threaded_spsc, &v) && !queue_mpmc_pop_u64(&queue_threaded_mpmc, &v), "Expected queues to be empty");
+
+    queue_spsc_destroy_u64(&queue_threaded_spsc);
+    queue_mpmc_destroy_u64(&queue_threaded_mpmc);
+    succeed;
+}
+
+test allocator_test() {
+    allocator_arena arena;
+    allocator_arena_create(&arena, 1024);
+
+    // Allocations are aligned, and the last one grows and shrinks in place
+    uint8_t *a = allocator_allocate(&arena.allocator, 3);
+    uint8_t *b = allocator_allocate(&arena.allocator, 100);
+    expect(a != NULL && b != NULL, "Failed to allocate from arena");
+    expect((uintptr_t) a % 16 == 0 && (uintptr_t) b % 16 == 0, "Unaligned allocation");
+    memset(b, 7, 100);
+    expect(allocator_reallocate(&arena.allocator, b, 100, 500) == b, "Expected last allocation to grow in place");
+    expect(b[99] == 7, "Unexpected data after growing");
+    uint8_t *c = allocator_reallocate(&arena.allocator, a, 3, 64);
+    expect(c != NULL && c != a, "Expected allocation to move");
+
+    // Larger than a chunk
+    uint8_t *large = allocator_allocate(&arena.allocator, 5000);
+    expect(large != NULL, "Failed to allocate from arena");
+    memset(large, 1, 5000);
+
+    // Datastructures created in the arena are freed by resetting it
+    for (int round = 0; round < 3; round++) {
+        allocator_arena_reset(&arena);
+        expect(allocator_allocate(&arena.allocator, 16) == a, "Expected reset to reuse the first chunk");
+
+        buffer buf;
+        expect(buffer_create_in(&buf, &arena.allocator, 2), "Failed to create buffer");
+
+        for (size_t i = 0; i < 1000; i++) *(size_t *) buffer_push(&buf, sizeof(size_t)) = i;
+
+        string *str = string_create_in(&arena.allocator, 4);
+        str = string_append_chars(str, 11, (uint8_t *) "hello arena");
+        expect(str != NULL && string_size(str) == 11, "Failed to append to string");
+
+        sparsearray s;
+        expect(sparsearray_create_tree_in(&s, &arena.allocator, sizeof(uint64_t)), "Failed to create sparsearray");
+
+        for (uint64_t key = 0; key < 1000; key++) *(uint64_t *) sparsearray_put(&s, key * 7, sizeof(uint64_t)) = key;
+
+        hashtable h;
+        expect(hashtable_create_in(&h, &arena.allocator, 0, 0, 0), "Failed to create hashtable");
+
+        for (uint64_t k = 0; k < 1000; k++) {
+            bool h_put = hashtable_put(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &k, sizeof(uint64_t), &k, sizeof(uint64_t));
+            expect(h_put, "Failed to insert into hashtable");
+        }
+
+        for (size_t i = 0; i < 1000; i++) expect(*(size_t *) buffer_get(&buf, i * sizeof(size_t)) == i, "Unexpected value");
+
+        for (uint64_t key = 0; key < 1000; key++) {
+            expect(*(uint64_t *) sparsearray_get(&s, key * 7, sizeof(uint64_t)) == key, "Unexpected value");
+            uint64_t *v = hashtable_get(&h, (uint64_t (*)(void *)) hash_uint64_ptr, (bool (*)(void *, void *)) equals_uint64_ptr, &key, sizeof(uint64_t), sizeof(uint64_t));
+            expect(v != NULL && *v == key, "Unexpected value");
+        }
+    }
+
+    allocator_arena_destroy(&arena);
+
+    // Freed blocks are handed out again by the cache
+    allocator_cache cache;
+    allocator_cache_create(&cache);
+    void *block = allocator_allocate(&cache.allocator, 20);
+    allocator_free(&cache.allocator, block, 20);
+    expect(allocator_allocate(&cache.allocator, 30) == block, "Expected cached block");
+    expect(allocator_reallocate(&cache.allocator, block, 30, 32) == block, "Expected block to have room");
+    block = allocator_reallocate(&cache.allocator, block, 32, 10000);
+    expect(block != NULL, "Failed to reallocate");
+    allocator_free(&cache.allocator, block, 10000);
+
+    for (int round = 0; round < 2; round++) {
+        string *str = string_create_in(&cache.allocator, 8);
+
+        for (int i = 0; i < 100; i++) str = string_append_char(str, 'a');
+
+        expect(str != NULL && string_size(str) == 100, "Failed to append to string");
+        string_free(str);
+    }
+
+    allocator_cache_destroy(&cache);
+    succeed;
+}
+
 test string_test() {
     // Test equality.
     string *a = string_create(3);
@@ -251,10 +2063,37 @@ test string_test() {
 int main() {
     tests_start("Utilities");
     test_run(buffer_test);
+    test_run(buffer_small_test);
+    test_run(buffer_pages_test);
+    test_run(buffer_map_file_test);
+    test_run(buffer_io_test);
+    test_run(buffer_gap_test);
+    test_run(buffer_ring_test);
+    test_run(buffer_ring_typed_test);
+    test_run(buffer_segmented_test);
     test_run(buffer_typed_test);
     test_run(sparsearray_test);
+    test_run(sparsearray_tree_test);
+    test_run(sparsearray_index_test);
+    test_run(sparsearray_range_test);
+    test_run(sparsearray_packed_test);
+    test_run(sparsearray_dense_test);
+    test_run(sparsearray_snapshot_test);
+    test_run(sparsearray_bulk_test);
     test_run(hashtable_test);
     test_run(hashtable_typed_test);
+    test_run(hashtable_grow_test);
+    test_run(hashtable_batch_test);
+    test_run(hashtable_hashed_test);
+    test_run(hashtable_bytes_test);
+    test_run(hashtable_incremental_test);
+    test_run(hashtable_stats_test);
+    test_run(hashtable_snapshot_test);
+    test_run(hashtable_concurrent_test);
+    test_run(hashtable_concurrent_threaded_test);
+    test_run(queue_test);
+    test_run(queue_threaded_test);
+    test_run(allocator_test);
     test_run(string_test);
     tests_finish;
     getchar();